@@ -0,0 +1,34 @@
+// Regression limits for the on-device benchmarks served at /bench
+// (build the bench environment: pio run -e bench -t upload)
+// A case fails when it is slower than maxNsPerOp or allocates more than
+// maxAllocsPerOp per call; a time limit of 0 is not checked.
+// No board has been measured yet, so the device table only holds the exact
+// allocation limits: run /bench on an ESP32 at 240 MHz and fill in the
+// measured ns/op plus some headroom. Until then the time of the same cases is
+// guarded on the host by test/test_bench (pio test -e native).
+#pragma once
+
+struct BenchThreshold {
+  const char* name;
+  unsigned long maxNsPerOp;
+  unsigned long maxAllocsPerOp;
+};
+
+const BenchThreshold BENCH_THRESHOLDS[] = {
+  { "utf8_decode",      0, 0 },  // ~120 byte mixed Icelandic/ASCII message
+  { "utf8_decode_512",  0, 0 },  // Same text repeated to MAX_MESSAGE_BYTES, for throughput
+  { "layout",           0, 0 },  // The ~120 byte message, 12pt
+  { "layout_9pt",       0, 0 },  // 200 character message at each fixed size
+  { "layout_12pt",      0, 0 },
+  { "layout_18pt",      0, 0 },
+  { "layout_24pt",      0, 0 },
+  { "raster",           0, 0 },  // Its glyph runs into a cleared frame
+  { "raster_cold",      0, 0 },  // Same, every glyph bitmap read from LittleFS (built-in fonts: as raster)
+  { "message_update",   0, 0 },  // Submit path: copy + trim, decode, layout, raster
+  { "autofit",          0, 0 },  // Largest size a 200 character message fits at, nothing memoized
+  { "autofit_edit",     0, 0 },  // Same after a one character edit
+  { "page_escape",      0, 0 },  // HTML escaping the message for the page
+  { "qr_generate",      0, 0 },  // WiFi QR code, version 3
+  { "qr_draw",          0, 0 },  // Same code at scale 5
+  { "frame_to_panel",   0, 0 },  // Whole frame transposed for the panel
+};
@@ -0,0 +1,55 @@
+// Logging: levels are fixed at compile time (build flag -D LOG_LEVEL=...),
+// calls above the level compile to nothing. logWrite() and logHexDump() are
+// in main.cpp
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+void logWrite(uint8_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+// Trace the bytes of a string as hex, split over several entries
+void logHexDump(const char* label, const char* data, size_t length);
+
+// A disabled level still compiles its call, so variables only logged are not
+// reported as unused, and the optimizer drops it
+#define LOG_DISABLED(level, ...) do { if (0) logWrite(level, __VA_ARGS__); } while (0)
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_DISABLED(LOG_LEVEL_ERROR, __VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logWrite(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_DISABLED(LOG_LEVEL_WARN, __VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logWrite(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISABLED(LOG_LEVEL_INFO, __VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISABLED(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) logWrite(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) LOG_DISABLED(LOG_LEVEL_TRACE, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_HEXDUMP(label, data, length) logHexDump(label, data, length)
+#else
+#define LOG_HEXDUMP(label, data, length) do { if (0) logHexDump(label, data, length); } while (0)
+#endif
@@ -1,13 +1,43 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <WebServer.h>
+#include <lwip/sockets.h>
+#include <esp_vfs_eventfd.h>
+#include <unistd.h>
 #include <GxEPD2_BW.h>
-#include <Fonts/FreeMonoBold9pt7b.h>
-#include <Fonts/FreeMonoBold12pt7b.h>
-#include <Fonts/FreeMonoBold18pt7b.h>
-#include <Fonts/FreeMonoBold24pt7b.h>
+#include <SPI.h>
+// FreeMonoBold with precomposed Latin-1 and Latin Extended-A glyphs (U+0020..U+017F),
+// generated at build time by tools/gen_fonts.py
+// Message fonts are read from LittleFS (see getFont()), only the 9 pt font for
+// the QR screen is linked in; build with -D FONTS_BUILTIN=1 to link all sizes
+#ifndef FONTS_BUILTIN
+#define FONTS_BUILTIN 0
+#endif
+#include "FreeMonoBoldLatin9pt.h"
+#if FONTS_BUILTIN
+#include "FreeMonoBoldLatin12pt.h"
+#include "FreeMonoBoldLatin18pt.h"
+#include "FreeMonoBoldLatin24pt.h"
+#endif
 #include <qrcode.h>
 #include <Preferences.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <WebSocketsServer.h>
+#include <rom/crc.h>
+#include <atomic>
+#include <stdarg.h>
+#include <limits.h>
+#include "log.h"
+#include "multi_web_server.h"
+
+// Benchmarks of the hot paths at /bench, enabled by the bench environment
+#ifndef ENABLE_BENCH
+#define ENABLE_BENCH 0
+#endif
+#if ENABLE_BENCH
+#include "bench_thresholds.h"
+#include <new>
+#endif
 
 // Pin definitions for ESP32
 #define EPD_CS      5   // Chip Select
@@ -15,559 +45,3649 @@
 #define EPD_RST     16  // Reset
 #define EPD_BUSY    4   // Busy
 
-// WiFi Access Point credentials
-const char* ssid = "ESP32-E-Paper";
-const char* password = "12345678";  // Change this if you want
+// Panel SPI clock, GxEPD2 defaults to 4 MHz (build flag -D EPD_SPI_HZ=... to change)
+#ifndef EPD_SPI_HZ
+#define EPD_SPI_HZ 10000000
+#endif
+
+// WiFi Access Point credentials
+const char* ssid = "ESP32-E-Paper";
+const char* password = "12345678";  // Change this if you want
+
+// WebSocket on port 81 pushing render-complete events to API clients
+WebSocketsServer webSocket(81);
+
+// Message text: UTF-8 in a fixed, zero-terminated buffer
+// Everything from a submit to the render task passes these (or pointer and
+// length) along, so updating the display does not touch the heap
+#define MAX_MESSAGE_BYTES 512
+// The page's form allows MAX_MESSAGE_BYTES letters of up to two bytes, sent
+// URL-encoded in one request buffer together with the head
+static_assert(MAX_MESSAGE_BYTES * 6 + 512 <= HTTP_MAX_REQUEST, "a full form message does not fit a request");
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+struct MessageBuffer {
+  char text[MAX_MESSAGE_BYTES + 1];
+  size_t len;
+  
+  MessageBuffer() : len(0) { text[0] = '\0'; }
+  explicit MessageBuffer(const char* s) { assign(s); }
+  
+  // Copy in data, cut to MAX_MESSAGE_BYTES without splitting a UTF-8 sequence
+  // data may point into this buffer
+  void assign(const char* data, size_t n) {
+    if (n > MAX_MESSAGE_BYTES) {
+      n = MAX_MESSAGE_BYTES;
+      while (n > 0 && ((uint8_t)data[n] & 0xC0) == 0x80) n--;
+    }
+    memmove(text, data, n);
+    text[n] = '\0';
+    len = n;
+  }
+  void assign(const char* s) { assign(s, strlen(s)); }
+  
+  // Strip surrounding whitespace in place, like String::trim()
+  void trim() {
+    size_t start = 0;
+    while (start < len && isspace((uint8_t)text[start])) start++;
+    size_t end = len;
+    while (end > start && isspace((uint8_t)text[end - 1])) end--;
+    assign(text + start, end - start);
+  }
+  
+  const char* c_str() const { return text; }
+  size_t length() const { return len; }
+};
+
+// Store the message to display
+MessageBuffer displayMessage("Hello World!");
+
+// Store the font size (1=small, 2=medium, 3=large, 4=xlarge, 5=auto-fit)
+#define FONT_SIZES 4      // Fixed sizes
+#define FONT_SIZE_AUTO 5  // Largest fixed size the message fits in, picked when it is laid out
+int fontSize = 2; // Default to medium (12pt)
+
+inline bool isFontSize(int size) { return size >= 1 && size <= FONT_SIZE_AUTO; }
+
+// E-paper display
+// Drawing goes through the frame rasterizer below, so the library's own page
+// buffer is kept small (it is only used by init)
+GxEPD2_BW<GxEPD2_370_GDEY037T03, GxEPD2_370_GDEY037T03::HEIGHT / 8> display(GxEPD2_370_GDEY037T03(EPD_CS, EPD_DC, EPD_RST, EPD_BUSY));
+
+// Preferences for storing data in NVS (Non-Volatile Storage)
+Preferences preferences;
+
+// Track boot time and QR code display duration
+unsigned long bootTime = 0;
+const unsigned long QR_DISPLAY_DURATION = 60000; // 1 minute in milliseconds
+bool showingQRCode = true;
+
+// Logging (macros in log.h): kept messages go into a lock-free ring buffer
+// that a low priority task drains to Serial, so logging never blocks on the UART
+#define LOG_ENTRIES 32     // Ring buffer size, must be a power of two
+#define LOG_TEXT_LEN 96    // Longer messages are truncated
+struct LogEntry {
+  std::atomic<uint32_t> seq;  // Sequence number + 1 once written, 0 while being written
+  uint32_t time;
+  uint8_t level;
+  char text[LOG_TEXT_LEN];
+};
+LogEntry logRing[LOG_ENTRIES];
+std::atomic<uint32_t> logHead(0);     // Next sequence number to hand out
+std::atomic<uint32_t> logDropped(0);  // Entries overwritten before they were drained
+uint32_t logTail = 0;                 // Next sequence number to drain (drain task only)
+
+void logWrite(uint8_t level, const char* format, ...) {
+  uint32_t seq = logHead.fetch_add(1);
+  LogEntry &entry = logRing[seq & (LOG_ENTRIES - 1)];
+  entry.seq.store(0, std::memory_order_relaxed);
+  entry.time = millis();
+  entry.level = level;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(entry.text, LOG_TEXT_LEN, format, args);
+  va_end(args);
+  entry.seq.store(seq + 1, std::memory_order_release);
+}
+
+// Copy out the entry with the given sequence number
+// Returns false if it is not written yet or was already overwritten
+bool logRead(uint32_t seq, LogEntry &out) {
+  LogEntry &entry = logRing[seq & (LOG_ENTRIES - 1)];
+  if (entry.seq.load(std::memory_order_acquire) != seq + 1) return false;
+  out.time = entry.time;
+  out.level = entry.level;
+  memcpy(out.text, entry.text, LOG_TEXT_LEN);
+  // A writer may have reused the slot while we were copying
+  return entry.seq.load(std::memory_order_acquire) == seq + 1;
+}
+
+const char LOG_LEVEL_LETTERS[] = "-EWIDT";
+
+// Serial frames: 0xA5, type, seq, payload length (u16 LE), payload, CRC-32
+// (LE, zlib's) of type through payload. Carries the serial control protocol
+// (see serialCommand()); once a host has sent a valid frame, log entries go
+// out as SERIAL_LOG frames too, so text can't land in the middle of a reply
+#define SERIAL_SYNC 0xA5
+#define SERIAL_MAX_PAYLOAD 1024
+enum SerialType {
+  SERIAL_HELLO = 0x01,         // -> version u8, max payload u16, baud rate u32
+  SERIAL_SET_BAUD = 0x02,      // baud rate u32, the reply still goes out at the old rate
+  SERIAL_SET_MESSAGE = 0x10,   // font u8 (0 = keep), flags u8 (bit 0 = full refresh), UTF-8 text -> seq u32
+  SERIAL_SET_FONT = 0x11,      // font u8 -> seq u32
+  SERIAL_IMAGE_START = 0x20,   // format u8 (0 PBM, 1 raw, 2 RLE), body length u32
+  SERIAL_IMAGE_DATA = 0x21,    // Next body bytes
+  SERIAL_IMAGE_END = 0x22,     // -> seq u32
+  SERIAL_READ_METRICS = 0x30,  // -> "name value" lines
+  SERIAL_LOG = 0x7F,           // Device to host: time u32, level u8, text
+  SERIAL_REPLY = 0x80          // Set in the type of replies, same seq as the command
+};
+std::atomic<bool> serialFramed(false);
+SemaphoreHandle_t serialTxMutex = NULL;  // One frame or log line at a time
+uint32_t serialFrames = 0;     // Valid frames received
+uint32_t serialBadFrames = 0;  // Failed the CRC or length check
+
+void serialSendFrame(uint8_t type, uint8_t seq, const uint8_t* payload, size_t length) {
+  uint8_t header[5] = { SERIAL_SYNC, type, seq, (uint8_t)length, (uint8_t)(length >> 8) };
+  uint32_t crc = crc32_le(0, header + 1, 4);
+  crc = crc32_le(crc, payload, length);
+  uint8_t trailer[4] = { (uint8_t)crc, (uint8_t)(crc >> 8), (uint8_t)(crc >> 16), (uint8_t)(crc >> 24) };
+  xSemaphoreTake(serialTxMutex, portMAX_DELAY);
+  Serial.write(header, sizeof(header));
+  Serial.write(payload, length);
+  Serial.write(trailer, sizeof(trailer));
+  xSemaphoreGive(serialTxMutex);
+}
+
+// Drain task: prints buffered log entries to Serial
+void logDrainTask(void* parameter) {
+  static LogEntry entry;
+  for (;;) {
+    uint32_t head = logHead.load(std::memory_order_acquire);
+    if (head - logTail > LOG_ENTRIES) {
+      // Fell behind, skip what has been overwritten
+      logDropped += head - logTail - LOG_ENTRIES;
+      logTail = head - LOG_ENTRIES;
+    }
+    while (logTail != head) {
+      LogEntry &slot = logRing[logTail & (LOG_ENTRIES - 1)];
+      if (slot.seq.load(std::memory_order_acquire) == 0) break;  // Still being written
+      if (!logRead(logTail, entry)) {
+        logDropped++;
+      } else if (serialFramed) {
+        uint8_t payload[5 + LOG_TEXT_LEN];
+        size_t length = strnlen(entry.text, LOG_TEXT_LEN - 1);
+        memcpy(payload, &entry.time, 4);  // Little-endian like the rest of the frame
+        payload[4] = entry.level;
+        memcpy(payload + 5, entry.text, length);
+        serialSendFrame(SERIAL_LOG, 0, payload, 5 + length);
+      } else {
+        xSemaphoreTake(serialTxMutex, portMAX_DELAY);
+        Serial.printf("[%lu] %c %s\n", (unsigned long)entry.time, LOG_LEVEL_LETTERS[entry.level], entry.text);
+        xSemaphoreGive(serialTxMutex);
+      }
+      logTail++;
+    }
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+}
+
+void startLogTask() {
+  serialTxMutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(logDrainTask, "log", 3072, NULL, tskIDLE_PRIORITY + 1, NULL, 1);
+}
+
+// Trace the bytes of a string as hex, split over several entries
+void logHexDump(const char* label, const char* data, size_t length) {
+  char line[LOG_TEXT_LEN];
+  int pos = 0;
+  for (size_t i = 0; i < length; i++) {
+    pos += snprintf(line + pos, sizeof(line) - pos, "%02X ", (unsigned char)data[i]);
+    if (pos > LOG_TEXT_LEN - 24 || i == length - 1) {
+      LOG_TRACE("%s: %s", label, line);
+      pos = 0;
+    }
+  }
+}
+
+// Boot timing: setup() runs as a series of stages, each stamped in us since
+// the app started, plus milestones reached later by other tasks
+// Reported on serial once setup() is done and at /boot
+#define BOOT_MAX_STAGES 10
+struct BootStage {
+  const char* name;
+  uint32_t time;
+};
+BootStage bootStages[BOOT_MAX_STAGES];
+int bootStageCount = 0;
+volatile uint32_t bootDisplayReady = 0;   // Render task: display.init() done
+volatile uint32_t bootFirstRender = 0;    // Render task: first panel refresh done
+volatile uint32_t bootFirstResponse = 0;  // First HTTP 200 sent
+
+// Mark the end of a setup() stage (only called from setup())
+void bootStage(const char* name) {
+  if (bootStageCount >= BOOT_MAX_STAGES) return;
+  bootStages[bootStageCount].name = name;
+  bootStages[bootStageCount].time = micros();
+  bootStageCount++;
+}
+
+// Milestones only get their first time
+void bootMilestone(volatile uint32_t &milestone) {
+  if (milestone == 0) milestone = micros();
+}
+
+// Metrics: scoped cycle-counter timers feeding fixed-bucket latency histograms,
+// served at /metrics in Prometheus text format
+// Build with -D ENABLE_METRICS=0 to compile all of it out
+#ifndef ENABLE_METRICS
+#define ENABLE_METRICS 1
+#endif
+#if ENABLE_METRICS
+// Bucket upper bounds in microseconds, one more bucket catches everything above
+const uint32_t METRIC_BUCKETS_US[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000,
+                                       25000, 50000, 100000, 250000, 500000, 1000000, 2500000 };
+#define METRIC_BUCKET_COUNT (sizeof(METRIC_BUCKETS_US) / sizeof(METRIC_BUCKETS_US[0]))
+
+// The decode, layout and raster histograms are recorded from both the render
+// task and loop(), on different cores: updates and the /metrics snapshot go
+// through metricLock, a spinlock held for a handful of instructions
+portMUX_TYPE metricLock = portMUX_INITIALIZER_UNLOCKED;
+
+struct Histogram {
+  const char* name;
+  const char* help;
+  uint32_t buckets[METRIC_BUCKET_COUNT + 1];
+  uint32_t count;
+  uint64_t sumUs;
+  
+  Histogram(const char* name, const char* help) : name(name), help(help), buckets(), count(0), sumUs(0) {}
+  
+  void record(uint32_t us) {
+    size_t i = 0;
+    while (i < METRIC_BUCKET_COUNT && us > METRIC_BUCKETS_US[i]) i++;
+    portENTER_CRITICAL(&metricLock);
+    buckets[i]++;
+    count++;
+    sumUs += us;
+    portEXIT_CRITICAL(&metricLock);
+  }
+  
+  // All of it from the same moment
+  Histogram snapshot() const {
+    portENTER_CRITICAL(&metricLock);
+    Histogram copy = *this;
+    portEXIT_CRITICAL(&metricLock);
+    return copy;
+  }
+};
+
+Histogram requestMetric("epaper_request_seconds", "HTTP request handling time");
+Histogram utf8Metric("epaper_utf8_decode_seconds", "UTF-8 decoding of a message");
+Histogram layoutMetric("epaper_layout_seconds", "Text layout of a message");
+Histogram rasterMetric("epaper_raster_seconds", "Rasterizing a layout into the frame");
+Histogram pageMetric("epaper_page_render_seconds", "Streaming the HTML page");
+Histogram spiMetric("epaper_spi_transfer_seconds", "Sending image data to the panel");
+Histogram busyMetric("epaper_busy_wait_seconds", "Waiting for the panel refresh (BUSY)");
+Histogram* const METRICS[] = { &requestMetric, &utf8Metric, &layoutMetric, &rasterMetric,
+                               &pageMetric, &spiMetric, &busyMetric };
+
+// Records the time from construction to the end of the scope
+// micros() runs off esp_timer, not the CPU cycle counter, so a span stays
+// right when the power policy changes the CPU clock in the middle of it
+// (a request that wakes the device does)
+struct ScopedTimer {
+  Histogram &histogram;
+  unsigned long start;
+  explicit ScopedTimer(Histogram &h) : histogram(h), start(micros()) {}
+  ~ScopedTimer() { histogram.record(micros() - start); }
+};
+#define METRIC_TIMER(histogram) ScopedTimer histogram##Timer(histogram)
+#else
+#define METRIC_TIMER(histogram) do {} while (0)
+#endif
+
+// Web server on port 80 (multi_web_server.cpp)
+MultiWebServer server(80);
+
+// Frame rasterizer: everything is drawn into a packed 1bpp frame in the
+// rotated (landscape) orientation, 1 = black, rows MSB first like PBM.
+// Rows are handled as 32-bit words, the finished frame is sent to the panel
+// with one writeImage and one refresh
+#define FRAME_WIDTH  GxEPD2_370_GDEY037T03::HEIGHT  // 416, panel is used rotated
+#define FRAME_HEIGHT GxEPD2_370_GDEY037T03::WIDTH   // 240
+#define FRAME_WORDS_PER_ROW (FRAME_WIDTH / 32)
+#define FRAME_BYTES_PER_ROW (FRAME_WIDTH / 8)
+struct FrameBuffer {
+  uint32_t rows[FRAME_HEIGHT][FRAME_WORDS_PER_ROW];
+};
+FrameBuffer frame;
+
+// Native panel orientation (240 x 416) for the transfer, see pushFrame()
+uint8_t panelBuffer[GxEPD2_370_GDEY037T03::WIDTH / 8 * GxEPD2_370_GDEY037T03::HEIGHT];
+
+// The frame is locked by the render task while it draws, by an image upload
+// while it decodes and by /screen while it sends it. The render task lets go
+// as soon as the frame is converted into panelBuffer, the transfer and
+// refresh run from that copy
+SemaphoreHandle_t frameMutex = NULL;
+bool renderHoldsFrame = false;  // Only used by the render task
+
+void releaseFrame() {
+  if (!renderHoldsFrame) return;
+  renderHoldsFrame = false;
+  xSemaphoreGive(frameMutex);
+}
+
+// Words are stored so their bytes are in pixel order, pixel 0 in the MSB of
+// byte 0. Masks are built big-endian (pixel 0 = bit 31) and swapped
+inline uint32_t pixelMask(uint32_t bigEndianMask) {
+  return __builtin_bswap32(bigEndianMask);
+}
+
+void frameClear(FrameBuffer &fb) {
+  memset(fb.rows, 0, sizeof(fb.rows));
+}
+
+// Set pixels [x0, x1) of row y
+void frameFillSpan(FrameBuffer &fb, int x0, int x1, int y) {
+  if (y < 0 || y >= FRAME_HEIGHT) return;
+  if (x0 < 0) x0 = 0;
+  if (x1 > FRAME_WIDTH) x1 = FRAME_WIDTH;
+  if (x0 >= x1) return;
+  uint32_t* row = fb.rows[y];
+  int firstWord = x0 >> 5;
+  int lastWord = (x1 - 1) >> 5;
+  uint32_t headMask = 0xFFFFFFFFu >> (x0 & 31);
+  uint32_t tailMask = 0xFFFFFFFFu << (31 - ((x1 - 1) & 31));
+  if (firstWord == lastWord) {
+    row[firstWord] |= pixelMask(headMask & tailMask);
+    return;
+  }
+  row[firstWord] |= pixelMask(headMask);
+  for (int w = firstWord + 1; w < lastWord; w++) row[w] = 0xFFFFFFFFu;
+  row[lastWord] |= pixelMask(tailMask);
+}
+
+void frameFillRect(FrameBuffer &fb, int x, int y, int w, int h) {
+  for (int row = y; row < y + h; row++) frameFillSpan(fb, x, x + w, row);
+}
+
+// OR up to 32 pixels (big-endian, first pixel in bit 31) into row y at x
+inline void frameOrBits(FrameBuffer &fb, uint32_t bits, int x, int y) {
+  if (y < 0 || y >= FRAME_HEIGHT || x >= FRAME_WIDTH) return;
+  if (x < 0) {
+    if (x <= -32) return;
+    bits <<= -x;
+    x = 0;
+  }
+  int word = x >> 5;
+  int shift = x & 31;
+  fb.rows[y][word] |= pixelMask(bits >> shift);
+  if (shift && word + 1 < FRAME_WORDS_PER_ROW) fb.rows[y][word + 1] |= pixelMask(bits << (32 - shift));
+}
+
+// Draw one glyph from its packed bitmap with its pen at (x, y) on the baseline
+// Each glyph row is pulled out of the bitmap as one word and ORed in
+// Returns the advance width
+int frameDrawGlyph(FrameBuffer &fb, const GFXglyph &glyph, const uint8_t* bitmap, int x, int y) {
+  uint32_t bit = 0;
+  int gx = x + glyph.xOffset;
+  int gy = y + glyph.yOffset;
+  for (int row = 0; row < glyph.height; row++) {
+    for (int col = 0; col < glyph.width; col += 32) {
+      int count = glyph.width - col;
+      if (count > 32) count = 32;
+      // Gather count bits starting at bit from the continuous glyph bitstream
+      uint32_t bits = 0;
+      for (int n = 0; n < count; ) {
+        uint32_t b = bit + n;
+        int available = 8 - (b & 7);
+        int take = (count - n < available) ? count - n : available;
+        uint32_t chunk = (bitmap[b >> 3] >> (available - take)) & ((1u << take) - 1);
+        bits |= chunk << (32 - n - take);
+        n += take;
+      }
+      frameOrBits(fb, bits, gx + col, gy + row);
+      bit += count;
+    }
+  }
+  return glyph.xAdvance;
+}
+
+// Draw a string of ASCII text in a built-in font, returns the pen position after it
+int frameDrawText(FrameBuffer &fb, const GFXfont* font, const char* text, int x, int y) {
+  for (const char* p = text; *p; p++) {
+    const GFXglyph &glyph = font->glyph[(uint8_t)*p - font->first];
+    x += frameDrawGlyph(fb, glyph, font->bitmap + glyph.bitmapOffset, x, y);
+  }
+  return x;
+}
+
+// Transpose an 8x8 bit block, row 0 in the most significant byte
+inline uint64_t transpose8x8(uint64_t x) {
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+// Convert frame rows [y0, y0 + h) to the panel's native orientation
+// (rotation 1: frame pixel (x, y) is panel pixel (WIDTH - 1 - y, x)).
+// y0 and h must be multiples of 8; out gets h / 8 bytes per panel row
+void frameToPanel(const FrameBuffer &fb, int y0, int h, uint8_t* out) {
+  const uint8_t* rows = (const uint8_t*)fb.rows;
+  int outStride = h / 8;
+  for (int by = y0; by < y0 + h; by += 8) {
+    // Panel byte column covering frame rows by..by+7, bottom row in the MSB
+    int outColumn = (y0 + h - 8 - by) / 8;
+    for (int bx = 0; bx < FRAME_BYTES_PER_ROW; bx++) {
+      uint64_t block = 0;
+      for (int i = 0; i < 8; i++) {
+        block = (block << 8) | rows[(by + 7 - i) * FRAME_BYTES_PER_ROW + bx];
+      }
+      block = transpose8x8(block);
+      for (int j = 0; j < 8; j++) {
+        out[(bx * 8 + j) * outStride + outColumn] = (uint8_t)(block >> (56 - 8 * j));
+      }
+    }
+  }
+}
+
+// Panel transfer counters for /metrics
+uint32_t panelBytesSent = 0;     // Image bytes written to the controller
+uint32_t panelTransferRate = 0;  // Bytes/s of the last image write
+uint32_t panelBusyMs = 0;        // Time the render task slept on BUSY
+uint32_t panelBusyWakeups = 0;
+uint32_t panelBusyUsPart = 0;    // Remainder below 1 ms
+
+void recordTransfer(size_t bytes, uint32_t us) {
+  panelBytesSent += bytes;
+  if (us > 0) panelTransferRate = (uint64_t)bytes * 1000000 / us;
+}
+
+// BUSY edges wake the render task instead of GxEPD2 polling the pin every
+// millisecond on the core the WiFi stack runs on. GxEPD2 reads the pin again
+// after every wakeup, so either edge will do.
+// PANEL_BUSY_RECHECK_MS is not a timeout: GxEPD2's busy loop calls
+// waitForPanel() again while the pin still reads busy and gives up on its own
+// busy timeout (seconds). The binary semaphore keeps an edge that comes
+// between GxEPD2's pin read and the take, so no edge is lost; a stale one
+// from an earlier edge only costs one more pin read. The re-check only
+// matters if the controller ends a refresh without an edge the interrupt sees
+// (a glitch shorter than the GPIO filter), which then shows up 50 ms late
+// instead of hanging until GxEPD2's timeout
+#define PANEL_BUSY_RECHECK_MS 50
+SemaphoreHandle_t panelBusyEdge = NULL;
+
+void IRAM_ATTR onPanelBusyEdge() {
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(panelBusyEdge, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void waitForPanel(const void* parameter) {
+  uint32_t start = micros();
+  xSemaphoreTake(panelBusyEdge, pdMS_TO_TICKS(PANEL_BUSY_RECHECK_MS));
+  panelBusyUsPart += micros() - start;
+  panelBusyMs += panelBusyUsPart / 1000;
+  panelBusyUsPart %= 1000;
+  panelBusyWakeups++;
+}
+
+// Faster SPI clock and the BUSY interrupt, before and after display.init()
+void selectPanelSpi() {
+  display.epd2.selectSPI(SPI, SPISettings(EPD_SPI_HZ, MSBFIRST, SPI_MODE0));
+}
+
+void setupPanelBusy() {
+  panelBusyEdge = xSemaphoreCreateBinary();
+  display.epd2.setBusyCallback(waitForPanel);
+  attachInterrupt(digitalPinToInterrupt(EPD_BUSY), onPanelBusyEdge, CHANGE);
+}
+
+// Send frame rows [top, bottom] to the panel and refresh
+// A full refresh sends everything, a partial one only the 8-aligned band
+// GxEPD2 writes the band one SPIClass::transfer() byte at a time inside its
+// own command sequence; chunked or DMA transfers would need a panel driver
+// of our own and are not done
+void pushFrame(bool fullRefresh, int top, int bottom) {
+  if (fullRefresh) {
+    top = 0;
+    bottom = FRAME_HEIGHT - 1;
+  }
+  int y0 = top & ~7;
+  int h = ((bottom | 7) + 1) - y0;
+  if (y0 + h > FRAME_HEIGHT) h = FRAME_HEIGHT - y0;
+  frameToPanel(frame, y0, h, panelBuffer);
+  releaseFrame();
+  
+  // Panel coordinates of the band: x runs along the frame's rows (reversed)
+  int panelX = FRAME_HEIGHT - y0 - h;
+  int panelW = h;
+  int panelH = FRAME_WIDTH;
+  size_t bytes = panelW / 8 * panelH;
+  // Panel expects 1 = white, the frame uses 1 = black
+  uint32_t transferStart = micros();
+  {
+    METRIC_TIMER(spiMetric);
+    if (fullRefresh) {
+      display.epd2.writeImageForFullRefresh(panelBuffer, panelX, 0, panelW, panelH, true);
+    } else {
+      display.epd2.writeImage(panelBuffer, panelX, 0, panelW, panelH, true);
+    }
+  }
+  recordTransfer(bytes, micros() - transferStart);
+  {
+    METRIC_TIMER(busyMetric);
+    if (fullRefresh) {
+      display.epd2.refresh(false);
+    } else {
+      display.epd2.refresh(panelX, 0, panelW, panelH);
+    }
+  }
+  // Keep the controller's previous-image RAM in step for the next partial refresh
+  transferStart = micros();
+  {
+    METRIC_TIMER(spiMetric);
+    display.epd2.writeImageAgain(panelBuffer, panelX, 0, panelW, panelH, true);
+  }
+  recordTransfer(bytes, micros() - transferStart);
+  LOG_DEBUG("%s refresh: panel x=%d w=%d bytes=%u, %u bytes/s", fullRefresh ? "Full" : "Partial",
+            panelX, panelW, (unsigned)bytes, panelTransferRate);
+}
+
+// QR codes as packed 1bpp module bitmaps (one bit per module, rows MSB first)
+// The content only depends on the SSID, password and AP address, so generated
+// bitmaps are cached in NVS and only recomputed when the input changes
+#define MAX_QR_MODULES 33  // Version 4
+#define QR_ROW_BYTES ((MAX_QR_MODULES + 7) / 8)
+struct QRBitmap {
+  uint8_t size;  // Modules per side, 0 if generation failed
+  uint8_t rows[MAX_QR_MODULES][QR_ROW_BYTES];
+  
+  bool module(int x, int y) const { return rows[y][x >> 3] & (0x80 >> (x & 7)); }
+};
+
+// FNV-1a hash of a text followed by one byte, the cache tag of QR codes (text
+// and version) and of playlist frames (message and font size)
+uint32_t hashTextAndByte(const char* text, uint8_t last) {
+  uint32_t hash = 2166136261u;
+  for (const char* p = text; *p; p++) {
+    hash = (hash ^ (uint8_t)*p) * 16777619u;
+  }
+  return (hash ^ last) * 16777619u;
+}
+
+// Generate the QR code for data (trying each version in turn) and pack it
+bool generateQRBitmap(const char* data, const uint8_t versions[], int versionCount, QRBitmap &out) {
+  for (int v = 0; v < versionCount; v++) {
+    QRCode qrcode;
+    uint8_t buffer[qrcode_getBufferSize(4)];  // Large enough for versions 1-4
+    if (versions[v] > 4 || qrcode_initText(&qrcode, buffer, versions[v], 0, data) != 0) {
+      LOG_WARN("QR code version %d failed for: %s", versions[v], data);
+      continue;
+    }
+    memset(&out, 0, sizeof(out));
+    out.size = qrcode.size;
+    for (uint8_t y = 0; y < qrcode.size; y++) {
+      for (uint8_t x = 0; x < qrcode.size; x++) {
+        if (qrcode_getModule(&qrcode, x, y)) out.rows[y][x >> 3] |= 0x80 >> (x & 7);
+      }
+    }
+    return true;
+  }
+  out.size = 0;
+  return false;
+}
+
+// Get the QR bitmap for data from the NVS cache, generating it on a miss
+// Each slot holds one entry, tagged with the hash of the input it was made from
+bool getQRBitmap(const char* slot, const char* data, const uint8_t versions[], int versionCount, QRBitmap &out) {
+  struct CacheEntry {
+    uint32_t inputHash;
+    QRBitmap bitmap;
+  };
+  static CacheEntry entry;
+  uint32_t inputHash = hashTextAndByte(data, versions[0]);
+  unsigned long startTime = micros();
+  
+  Preferences qrCache;
+  qrCache.begin("qrcache", false);
+  if (qrCache.getBytes(slot, &entry, sizeof(entry)) == sizeof(entry) && entry.inputHash == inputHash &&
+      entry.bitmap.size > 0 && entry.bitmap.size <= MAX_QR_MODULES) {
+    qrCache.end();
+    out = entry.bitmap;
+    LOG_DEBUG("QR cache hit (%s): %lu us", slot, micros() - startTime);
+    return true;
+  }
+  
+  bool ok = generateQRBitmap(data, versions, versionCount, out);
+  if (ok) {
+    entry.inputHash = inputHash;
+    entry.bitmap = out;
+    qrCache.putBytes(slot, &entry, sizeof(entry));
+  }
+  qrCache.end();
+  LOG_DEBUG("QR cache miss (%s): generated in %lu us", slot, micros() - startTime);
+  return ok;
+}
+
+// Function to draw a QR code into the frame
+// Runs of dark modules in a row are merged into a single rectangle
+// Returns the number of rectangle fills
+int drawQRCode(FrameBuffer &fb, const QRBitmap &qr, int x, int y, int scale) {
+  int fills = 0;
+  for (int qy = 0; qy < qr.size; qy++) {
+    int qx = 0;
+    while (qx < qr.size) {
+      if (!qr.module(qx, qy)) {
+        qx++;
+        continue;
+      }
+      int runStart = qx;
+      while (qx < qr.size && qr.module(qx, qy)) qx++;
+      frameFillRect(fb, x + runStart * scale, y + qy * scale, (qx - runStart) * scale, scale);
+      fills++;
+    }
+  }
+  return fills;
+}
+
+// Set once a message frame is on the panel (used for partial refresh)
+extern bool lastFrameValid;
+
+int drawQRScreen(FrameBuffer &fb, const QRBitmap &wifiQR, const QRBitmap &webQR, const GFXfont* labelFont);
+
+// Function to display two QR codes side by side
+void displayQRCode() {
+  LOG_INFO("Generating QR codes...");
+  
+  // Get the IP address that ESP32 assigned itself
+  IPAddress IP = WiFi.softAPIP();
+  
+  // Create WiFi QR code string (left QR code)
+  char wifiQRData[96];
+  snprintf(wifiQRData, sizeof(wifiQRData), "WIFI:T:WPA;S:%s;P:%s;;", ssid, password);
+  
+  // Create web address QR code string (right QR code)
+  char webQRData[24];
+  snprintf(webQRData, sizeof(webQRData), "http://%u.%u.%u.%u", IP[0], IP[1], IP[2], IP[3]);
+  
+  LOG_DEBUG("WiFi QR Data: %s", wifiQRData);
+  LOG_DEBUG("Web QR Data: %s", webQRData);
+  
+  // WiFi QR code uses version 3 for more data capacity, falling back to version 2
+  static QRBitmap wifiQR;
+  static QRBitmap webQR;
+  const uint8_t wifiVersions[] = { 3, 2 };
+  const uint8_t webVersions[] = { 2 };
+  unsigned long qrStart = micros();
+  if (!getQRBitmap("wifi", wifiQRData, wifiVersions, 2, wifiQR)) {
+    LOG_ERROR("WiFi QR code generation failed!");
+    return;
+  }
+  if (!getQRBitmap("web", webQRData, webVersions, 1, webQR)) {
+    LOG_ERROR("Web QR code generation failed!");
+    return;
+  }
+  
+  LOG_INFO("Both QR codes ready in %lu us", micros() - qrStart);
+  LOG_DEBUG("WiFi QR size: %d modules", wifiQR.size);
+  LOG_DEBUG("Web QR size: %d modules", webQR.size);
+  
+  unsigned long drawStart = micros();
+  int fills = drawQRScreen(frame, wifiQR, webQR, &FreeMonoBoldLatin9pt);
+  unsigned long rasterTime = micros() - drawStart;
+  
+  pushFrame(true, 0, FRAME_HEIGHT - 1);
+  
+  // The panel no longer shows a message frame, next message needs a full refresh
+  lastFrameValid = false;
+  
+  LOG_DEBUG("QR screen rasterized in %lu us (%d rectangle fills), refreshed in %lu ms",
+            rasterTime, fills, (micros() - drawStart) / 1000);
+  
+  LOG_INFO("Both QR codes displayed! Left: WiFi join, Right: Web address");
+}
+
+// Draw the two QR codes side by side with their labels into a cleared frame
+// Returns the number of rectangle fills
+int drawQRScreen(FrameBuffer &fb, const QRBitmap &wifiQR, const QRBitmap &webQR, const GFXfont* labelFont) {
+  frameClear(fb);
+  
+  // Target display size for both QR codes (same pixel size)
+  int targetDisplaySize = 175;  // Target size in pixels (25 modules * 7 scale)
+  
+  // Calculate scale for each QR code to achieve same display size
+  int wifiScale = targetDisplaySize / wifiQR.size;
+  int webScale = targetDisplaySize / webQR.size;
+  
+  // Actual display sizes
+  int wifiDisplaySize = wifiQR.size * wifiScale;
+  int webDisplaySize = webQR.size * webScale;
+  
+  // Use the larger of the two for spacing calculations
+  int maxDisplaySize = (wifiDisplaySize > webDisplaySize) ? wifiDisplaySize : webDisplaySize;
+  
+  // Calculate spacing - two QR codes with more gap between them
+  int gap = 60;  // Larger gap between QR codes
+  int totalWidth = (maxDisplaySize * 2) + gap;
+  int startX = (FRAME_WIDTH - totalWidth) / 2;
+  int labelY = 10;  // Y position for labels
+  int qrY = labelY + 20;  // Y position for QR codes (below labels)
+  
+  // Center each QR code within its allocated space
+  int leftQRX = startX + (maxDisplaySize - wifiDisplaySize) / 2;
+  int rightQRX = startX + maxDisplaySize + gap + (maxDisplaySize - webDisplaySize) / 2;
+  
+  // Draw left label (centered above QR code) and QR code (WiFi join)
+  int leftLabelX = startX + (maxDisplaySize / 2) - 15;  // Approximate center
+  frameDrawText(fb, labelFont, "WiFi", leftLabelX, labelY);
+  int fills = drawQRCode(fb, wifiQR, leftQRX, qrY, wifiScale);
+  
+  // Draw right label (centered above QR code) and QR code (Web address)
+  int rightLabelX = startX + maxDisplaySize + gap + (maxDisplaySize / 2) - 10;  // Approximate center
+  frameDrawText(fb, labelFont, "Web", rightLabelX, labelY);
+  fills += drawQRCode(fb, webQR, rightQRX, qrY, webScale);
+  return fills;
+}
+
+// UTF-8 decoding: a table-driven DFA (after Bjoern Hoehrmann's decoder)
+// Each byte is one class lookup and one transition lookup, no branching per sequence type
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 12
+
+// Byte -> character class
+constexpr uint8_t UTF8_CLASS[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  8, 8, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  10, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 3, 3, 11, 6, 6, 6, 5, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+};
+
+// (state + class) -> next state, states are multiples of 12
+constexpr uint8_t UTF8_TRANSITION[108] = {
+   0, 12, 24, 36, 60, 96, 84, 12, 12, 12, 48, 72,  12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+  12,  0, 12, 12, 12, 12, 12,  0, 12,  0, 12, 12,  12, 24, 12, 12, 12, 12, 12, 24, 12, 24, 12, 12,
+  12, 12, 12, 12, 12, 12, 12, 24, 12, 12, 12, 12,  12, 24, 12, 12, 12, 12, 12, 12, 12, 24, 12, 12,
+  12, 12, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12,  12, 36, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12,
+  12, 36, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+};
+
+// Streaming decoder, feed it one byte at a time
+struct Utf8Decoder {
+  uint8_t state = UTF8_ACCEPT;
+  uint32_t codepoint = 0;
+  
+  // Returns UTF8_ACCEPT when codepoint holds a complete character,
+  // UTF8_REJECT on an invalid sequence, anything else means more bytes are needed
+  uint8_t feed(uint8_t byte) {
+    uint8_t type = UTF8_CLASS[byte];
+    codepoint = (state != UTF8_ACCEPT) ? (byte & 0x3Fu) | (codepoint << 6) : (0xFFu >> type) & byte;
+    state = UTF8_TRANSITION[state + type];
+    return state;
+  }
+};
+
+// Character drawn for anything the font has no glyph for
+#define REPLACEMENT_GLYPH '?'
+
+// Function to handle UTF-8 characters (including Icelandic)
+// Decodes UTF-8 into codepoints the display font can draw, anything outside
+// the font (or invalid UTF-8) becomes REPLACEMENT_GLYPH
+// Returns the number of codepoints written to out
+int handleUTF8(const char* text, size_t length, uint16_t* out, int maxLength, const GFXfont* font) {
+  METRIC_TIMER(utf8Metric);
+  LOG_HEXDUMP("Original UTF-8", text, length);
+  
+  Utf8Decoder decoder;
+  int count = 0;
+  for (int i = 0; i < (int)length && count < maxLength; i++) {
+    uint8_t byte = text[i];
+    bool inSequence = decoder.state != UTF8_ACCEPT;
+    uint8_t state = decoder.feed(byte);
+    if (state == UTF8_ACCEPT) {
+      uint32_t cp = decoder.codepoint;
+      if (cp == '\t') cp = ' ';
+      if (cp < 0x20 && cp != '\n' && cp != '\r') continue;  // Other control characters
+      if (cp > font->last || (cp >= 0x7F && cp <= 0x9F)) {
+        LOG_DEBUG("No glyph for U+%04X", (unsigned)cp);
+        cp = REPLACEMENT_GLYPH;
+      }
+      out[count++] = cp;
+    } else if (state == UTF8_REJECT) {
+      out[count++] = REPLACEMENT_GLYPH;
+      decoder.state = UTF8_ACCEPT;
+      // The byte that broke a sequence may start the next one; a byte that is
+      // never valid (0xC0, 0xC1, 0xF5..0xFF) is replaced once and skipped
+      uint8_t type = UTF8_CLASS[byte];
+      if (inSequence && type != 1 && type != 7 && type != 9) i--;
+    }
+  }
+  if (decoder.state != UTF8_ACCEPT && count < maxLength) {
+    out[count++] = REPLACEMENT_GLYPH;  // Truncated sequence at the end
+  }
+  
+  LOG_TRACE("Converted to %d codepoints", count);
+  return count;
+}
+
+#if FONTS_BUILTIN
+// Get the font for a font size (1=9pt, 2=12pt, 3=18pt, 4=24pt)
+const GFXfont* getFont(int size) {
+  switch(size) {
+    case 1: return &FreeMonoBoldLatin9pt;
+    case 2: return &FreeMonoBoldLatin12pt;
+    case 3: return &FreeMonoBoldLatin18pt;
+    case 4: return &FreeMonoBoldLatin24pt;
+    default: return &FreeMonoBoldLatin12pt;
+  }
+}
+
+void setupFonts(bool mounted) {}
+void lockFonts() {}
+void unlockFonts() {}
+void clearGlyphCache() {}
+
+// Packed bitmap of glyph index, built-in fonts keep theirs in flash
+inline const uint8_t* glyphBitmap(const GFXfont* font, uint16_t index) {
+  return font->bitmap + font->glyph[index].bitmapOffset;
+}
+#else
+// Font files on LittleFS, written by tools/gen_fonts.py into data/fonts and
+// uploaded with `pio run -t uploadfs`, all little-endian:
+//   "EPF1", first u16, last u16, yAdvance u8, reserved u8, largest glyph bitmap u16
+//   (last - first + 1) glyphs: bitmap offset u16, width u8, height u8, xAdvance u8, xOffset s8, yOffset s8
+//   glyph bitmaps, packed like GFXfont's
+// A size's glyph table is read the first time it is used and kept, that is all
+// layout needs. Bitmaps are read glyph by glyph when they are drawn, through a
+// small LRU cache shared by all sizes
+#ifndef FONT_FAMILY
+#define FONT_FAMILY "mono"
+#endif
+#define FONT_MAX_GLYPHS (0x17F - 0x20 + 1)
+#define GLYPH_CACHE_SLOTS 64
+#define GLYPH_CACHE_BYTES 160  // Largest glyph bitmap a font file may have, gen_fonts.py checks it
+const uint8_t FONT_POINTS[FONT_SIZES] = { 9, 12, 18, 24 };
+
+struct FontFace {
+  GFXfont gfx;            // Glyph table in RAM, no bitmaps
+  uint8_t* cacheSlot;     // Slot + 1 holding each glyph's bitmap, 0 = not cached
+  uint32_t bitmapStart;   // File offset of the bitmaps
+  std::atomic<bool> loaded;
+  bool missing;           // No usable file, the built-in font stands in
+};
+struct GlyphCacheSlot {
+  uint32_t lastUse;       // 0 = free
+  uint8_t face;
+  uint16_t index;
+  uint8_t bitmap[GLYPH_CACHE_BYTES];
+};
+FontFace fontFaces[FONT_SIZES];
+GlyphCacheSlot glyphCache[GLYPH_CACHE_SLOTS];
+uint32_t glyphCacheClock = 0;
+SemaphoreHandle_t fontMutex = NULL;  // Loading and the glyph cache, created with the render task
+bool fontsReady = false;             // LittleFS is mounted
+File glyphFile;                      // Font file of glyphFileFace, kept open between misses
+int glyphFileFace = -1;
+uint32_t glyphCacheHits = 0;
+uint32_t glyphCacheMisses = 0;
+uint32_t fontLoads = 0;
+unsigned long fontLoadTime = 0;      // ms for the last glyph table
+
+void getFontPath(int size, char* path, size_t length) {
+  snprintf(path, length, "/fonts/" FONT_FAMILY "-%u.epf", FONT_POINTS[size - 1]);
+}
+
+// Read a glyph table, on any problem the face is marked missing
+void loadFontFace(int size) {
+  FontFace &face = fontFaces[size - 1];
+  unsigned long startTime = millis();
+  char path[32];
+  getFontPath(size, path, sizeof(path));
+  face.missing = true;
+  File file = LittleFS.open(path, FILE_READ);
+  uint8_t header[12];
+  if (!file || file.read(header, sizeof(header)) != sizeof(header) || memcmp(header, "EPF1", 4) != 0) {
+    LOG_WARN("Font %s missing or invalid, using the built-in 9 pt font", path);
+    face.loaded.store(true, std::memory_order_release);
+    return;
+  }
+  uint16_t first = header[4] | (header[5] << 8);
+  uint16_t last = header[6] | (header[7] << 8);
+  uint16_t largest = header[10] | (header[11] << 8);
+  int count = last - first + 1;
+  if (first != 0x20 || count > FONT_MAX_GLYPHS || count < 0x60 || largest > GLYPH_CACHE_BYTES) {
+    LOG_WARN("Font %s: unsupported range or glyph size, using the built-in 9 pt font", path);
+    face.loaded.store(true, std::memory_order_release);
+    return;
+  }
+  
+  // One allocation for the life of the firmware
+  GFXglyph* glyphs = face.gfx.glyph;
+  if (glyphs == NULL) {
+    glyphs = (GFXglyph*)malloc(FONT_MAX_GLYPHS * (sizeof(GFXglyph) + 1));
+    if (glyphs == NULL) {
+      LOG_ERROR("No memory for font %s", path);
+      face.loaded.store(true, std::memory_order_release);
+      return;
+    }
+    face.cacheSlot = (uint8_t*)(glyphs + FONT_MAX_GLYPHS);
+  }
+  uint32_t bitmapStart = sizeof(header) + count * 7;
+  size_t bitmapSize = file.size() - bitmapStart;
+  bool ok = file.size() >= bitmapStart;
+  for (int i = 0; i < count && ok; i++) {
+    uint8_t entry[7];
+    ok = file.read(entry, sizeof(entry)) == sizeof(entry);
+    GFXglyph &g = glyphs[i];
+    g.bitmapOffset = entry[0] | (entry[1] << 8);
+    g.width = entry[2];
+    g.height = entry[3];
+    g.xAdvance = entry[4];
+    g.xOffset = (int8_t)entry[5];
+    g.yOffset = (int8_t)entry[6];
+    size_t bytes = ((size_t)g.width * g.height + 7) / 8;
+    ok = ok && bytes <= largest && g.bitmapOffset + bytes <= bitmapSize;
+  }
+  file.close();
+  face.gfx.glyph = glyphs;
+  if (!ok) {
+    LOG_WARN("Font %s is damaged, using the built-in 9 pt font", path);
+    face.loaded.store(true, std::memory_order_release);
+    return;
+  }
+  memset(face.cacheSlot, 0, FONT_MAX_GLYPHS);
+  face.gfx.bitmap = NULL;
+  face.gfx.first = first;
+  face.gfx.last = last;
+  face.gfx.yAdvance = header[8];
+  face.bitmapStart = bitmapStart;
+  face.missing = false;
+  face.loaded.store(true, std::memory_order_release);
+  fontLoads++;
+  fontLoadTime = millis() - startTime;
+  LOG_INFO("Loaded font %s: %d glyphs in %lu ms", path, count, fontLoadTime);
+}
+
+// Get the font for a font size (1=9pt, 2=12pt, 3=18pt, 4=24pt), loading it on first use
+const GFXfont* getFont(int size) {
+  if (size < 1 || size > FONT_SIZES) size = 2;
+  FontFace &face = fontFaces[size - 1];
+  if (!face.loaded.load(std::memory_order_acquire)) {
+    if (!fontsReady) return &FreeMonoBoldLatin9pt;  // Only before setup() mounted LittleFS
+    xSemaphoreTake(fontMutex, portMAX_DELAY);
+    if (!face.loaded.load(std::memory_order_relaxed)) loadFontFace(size);
+    xSemaphoreGive(fontMutex);
+  }
+  return face.missing ? &FreeMonoBoldLatin9pt : &face.gfx;
+}
+
+// Hold the glyph cache while drawing, bitmaps stay valid until unlockFonts()
+// unless the cache has to make room for another glyph
+void lockFonts() { xSemaphoreTake(fontMutex, portMAX_DELAY); }
+void unlockFonts() { xSemaphoreGive(fontMutex); }
+
+// Drop all cached bitmaps (benchmarks of the cold path)
+void clearGlyphCache() {
+  lockFonts();
+  for (GlyphCacheSlot &slot : glyphCache) {
+    if (slot.lastUse != 0) fontFaces[slot.face].cacheSlot[slot.index] = 0;
+    slot.lastUse = 0;
+  }
+  unlockFonts();
+}
+
+// Packed bitmap of glyph index, NULL if it can't be read
+// File fonts go through the cache, built-in fonts keep theirs in flash
+// Call with the fonts locked
+const uint8_t* glyphBitmap(const GFXfont* font, uint16_t index) {
+  if (font->bitmap != NULL) return font->bitmap + font->glyph[index].bitmapOffset;
+  int f = 0;
+  while (&fontFaces[f].gfx != font) f++;
+  FontFace &face = fontFaces[f];
+  uint32_t now = ++glyphCacheClock;
+  uint8_t cached = face.cacheSlot[index];
+  if (cached != 0) {
+    glyphCacheHits++;
+    glyphCache[cached - 1].lastUse = now;
+    return glyphCache[cached - 1].bitmap;
+  }
+  
+  // Miss: take a free slot or the least recently used one
+  glyphCacheMisses++;
+  int victim = 0;
+  for (int i = 1; i < GLYPH_CACHE_SLOTS && glyphCache[victim].lastUse != 0; i++) {
+    if (glyphCache[i].lastUse < glyphCache[victim].lastUse) victim = i;
+  }
+  GlyphCacheSlot &slot = glyphCache[victim];
+  if (slot.lastUse != 0) fontFaces[slot.face].cacheSlot[slot.index] = 0;
+  slot.lastUse = 0;
+  
+  if (glyphFileFace != f) {
+    if (glyphFile) glyphFile.close();
+    char path[32];
+    getFontPath(f + 1, path, sizeof(path));
+    glyphFile = LittleFS.open(path, FILE_READ);
+    glyphFileFace = glyphFile ? f : -1;
+  }
+  const GFXglyph &glyph = face.gfx.glyph[index];
+  size_t bytes = ((size_t)glyph.width * glyph.height + 7) / 8;
+  if (glyphFileFace != f || !glyphFile.seek(face.bitmapStart + glyph.bitmapOffset) ||
+      glyphFile.read(slot.bitmap, bytes) != bytes) {
+    LOG_WARN("Can't read glyph %u of font size %d", (unsigned)index, f + 1);
+    return NULL;
+  }
+  slot.lastUse = now;
+  slot.face = f;
+  slot.index = index;
+  face.cacheSlot[index] = victim + 1;
+  return slot.bitmap;
+}
+
+// Fonts live on the LittleFS that setupPlaylistCache() mounts
+void setupFonts(bool mounted) {
+  fontsReady = mounted;
+  int found = 0;
+  char path[32];
+  for (int size = 1; size <= FONT_SIZES && fontsReady; size++) {
+    getFontPath(size, path, sizeof(path));
+    if (LittleFS.exists(path)) found++;
+  }
+  if (found < FONT_SIZES) {
+    LOG_WARN("%d of %d font files on LittleFS, upload them with: pio run -t uploadfs", found, FONT_SIZES);
+  }
+}
+#endif
+
+// Advance width of a codepoint taken from the font's glyph table
+// (handleUTF8 has already mapped everything to codepoints inside the font)
+inline int glyphAdvance(const GFXfont* font, uint16_t cp) {
+  return font->glyph[cp - font->first].xAdvance;
+}
+
+// Text layout: the processed message as positioned glyph runs (one per line)
+// Built once per update, rasterizing only replays it
+#define MAX_GLYPH_RUNS 16
+#define MAX_TEXT_GLYPHS 512
+#define TEXT_MARGIN 10
+struct GlyphRun {
+  int16_t x, y;     // Pen position of the first glyph (y is the baseline)
+  uint16_t start;   // Index of the first codepoint in the layout text
+  uint16_t length;  // Number of codepoints in the run
+};
+struct TextLayout {
+  uint16_t text[MAX_TEXT_GLYPHS];  // Decoded message the runs point into
+  int textLength;
+  const GFXfont* font;
+  int fontSize;
+  int ascent;       // Pixels above the baseline, including accent room
+  int descent;      // Pixels below the baseline
+  int lineHeight;
+  GlyphRun runs[MAX_GLYPH_RUNS];
+  int runCount;
+};
+
+// Measure how far the font's glyphs reach above and below the baseline
+void getFontExtents(const GFXfont* font, int &ascent, int &descent) {
+  ascent = 0;
+  descent = 0;
+  for (int i = 0; i <= font->last - font->first; i++) {
+    const GFXglyph &g = font->glyph[i];
+    if (-g.yOffset > ascent) ascent = -g.yOffset;
+    if (g.height + g.yOffset > descent) descent = g.height + g.yOffset;
+  }
+}
+
+// Append a run covering text[start, end) on the next line
+void addGlyphRun(TextLayout &layout, int start, int end, int &y) {
+  GlyphRun &run = layout.runs[layout.runCount++];
+  run.x = TEXT_MARGIN;
+  run.y = y;
+  run.start = start;
+  run.length = end - start;
+  y += layout.lineHeight;
+}
+
+// Find where the line starting at text[start] ends, using the font's advance widths
+// Wrapped lines break at the last space, a word longer than the line is split
+// Returns the end of the line's run, next is where the following line starts
+// and scanned the last character looked at (the break depends on nothing after it)
+int wrapLine(const uint16_t* text, int len, int start, const GFXfont* font, int &next, int &scanned) {
+  int maxLineWidth = FRAME_WIDTH - 2 * TEXT_MARGIN;
+  int lineWidth = 0;       // Pen advance of the line so far
+  int lastSpace = -1;      // Last space inside the line
+  for (int i = start; i < len; i++) {
+    uint16_t c = text[i];
+    if (c == '\n' || c == '\r') {
+      // Treat \r\n as a single line break
+      bool pair = c == '\r' && i + 1 < len && text[i + 1] == '\n';
+      next = i + (pair ? 2 : 1);
+      scanned = (c == '\r' && i + 1 < len) ? i + 1 : i;
+      return i;
+    }
+    int advance = glyphAdvance(font, c);
+    if (lineWidth + advance > maxLineWidth && i > start) {
+      scanned = i;
+      if (c == ' ') {
+        // Wrap exactly at a space, drop it
+        next = i + 1;
+        return i;
+      }
+      if (lastSpace >= 0) {
+        // Break at word boundary, the partial word moves to the next line
+        next = lastSpace + 1;
+        return lastSpace;
+      }
+      // No space found, break before this character
+      next = i;
+      return i;
+    }
+    if (c == ' ') lastSpace = i;
+    lineWidth += advance;
+  }
+  next = len;
+  scanned = len;
+  return len;
+}
+
+// Auto-fit: the largest fixed size whose wrapped lines fit the panel height,
+// found by binary search over the sizes measuring line breaks only
+// Each size remembers the line breaks of the text it measured last. After an
+// edit the lines before the change are kept, and once a new line starts at
+// the same place in the unchanged tail as an old one, the old lines from
+// there on are reused shifted, so only the lines around the edit are wrapped
+#define FIT_MAX_LINES (MAX_GLYPH_RUNS + 1)  // Measuring stops once it can't fit
+struct FitLine {
+  uint16_t start;
+  uint16_t scanned;  // Last character the break depends on
+};
+struct FitSize {
+  const GFXfont* font;             // Font the lines were measured with
+  int extent;                      // Its ascent + descent
+  uint16_t text[MAX_TEXT_GLYPHS];  // Text the lines were measured for
+  int textLength;
+  FitLine lines[FIT_MAX_LINES];
+  int lineCount;                   // FIT_MAX_LINES means at least that many
+};
+struct FitMemo {
+  FitSize sizes[FONT_SIZES];
+  uint32_t linesWrapped;           // Lines measured, the rest were reused
+  uint32_t linesReused;
+};
+
+// Number of lines text wraps to at size (up to FIT_MAX_LINES), updating its memo
+int measureLines(const uint16_t* text, int len, int size, FitMemo &memo) {
+  FitSize &m = memo.sizes[size - 1];
+  const GFXfont* font = getFont(size);
+  if (m.font != font) {
+    // First use, or the font file was loaded since
+    int ascent, descent;
+    getFontExtents(font, ascent, descent);
+    m.font = font;
+    m.extent = ascent + descent;
+    m.textLength = 0;
+    m.lineCount = 0;
+  }
+  
+  // Unchanged head text[0, head) and tail, the old text [head, oldEnd) was replaced
+  int shorter = (len < m.textLength) ? len : m.textLength;
+  int head = 0;
+  int tail = 0;
+  while (head < shorter && text[head] == m.text[head]) head++;
+  while (tail < shorter - head && text[len - 1 - tail] == m.text[m.textLength - 1 - tail]) tail++;
+  if (head == len && len == m.textLength && m.lineCount > 0) {
+    memo.linesReused += m.lineCount;
+    return m.lineCount;
+  }
+  int oldEnd = m.textLength - tail;
+  int shift = len - m.textLength;
+  FitLine old[FIT_MAX_LINES];
+  int oldCount = m.lineCount;
+  memcpy(old, m.lines, sizeof(FitLine) * oldCount);
+  
+  // Lines that never looked at the replaced part stay as they are
+  int lineCount = 0;
+  while (lineCount < oldCount && old[lineCount].scanned < head) lineCount++;
+  memo.linesReused += lineCount;
+  int oldLine = lineCount;
+  int start = 0;
+  int next, scanned;
+  if (lineCount > 0) {
+    wrapLine(text, len, old[lineCount - 1].start, font, next, scanned);
+    start = next;
+  }
+  while (start < len && lineCount < FIT_MAX_LINES) {
+    if (start - shift >= oldEnd) {
+      // Same start in the unchanged tail as an old line: the old lines from
+      // there on are still right, shifted
+      while (oldLine < oldCount && old[oldLine].start < start - shift) oldLine++;
+      if (oldLine < oldCount && old[oldLine].start == start - shift) {
+        while (oldLine < oldCount && lineCount < FIT_MAX_LINES) {
+          m.lines[lineCount].start = old[oldLine].start + shift;
+          m.lines[lineCount].scanned = old[oldLine].scanned + shift;
+          lineCount++;
+          oldLine++;
+          memo.linesReused++;
+        }
+        // The old measurement may have stopped early, carry on after it
+        wrapLine(text, len, m.lines[lineCount - 1].start, font, next, scanned);
+        start = next;
+        continue;
+      }
+    }
+    wrapLine(text, len, start, font, next, scanned);
+    m.lines[lineCount].start = start;
+    m.lines[lineCount].scanned = scanned;
+    lineCount++;
+    memo.linesWrapped++;
+    start = next;
+  }
+  memcpy(m.text, text, len * sizeof(uint16_t));
+  m.textLength = len;
+  m.lineCount = lineCount;
+  return lineCount;
+}
+
+// Whether text laid out at size stays inside the panel
+bool fitsAtSize(const uint16_t* text, int len, int size, FitMemo &memo) {
+  int lines = measureLines(text, len, size, memo);
+  if (lines > MAX_GLYPH_RUNS) return false;
+  if (lines == 0) lines = 1;
+  const FitSize &m = memo.sizes[size - 1];
+  return TEXT_MARGIN / 2 + m.extent + (lines - 1) * m.font->yAdvance <= FRAME_HEIGHT;
+}
+
+// Largest fixed size text fits at, the smallest if it fits at none
+int fitFontSize(const uint16_t* text, int len, FitMemo &memo) {
+  int low = 1;
+  int high = FONT_SIZES;
+  while (low < high) {
+    int middle = (low + high + 1) / 2;
+    if (fitsAtSize(text, len, middle, memo)) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return low;
+}
+
+void layoutDecoded(TextLayout &layout, const GFXfont* font, int size);
+
+// Decode a message and lay it out using the font's advance widths
+// Nothing is rewound or drawn; FONT_SIZE_AUTO picks the size with fitFontSize()
+void layoutText(const char* message, size_t length, int size, TextLayout &layout) {
+  METRIC_TIMER(layoutMetric);
+  layout.textLength = handleUTF8(message, length, layout.text, MAX_TEXT_GLYPHS, getFont(size));
+  if (size == FONT_SIZE_AUTO) {
+    static FitMemo memo;  // Render task only
+    size = fitFontSize(layout.text, layout.textLength, memo);
+    LOG_DEBUG("Auto-fit: font size %d", size);
+  }
+  layoutDecoded(layout, getFont(size), size);
+}
+
+// Lay out layout.text, decoded for font already, into glyph runs
+void layoutDecoded(TextLayout &layout, const GFXfont* font, int size) {
+  layout.fontSize = size;
+  layout.font = font;
+  layout.lineHeight = layout.font->yAdvance;
+  getFontExtents(layout.font, layout.ascent, layout.descent);
+  layout.runCount = 0;
+  
+  int y = TEXT_MARGIN / 2 + layout.ascent;
+  int start = 0;
+  int len = layout.textLength;
+  while (start < len && layout.runCount < MAX_GLYPH_RUNS) {
+    int next, scanned;
+    int end = wrapLine(layout.text, len, start, layout.font, next, scanned);
+    addGlyphRun(layout, start, end, y);
+    start = next;
+  }
+}
+
+// Check whether run i of two layouts would draw the same pixels
+bool runsEqual(const TextLayout &a, const TextLayout &b, int i) {
+  const GlyphRun &ra = a.runs[i];
+  const GlyphRun &rb = b.runs[i];
+  return ra.x == rb.x && ra.y == rb.y && ra.length == rb.length &&
+         memcmp(a.text + ra.start, b.text + rb.start, ra.length * sizeof(uint16_t)) == 0;
+}
+
+// Replay a layout's glyph runs into the frame, returns the number of glyphs drawn
+// Accented letters are glyphs of their own
+int rasterizeLayout(FrameBuffer &fb, const TextLayout &layout) {
+  METRIC_TIMER(rasterMetric);
+  frameClear(fb);
+  const GFXfont* font = layout.font;
+  int glyphCount = 0;
+  lockFonts();
+  for (int r = 0; r < layout.runCount; r++) {
+    const GlyphRun &run = layout.runs[r];
+    int x = run.x;
+    for (int i = run.start; i < run.start + run.length; i++) {
+      uint16_t index = layout.text[i] - font->first;
+      const uint8_t* bitmap = glyphBitmap(font, index);
+      if (bitmap != NULL) frameDrawGlyph(fb, font->glyph[index], bitmap, x, run.y);
+      x += font->glyph[index].xAdvance;
+      glyphCount++;
+    }
+  }
+  unlockFonts();
+  return glyphCount;
+}
+
+// Partial refresh bookkeeping: remember the last message layout so the next
+// update only pushes the line bands that actually changed
+TextLayout lastLayout;
+bool lastFrameValid = false;  // false while the QR screen (or nothing) is on the panel
+int partialRefreshCount = 0;
+const int FULL_REFRESH_EVERY = 10;  // Force a full refresh after this many partial ones to clear ghosting
+
+// Function to update the e-paper display with text message
+void updateDisplay(const char* message, size_t length, int size) {
+  LOG_INFO("Updating display with: %s", message);
+  LOG_DEBUG("Font size: %d", size);
+  unsigned long startTime = millis();
+  
+  // Decode UTF-8 (including Icelandic) and lay out the text
+  static TextLayout layout;
+  unsigned long layoutStart = micros();
+  layoutText(message, length, size, layout);
+  unsigned long layoutTime = micros() - layoutStart;
+  
+  // Work out which line bands differ from what is already on the panel
+  bool fullRefresh = !lastFrameValid || lastLayout.fontSize != layout.fontSize ||
+                     partialRefreshCount >= FULL_REFRESH_EVERY;
+  int dirtyTop = FRAME_HEIGHT;
+  int dirtyBottom = -1;
+  if (!fullRefresh) {
+    int maxRuns = (layout.runCount > lastLayout.runCount) ? layout.runCount : lastLayout.runCount;
+    for (int i = 0; i < maxRuns; i++) {
+      if (i < layout.runCount && i < lastLayout.runCount && runsEqual(layout, lastLayout, i)) continue;
+      int y = (i < layout.runCount) ? layout.runs[i].y : lastLayout.runs[i].y;
+      int top = y - layout.ascent;
+      int bottom = y + layout.descent;
+      if (top < dirtyTop) dirtyTop = top;
+      if (bottom > dirtyBottom) dirtyBottom = bottom;
+    }
+    if (dirtyBottom < 0) {
+      LOG_INFO("Display unchanged, skipping refresh");
+      return;
+    }
+    if (dirtyTop < 0) dirtyTop = 0;
+    if (dirtyBottom >= FRAME_HEIGHT) dirtyBottom = FRAME_HEIGHT - 1;
+  }
+  
+  if (fullRefresh) {
+    partialRefreshCount = 0;
+  } else {
+    partialRefreshCount++;
+  }
+  
+  // Replay the glyph runs into the frame
+  unsigned long rasterStart = micros();
+  int glyphCount = rasterizeLayout(frame, layout);
+  unsigned long rasterTime = micros() - rasterStart;
+  
+  pushFrame(fullRefresh, dirtyTop, dirtyBottom);
+  
+  // Remember this frame for the next diff
+  lastLayout = layout;
+  lastFrameValid = true;
+  
+  LOG_DEBUG("Decode + layout: %lu us for %d glyphs, %d runs; raster: %lu us for %d glyphs",
+            layoutTime, layout.textLength, layout.runCount, rasterTime, glyphCount);
+  LOG_INFO("Display updated in %lu ms", millis() - startTime);
+}
+
+// Push a whole frame that was not drawn from a layout (playlist frames, images)
+// A partial refresh of everything avoids the flashing, the next message can't
+// be diffed against this frame so it gets a full refresh
+void pushWholeFrame() {
+  bool fullRefresh = !lastFrameValid || partialRefreshCount >= FULL_REFRESH_EVERY;
+  partialRefreshCount = fullRefresh ? 0 : partialRefreshCount + 1;
+  pushFrame(fullRefresh, 0, FRAME_HEIGHT - 1);
+  lastFrameValid = true;
+  lastLayout.fontSize = 0;
+}
+
+// Playlist frame cache: each playlist entry is rasterized once and kept as a
+// finished frame, so rotating to it is a copy and a panel push
+// Frames go to PSRAM when there is some, otherwise a few fit in internal RAM
+// and the rest are kept as files on LittleFS
+// Only the render task touches the cache
+#define PLAYLIST_MAX_ENTRIES 8
+#define PLAYLIST_RAM_FRAMES 3  // Internal RAM budget when there is no PSRAM (12.5 KB each)
+
+struct PlaylistFrame {
+  uint32_t hash;       // Hash of the message and font size the frame was rendered from, 0 = empty
+  FrameBuffer* ram;    // NULL when the frame lives in flash
+};
+PlaylistFrame playlistFrames[PLAYLIST_MAX_ENTRIES];
+int playlistRamFrames = 0;
+bool playlistFlashReady = false;
+uint32_t playlistHits = 0;
+uint32_t playlistMisses = 0;
+unsigned long lastRotationTime = 0;  // ms from request to refreshed panel
+uint32_t shownPlaylistHash = 0;  // Entry on the panel, 0 when it shows something else
+
+// Cache tag for a playlist entry: its message and font size
+uint32_t getPlaylistHash(const char* message, int size) {
+  uint32_t hash = hashTextAndByte(message, size);
+  return hash ? hash : 1;  // 0 marks an empty slot
+}
+
+// Get RAM for a slot's frame, NULL if it has to go to flash
+FrameBuffer* allocPlaylistFrame(PlaylistFrame &slot) {
+  if (slot.ram != NULL) return slot.ram;
+  if (psramFound()) {
+    slot.ram = (FrameBuffer*)ps_malloc(sizeof(FrameBuffer));
+  } else if (playlistRamFrames < PLAYLIST_RAM_FRAMES) {
+    slot.ram = (FrameBuffer*)heap_caps_malloc(sizeof(FrameBuffer), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (slot.ram != NULL) playlistRamFrames++;
+  }
+  return slot.ram;
+}
+
+// Flash copy of slot index: the hash followed by the frame rows
+void getPlaylistFramePath(int index, char* path, size_t size) {
+  snprintf(path, size, "/frame%d.bin", index);
+}
+
+// Copy the cached frame for hash into fb, returns false on a miss
+// Any slot may hold it, entries keep their frames when the playlist is reordered
+bool loadPlaylistFrame(uint32_t hash, FrameBuffer &fb) {
+  int index = 0;
+  while (index < PLAYLIST_MAX_ENTRIES && playlistFrames[index].hash != hash) index++;
+  if (index == PLAYLIST_MAX_ENTRIES) return false;
+  PlaylistFrame &slot = playlistFrames[index];
+  if (slot.ram != NULL) {
+    memcpy(&fb, slot.ram, sizeof(FrameBuffer));
+    return true;
+  }
+  if (!playlistFlashReady) return false;
+  char path[16];
+  getPlaylistFramePath(index, path, sizeof(path));
+  File file = LittleFS.open(path, FILE_READ);
+  if (!file) return false;
+  uint32_t storedHash = 0;
+  bool ok = file.read((uint8_t*)&storedHash, sizeof(storedHash)) == sizeof(storedHash) && storedHash == hash &&
+            file.read((uint8_t*)&fb, sizeof(FrameBuffer)) == sizeof(FrameBuffer);
+  file.close();
+  return ok;
+}
+
+// Keep a copy of fb as the frame for slot index
+void storePlaylistFrame(int index, uint32_t hash, const FrameBuffer &fb) {
+  PlaylistFrame &slot = playlistFrames[index];
+  slot.hash = 0;
+  FrameBuffer* ram = allocPlaylistFrame(slot);
+  if (ram != NULL) {
+    memcpy(ram, &fb, sizeof(FrameBuffer));
+    slot.hash = hash;
+    return;
+  }
+  if (!playlistFlashReady) return;
+  char path[16];
+  getPlaylistFramePath(index, path, sizeof(path));
+  File file = LittleFS.open(path, FILE_WRITE);
+  if (!file) return;
+  bool ok = file.write((const uint8_t*)&hash, sizeof(hash)) == sizeof(hash) &&
+            file.write((const uint8_t*)&fb, sizeof(FrameBuffer)) == sizeof(FrameBuffer);
+  file.close();
+  if (ok) slot.hash = hash;
+}
+
+// Show playlist entry index, rendering it only if the cache has no frame for it
+void showPlaylistEntry(int index, const char* message, size_t length, int size) {
+  unsigned long startTime = millis();
+  uint32_t hash = getPlaylistHash(message, size);
+  if (hash == shownPlaylistHash && lastFrameValid) {
+    return;  // Already on the panel
+  }
+  bool hit = loadPlaylistFrame(hash, frame);
+  if (hit) {
+    playlistHits++;
+  } else {
+    playlistMisses++;
+    static TextLayout layout;
+    layoutText(message, length, size, layout);
+    rasterizeLayout(frame, layout);
+    storePlaylistFrame(index, hash, frame);
+  }
+  
+  unsigned long pushStart = millis();
+  pushWholeFrame();
+  shownPlaylistHash = hash;
+  lastRotationTime = millis() - startTime;
+  LOG_INFO("Playlist entry %d: %s, %lu ms (push %lu ms), hit rate %u/%u", index, hit ? "hit" : "miss",
+           lastRotationTime, millis() - pushStart, playlistHits, playlistHits + playlistMisses);
+}
+
+// Mount LittleFS for frames that do not fit in RAM
+void setupPlaylistCache() {
+  playlistFlashReady = LittleFS.begin(true);
+  if (!playlistFlashReady) LOG_WARN("LittleFS mount failed, playlist frames only cached in RAM");
+  LOG_INFO("Playlist frame cache: %s", psramFound() ? "PSRAM" : "internal RAM + LittleFS");
+}
+
+// Uploaded images: 1bpp PBM (P4), raw frames or a simple RLE format, decoded
+// chunk by chunk while the body streams in, straight into the frame
+// Raw: FRAME_HEIGHT rows of FRAME_BYTES_PER_ROW bytes, first pixel in the MSB, 1 = black
+// RLE: "R1", width and height as u16 LE, then one byte per run (bit 7 = black,
+// bits 0-6 = length - 1), running on across rows
+// Images smaller than the frame are centered on white
+enum ImageFormat { IMAGE_PBM, IMAGE_RAW, IMAGE_RLE };
+
+struct ImageDecoder {
+  ImageFormat format;
+  bool headerDone;
+  const char* error;    // Set once the image is rejected, nothing more is decoded
+  int errorCode;        // HTTP status to answer with
+  size_t headerLength;  // Bytes before the pixel data
+  int width, height;
+  int left, top;        // Placement in the frame
+  int row, col;         // Next pixel (RLE) or byte (PBM, raw) within the image
+  int rowBytes;
+  // PBM header parsing
+  int magic, field, number;
+  bool inNumber, inComment;
+  // RLE header
+  uint8_t rle[6];
+  
+  void begin(ImageFormat f) {
+    memset(this, 0, sizeof(*this));
+    format = f;
+    if (f == IMAGE_RAW) setSize(FRAME_WIDTH, FRAME_HEIGHT);
+  }
+  
+  void fail(int code, const char* message) {
+    if (error == NULL) {
+      error = message;
+      errorCode = code;
+    }
+  }
+  
+  void setSize(int w, int h) {
+    if (w < 1 || h < 1) return fail(400, "empty image");
+    if (w > FRAME_WIDTH || h > FRAME_HEIGHT) return fail(413, "image larger than 416x240");
+    width = w;
+    height = h;
+    rowBytes = (w + 7) / 8;
+    left = (FRAME_WIDTH - w) / 2;
+    top = (FRAME_HEIGHT - h) / 2;
+    headerDone = true;
+  }
+  
+  // Largest body a valid upload of this image can have
+  size_t maxBodySize() const {
+    if (format == IMAGE_RLE) return headerLength + (size_t)width * height;  // One run per pixel
+    return headerLength + (size_t)rowBytes * height;
+  }
+  
+  bool complete() const { return headerDone && error == NULL && row == height; }
+  
+  // Consume up to n bytes, returns how many were used
+  // Stops right after the header so the caller can check it and take the frame
+  size_t feed(FrameBuffer &fb, const uint8_t* data, size_t n) {
+    size_t i = 0;
+    while (!headerDone && error == NULL && i < n) {
+      headerByte(data[i++]);
+      headerLength++;
+      if (headerDone) return i;
+    }
+    if (error != NULL) return n;
+    for (; i < n && error == NULL; i++) {
+      if (row == height) {
+        fail(400, "more data than the image holds");
+      } else if (format == IMAGE_RLE) {
+        runByte(fb, data[i]);
+      } else {
+        pixelByte(fb, data[i]);
+      }
+    }
+    return n;
+  }
+  
+  void headerByte(uint8_t c) {
+    if (format == IMAGE_RLE) {
+      rle[headerLength] = c;
+      if (headerLength == 1 && (rle[0] != 'R' || rle[1] != '1')) return fail(400, "not an R1 RLE image");
+      if (headerLength == 5) setSize(rle[2] | (rle[3] << 8), rle[4] | (rle[5] << 8));
+      return;
+    }
+    // PBM: "P4", width and height separated by whitespace or comments, one whitespace
+    if (magic < 2) {
+      if (c != "P4"[magic]) return fail(400, "not a binary (P4) PBM");
+      magic++;
+    } else if (inComment) {
+      if (c == '\n' || c == '\r') inComment = false;
+    } else if (c >= '0' && c <= '9') {
+      number = number * 10 + (c - '0');
+      inNumber = true;
+      if (number > 9999) fail(413, "image larger than 416x240");
+    } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      if (!inNumber) return;
+      inNumber = false;
+      if (field++ == 0) {
+        width = number;
+      } else {
+        setSize(width, number);
+      }
+      number = 0;
+    } else if (c == '#' && !inNumber) {
+      inComment = true;
+    } else {
+      fail(400, "bad PBM header");
+    }
+  }
+  
+  // Eight pixels of a packed row, padding bits past the width are dropped
+  void pixelByte(FrameBuffer &fb, uint8_t bits) {
+    if (col == rowBytes - 1 && (width & 7)) bits &= 0xFF << (8 - (width & 7));
+    if (bits) frameOrBits(fb, (uint32_t)bits << 24, left + col * 8, top + row);
+    if (++col == rowBytes) {
+      col = 0;
+      row++;
+    }
+  }
+  
+  void runByte(FrameBuffer &fb, uint8_t run) {
+    int length = (run & 0x7F) + 1;
+    bool black = run & 0x80;
+    while (length > 0) {
+      if (row == height) return fail(400, "RLE runs past the end of the image");
+      int span = (length < width - col) ? length : width - col;
+      if (black) frameFillSpan(fb, left + col, left + col + span, top + row);
+      col += span;
+      length -= span;
+      if (col == width) {
+        col = 0;
+        row++;
+      }
+    }
+  }
+};
+
+// Requests queued before an upload finished are dropped
+volatile uint32_t imageSequence = 0;      // Render sequence of the last uploaded image
+volatile unsigned long imageUploadStart = 0;
+
+// Push the uploaded image that was decoded into the frame
+void showUploadedImage() {
+  unsigned long pushStart = millis();
+  pushWholeFrame();
+  LOG_INFO("Image shown: push %lu ms, upload to refresh %lu ms", millis() - pushStart,
+           millis() - imageUploadStart);
+}
+
+// Render requests handed from the web server to the render task
+// The mailbox holds a single request, a newer one replaces one not yet started
+enum RenderKind { RENDER_QR_CODES, RENDER_MESSAGE, RENDER_PLAYLIST, RENDER_IMAGE, RENDER_HIBERNATE };
+struct RenderRequest {
+  RenderKind kind;
+  int fontSize;
+  int playlistIndex;  // Entry for RENDER_PLAYLIST
+  bool fullRefresh;   // Skip the partial refresh for this one
+  uint32_t sequence;  // Value of renderRequestCount it was queued as
+  uint16_t length;
+  char message[MAX_MESSAGE_BYTES + 1];
+};
+QueueHandle_t renderMailbox = NULL;
+TaskHandle_t renderTaskHandle = NULL;
+TaskHandle_t mainLoopTask = NULL;  // Woken by renders, sockets, stations and the UART
+volatile uint32_t renderRequestCount = 0;
+volatile uint32_t renderCount = 0;
+volatile uint32_t renderedSequence = 0;  // Sequence of the last completed request
+volatile unsigned long renderedTime = 0;  // How long it took, ms
+const BaseType_t RENDER_CORE = 0;  // Arduino loop() and the web server run on core 1
+
+// Queue a redraw, returns immediately
+// Returns the request's sequence number, reported back once it is rendered
+uint32_t requestRender(RenderKind kind, const char* message, size_t length, int size, int playlistIndex,
+                       bool fullRefresh = false) {
+  static RenderRequest request;  // Copied into the mailbox, keep it off the stack
+  request.kind = kind;
+  request.fontSize = size;
+  request.playlistIndex = playlistIndex;
+  request.fullRefresh = fullRefresh;
+  request.sequence = renderRequestCount + 1;
+  if (length > MAX_MESSAGE_BYTES) length = MAX_MESSAGE_BYTES;
+  memcpy(request.message, message, length);
+  request.message[length] = '\0';
+  request.length = length;
+  xQueueOverwrite(renderMailbox, &request);
+  renderRequestCount++;
+  return request.sequence;
+}
+
+// Queue a redraw of the QR codes or the current message
+void requestRender(RenderKind kind) {
+  requestRender(kind, displayMessage.c_str(), displayMessage.length(), fontSize, -1);
+}
+
+// Draw one request from the mailbox, on the render task
+void processRenderRequest(const RenderRequest &request) {
+  unsigned long startTime = millis();
+  xSemaphoreTake(frameMutex, portMAX_DELAY);
+  renderHoldsFrame = true;
+  if (request.fullRefresh) lastFrameValid = false;
+  if ((int32_t)(request.sequence - imageSequence) < 0) {
+    // An image was uploaded while this waited for the frame
+    LOG_DEBUG("Render request %u superseded by image upload", request.sequence);
+  } else if (request.kind == RENDER_HIBERNATE) {
+    // Deep sleep drops the controller's copy of the old image, so the next
+    // message has to go out as a full refresh
+    display.hibernate();
+    lastFrameValid = false;
+    LOG_DEBUG("Panel hibernating");
+  } else {
+    if (request.kind == RENDER_PLAYLIST) {
+      showPlaylistEntry(request.playlistIndex, request.message, request.length, request.fontSize);
+    } else {
+      shownPlaylistHash = 0;
+      if (request.kind == RENDER_IMAGE) {
+        showUploadedImage();
+      } else if (request.kind == RENDER_QR_CODES) {
+        displayQRCode();
+      } else {
+        updateDisplay(request.message, request.length, request.fontSize);
+      }
+    }
+    // The image stays without power, switch off the booster until the next update
+    display.powerOff();
+  }
+  releaseFrame();
+  renderedTime = millis() - startTime;
+  renderedSequence = request.sequence;
+  if (request.kind != RENDER_HIBERNATE) bootMilestone(bootFirstRender);
+  renderCount++;
+  if (mainLoopTask != NULL) xTaskNotifyGive(mainLoopTask);
+  LOG_DEBUG("Renders: %u of %u requests", renderCount, renderRequestCount);
+}
+
+// Render task: owns the display and draws the newest request
+// A burst of requests while a refresh is running collapses into one refresh
+void renderTask(void* parameter) {
+  static RenderRequest request;
+  // The panel is set up here so setup() does not wait for it
+  selectPanelSpi();
+  display.init(115200, true, 2, false);
+  setupPanelBusy();
+  bootMilestone(bootDisplayReady);
+  for (;;) {
+    if (xQueueReceive(renderMailbox, &request, portMAX_DELAY) != pdTRUE) continue;
+    processRenderRequest(request);
+  }
+}
+
+// Start the render task on the other core
+void startRenderTask() {
+  renderMailbox = xQueueCreate(1, sizeof(RenderRequest));
+  frameMutex = xSemaphoreCreateMutex();
+#if !FONTS_BUILTIN
+  fontMutex = xSemaphoreCreateMutex();
+#endif
+  xTaskCreatePinnedToCore(renderTask, "render", 8192, NULL, 1, &renderTaskHandle, RENDER_CORE);
+}
+
+// Power policy: how fast the CPU runs and when the panel is hibernated,
+// decided from recent traffic and associated stations. loop() does not poll,
+// it sleeps until an event or the policy's next change (untilChange())
+// Pure logic on a caller-supplied clock, nothing here touches the hardware
+enum PowerState { POWER_ACTIVE, POWER_IDLE, POWER_DOZE };
+const char* const POWER_STATE_NAMES[] = { "ACTIVE", "IDLE", "DOZE" };
+const uint32_t POWER_CPU_MHZ[] = { 240, 160, 80 };      // 80 MHz keeps the APB clock (SPI, UART) unchanged
+const unsigned long POWER_ACTIVE_WINDOW = 5000;         // Stay ACTIVE this long after the last request
+const unsigned long POWER_HIBERNATE_AFTER = 30000;      // Hibernate the panel after this long without renders
+
+struct PowerPolicy {
+  PowerState state = POWER_ACTIVE;
+  unsigned long lastActivity = 0;
+  unsigned long lastRender = 0;
+  unsigned long wakeTime = 0;
+  unsigned long lastWakeLatency = 0;  // Wake to first response, ms
+  PowerState wokeFrom = POWER_ACTIVE;
+  bool awaitingResponse = false;
+  bool panelHibernating = false;
+  bool rendering = false;
+  uint32_t wakeCount = 0;
+
+  // A request or a station joining, returns true if this woke us up
+  bool onActivity(unsigned long now) {
+    lastActivity = now;
+    if (state == POWER_ACTIVE) return false;
+    wokeFrom = state;
+    state = POWER_ACTIVE;
+    wakeTime = now;
+    awaitingResponse = true;
+    wakeCount++;
+    return true;
+  }
+
+  // A response went out, completes a pending wake latency measurement
+  void onResponse(unsigned long now) {
+    if (!awaitingResponse) return;
+    awaitingResponse = false;
+    lastWakeLatency = now - wakeTime;
+  }
+
+  // A render was queued, the panel is awake again until it is hibernated
+  void onRender(unsigned long now) {
+    lastRender = now;
+    panelHibernating = false;
+  }
+
+  // Settle down once traffic stops, renders in flight keep us ACTIVE
+  PowerState update(unsigned long now, int stations, bool renderPending) {
+    rendering = renderPending;
+    if (rendering) {
+      lastRender = now;
+      return state;
+    }
+    if (state == POWER_ACTIVE && now - lastActivity < POWER_ACTIVE_WINDOW) return state;
+    state = (stations > 0) ? POWER_IDLE : POWER_DOZE;
+    return state;
+  }
+
+  // True once when the panel should be put into deep sleep
+  bool shouldHibernate(unsigned long now) {
+    if (panelHibernating || state == POWER_ACTIVE || now - lastRender < POWER_HIBERNATE_AFTER) return false;
+    panelHibernating = true;
+    return true;
+  }
+
+  // ms until update() or shouldHibernate() would decide otherwise with no
+  // new activity, NO_DEADLINE if never; while rendering that waits for the
+  // render to finish, which wakes loop()
+  unsigned long untilChange(unsigned long now) const {
+    if (rendering) return NO_DEADLINE;
+    if (state == POWER_ACTIVE) {
+      unsigned long idle = now - lastActivity;
+      return (idle < POWER_ACTIVE_WINDOW) ? POWER_ACTIVE_WINDOW - idle : 0;
+    }
+    if (panelHibernating) return NO_DEADLINE;
+    unsigned long sinceRender = now - lastRender;
+    return (sinceRender < POWER_HIBERNATE_AFTER) ? POWER_HIBERNATE_AFTER - sinceRender : 0;
+  }
+  uint32_t cpuMhz() const { return POWER_CPU_MHZ[state]; }
+};
+
+PowerPolicy power;
+volatile bool stationEvent = false;
+
+// Apply the policy's CPU clock, logged once per state change
+void applyPowerState() {
+  static PowerState applied = POWER_ACTIVE;
+  if (power.state == applied) return;
+  applied = power.state;
+  setCpuFrequencyMhz(power.cpuMhz());
+  LOG_INFO("Power: %s, CPU %u MHz, %d stations", POWER_STATE_NAMES[applied], getCpuFrequencyMhz(),
+           WiFi.softAPgetStationNum());
+}
+
+// Called by handlers before doing any work
+void powerOnRequest() {
+  if (power.onActivity(millis())) applyPowerState();
+}
+
+// Called by handlers once the response is sent
+void powerOnResponse() {
+  bool pending = power.awaitingResponse;
+  power.onResponse(millis());
+  if (pending) {
+    LOG_INFO("Wake to first response: %lu ms (from %s)", power.lastWakeLatency,
+             POWER_STATE_NAMES[power.wokeFrom]);
+  }
+}
+
+// Station joined or left the AP (runs on the WiFi event task), wake loop()
+void onStationEvent(WiFiEvent_t event) {
+  stationEvent = true;
+  if (mainLoopTask != NULL) xTaskNotifyGive(mainLoopTask);
+}
+
+// Socket watch: loop() does not poll the web and WebSocket servers, this task
+// waits in select() on their sockets and wakes loop() when one has something
+// for it. Before it sleeps loop() hands over the sockets to wait on with
+// armNetWatch(), which also writes to an eventfd so a select() already
+// running starts over with them. After waking loop() the task waits for the
+// next set, a socket loop() left alone does not wake it again in between
+SemaphoreHandle_t netWatchMutex = NULL;
+NetWaitSet netWatchSet;
+int netWatchWakeFd = -1;
+uint32_t loopWakeups = 0;
+
+void netWatchTask(void* parameter) {
+  for (;;) {
+    NetWaitSet set;
+    xSemaphoreTake(netWatchMutex, portMAX_DELAY);
+    set = netWatchSet;
+    xSemaphoreGive(netWatchMutex);
+    set.add(netWatchWakeFd, set.readable);
+    int ready = select(set.maxFd + 1, &set.readable, &set.writable, NULL, NULL);
+    uint64_t count;
+    if (ready > 0 && FD_ISSET(netWatchWakeFd, &set.readable)) {
+      read(netWatchWakeFd, &count, sizeof(count));  // New sockets to wait on
+      continue;
+    }
+    // Something to do, or select() failed on a socket closed meanwhile;
+    // either way loop() looks and arms us again
+    xTaskNotifyGive(mainLoopTask);
+    fd_set wake;
+    FD_ZERO(&wake);
+    FD_SET(netWatchWakeFd, &wake);
+    select(netWatchWakeFd + 1, &wake, NULL, NULL, NULL);
+    read(netWatchWakeFd, &count, sizeof(count));
+  }
+}
+
+void startNetWatch() {
+  esp_vfs_eventfd_config_t config;
+  config.max_fds = 1;
+  esp_vfs_eventfd_register(&config);
+  netWatchWakeFd = eventfd(0, 0);
+  netWatchMutex = xSemaphoreCreateMutex();
+  netWatchSet.clear();
+  xTaskCreatePinnedToCore(netWatchTask, "netwatch", 3072, NULL, tskIDLE_PRIORITY + 1, NULL, 1);
+}
+
+// Hand the sockets loop() waits on to the watch task, returns the ms until
+// the next web server timeout. The web server picks its connections; its
+// listener only counts while a new connection would get a slot. Every other
+// lwIP socket belongs to the WebSocket server, which reads whatever arrives
+unsigned long armNetWatch(unsigned long now) {
+  NetWaitSet set;
+  set.clear();
+  unsigned long wait = server.waitSet(now, set);
+  for (int fd = LWIP_SOCKET_OFFSET; fd < LWIP_SOCKET_OFFSET + CONFIG_LWIP_MAX_SOCKETS; fd++) {
+    int listening = 0;
+    socklen_t size = sizeof(listening);
+    if (lwip_getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &size) != 0) continue;  // Not open
+    struct sockaddr_in local;
+    size = sizeof(local);
+    bool web = lwip_getsockname(fd, (struct sockaddr*)&local, &size) == 0 && ntohs(local.sin_port) == server.port();
+    if (!web || (listening && server.canAccept(now))) set.add(fd, set.readable);
+  }
+  if (netWatchWakeFd < 0) return wait;
+  xSemaphoreTake(netWatchMutex, portMAX_DELAY);
+  netWatchSet = set;
+  xSemaphoreGive(netWatchMutex);
+  uint64_t one = 1;
+  write(netWatchWakeFd, &one, sizeof(one));
+  return wait;
+}
+
+// Settings store: the message and font size live in RAM (displayMessage and
+// fontSize) and are written behind as one versioned, CRC-checked NVS blob
+// A change is flushed once no further change came in for SETTINGS_FLUSH_DELAY,
+// or right away before the panel is hibernated
+#define SETTINGS_VERSION 1
+#define SETTINGS_KEY "settings"
+const unsigned long SETTINGS_FLUSH_DELAY = 3000;
+
+struct SettingsHeader {
+  uint16_t version;
+  uint8_t fontSize;
+  uint8_t reserved;
+  uint16_t messageLength;
+  uint16_t reserved2;
+  uint32_t crc;  // Over the header (with crc = 0) and the message bytes
+};
+
+struct SettingsRecord {
+  SettingsHeader header;
+  char message[MAX_MESSAGE_BYTES];  // Not terminated, only messageLength bytes are stored
+};
+
+bool settingsDirty = false;
+unsigned long settingsChangedAt = 0;
+uint32_t settingsStoredCrc = 0;      // CRC of the record last read or written
+uint32_t settingsWrites = 0;
+uint32_t settingsWritesAvoided = 0;  // Changes that did not cost a flash write of their own
+
+// Fill in a record from the current settings, returns its stored size
+size_t buildSettingsRecord(SettingsRecord &record) {
+  size_t length = displayMessage.length();
+  if (length > MAX_MESSAGE_BYTES) length = MAX_MESSAGE_BYTES;
+  memset(&record.header, 0, sizeof(record.header));
+  record.header.version = SETTINGS_VERSION;
+  record.header.fontSize = fontSize;
+  record.header.messageLength = length;
+  memcpy(record.message, displayMessage.c_str(), length);
+  record.header.crc = crc32_le(0, (const uint8_t*)&record, sizeof(SettingsHeader) + length);
+  return sizeof(SettingsHeader) + length;
+}
+
+// Load the settings record with one read, returns false if it is missing or invalid
+bool loadSettings() {
+  static SettingsRecord record;
+  size_t size = preferences.getBytes(SETTINGS_KEY, &record, sizeof(record));
+  if (size < sizeof(SettingsHeader)) return false;
+  SettingsHeader &header = record.header;
+  if (header.version != SETTINGS_VERSION || size != sizeof(SettingsHeader) + header.messageLength) {
+    LOG_WARN("Settings record has version %u, size %u, ignored", header.version, (unsigned)size);
+    return false;
+  }
+  uint32_t crc = header.crc;
+  header.crc = 0;
+  if (crc32_le(0, (const uint8_t*)&record, size) != crc) {
+    LOG_WARN("Settings record CRC mismatch, ignored");
+    return false;
+  }
+  if (isFontSize(header.fontSize)) fontSize = header.fontSize;
+  displayMessage.assign(record.message, header.messageLength);
+  settingsStoredCrc = crc;
+  return true;
+}
+
+// Note that displayMessage or fontSize changed
+void markSettingsDirty(unsigned long now) {
+  if (settingsDirty) settingsWritesAvoided++;  // Folded into the pending write
+  settingsDirty = true;
+  settingsChangedAt = now;
+}
+
+// Write the settings record if anything changed, returns true if flash was written
+bool flushSettings() {
+  if (!settingsDirty) return false;
+  settingsDirty = false;
+  static SettingsRecord record;
+  size_t size = buildSettingsRecord(record);
+  if (record.header.crc == settingsStoredCrc) {
+    settingsWritesAvoided++;  // Changed back to what is stored already
+    return false;
+  }
+  unsigned long startTime = micros();
+  preferences.begin("epaper", false);
+  bool ok = preferences.putBytes(SETTINGS_KEY, &record, size) == size;
+  preferences.end();
+  if (!ok) {
+    LOG_ERROR("Saving settings failed");
+    return false;
+  }
+  settingsStoredCrc = record.header.crc;
+  settingsWrites++;
+  LOG_DEBUG("Settings saved: %u bytes in %lu us, %u writes, %u avoided", (unsigned)size,
+            micros() - startTime, settingsWrites, settingsWritesAvoided);
+  return true;
+}
+
+// Flush once the debounce window has passed, returns ms until the next check is due
+unsigned long flushSettingsIfDue(unsigned long now) {
+  if (!settingsDirty) return NO_DEADLINE;
+  unsigned long elapsed = now - settingsChangedAt;
+  if (elapsed < SETTINGS_FLUSH_DELAY) return SETTINGS_FLUSH_DELAY - elapsed;
+  flushSettings();
+  return NO_DEADLINE;
+}
+
+// Read the settings at boot, converting the separate keys older firmware used
+void setupSettings() {
+  preferences.begin("epaper", false);
+  bool loaded = loadSettings();
+  if (!loaded && preferences.isKey("message")) {
+    String legacy = preferences.getString("message", "Hello World!");
+    displayMessage.assign(legacy.c_str(), legacy.length());
+    fontSize = preferences.getInt("fontsize", 2);
+    LOG_INFO("Migrating message and font size to the settings record");
+    settingsDirty = true;
+  }
+  preferences.end();
+  if (settingsDirty && flushSettings()) {
+    preferences.begin("epaper", false);
+    preferences.remove("message");
+    preferences.remove("fontsize");
+    preferences.end();
+  }
+  if (loaded) {
+    LOG_INFO("Loaded saved message: %s", displayMessage.c_str());
+    LOG_INFO("Loaded saved font size: %d", fontSize);
+  }
+}
+
+// Playlist: messages shown in turn, each for playlistInterval
+// Edited by the web handlers, loop() queues the rotations
+struct PlaylistEntry {
+  MessageBuffer message;
+  int fontSize;
+};
+PlaylistEntry playlist[PLAYLIST_MAX_ENTRIES];
+int playlistLength = 0;
+int playlistPosition = 0;
+bool playlistRunning = false;
+unsigned long playlistInterval = 30000;
+unsigned long lastRotation = 0;
+
+// Queue the entry at playlistPosition for display
+void showPlaylistPosition(unsigned long now) {
+  const PlaylistEntry &entry = playlist[playlistPosition];
+  requestRender(RENDER_PLAYLIST, entry.message.c_str(), entry.message.length(), entry.fontSize, playlistPosition);
+  power.onRender(now);
+  lastRotation = now;
+}
+
+// Move on to the next entry once the current one has been shown long enough
+// Returns ms until the next rotation is due
+unsigned long rotatePlaylistIfDue(unsigned long now) {
+  if (!playlistRunning || playlistLength == 0 || showingQRCode) return NO_DEADLINE;
+  unsigned long elapsed = now - lastRotation;
+  if (elapsed < playlistInterval) return playlistInterval - elapsed;
+  playlistPosition = (playlistPosition + 1) % playlistLength;
+  showPlaylistPosition(now);
+  return playlistInterval;
+}
+
+// Playlist edits shared by the web form handler and the API
+// Each returns false if the arguments do not fit the current playlist
+bool playlistAdd(const char* message, size_t length, int size) {
+  if (length == 0 || playlistLength >= PLAYLIST_MAX_ENTRIES) return false;
+  playlist[playlistLength].message.assign(message, length);
+  playlist[playlistLength].fontSize = size;
+  playlistLength++;
+  return true;
+}
+
+bool playlistSet(int index, const char* message, size_t length, int size, unsigned long now) {
+  if (length == 0 || index < 0 || index >= playlistLength) return false;
+  playlist[index].message.assign(message, length);
+  playlist[index].fontSize = size;
+  if (playlistRunning && index == playlistPosition && !showingQRCode) showPlaylistPosition(now);
+  return true;
+}
+
+bool playlistRemove(int index) {
+  if (index < 0 || index >= playlistLength) return false;
+  for (int i = index; i < playlistLength - 1; i++) playlist[i] = playlist[i + 1];
+  playlistLength--;
+  if (playlistPosition >= playlistLength) playlistPosition = 0;
+  if (playlistLength == 0) playlistRunning = false;
+  return true;
+}
+
+void playlistClear() {
+  playlistLength = 0;
+  playlistRunning = false;
+}
+
+// Start from the first entry, intervalSeconds of 0 keeps the current interval
+bool playlistStart(long intervalSeconds, unsigned long now) {
+  if (playlistLength == 0) return false;
+  if (intervalSeconds >= 5) playlistInterval = intervalSeconds * 1000UL;
+  playlistRunning = true;
+  playlistPosition = 0;
+  showingQRCode = false;
+  showPlaylistPosition(now);
+  return true;
+}
+
+// Stop rotating and go back to the single message
+void playlistStop(unsigned long now) {
+  playlistRunning = false;
+  requestRender(RENDER_MESSAGE);
+  power.onRender(now);
+}
+
+// Make message the displayed text and queue it, shared by the form and the API
+// An empty message shows "Empty message", an invalid size keeps the current one
+// Returns the render sequence number
+uint32_t showMessage(const char* message, size_t length, int size, bool fullRefresh, unsigned long now) {
+  displayMessage.assign(message, length);
+  displayMessage.trim();
+  if (displayMessage.length() == 0) {
+    displayMessage.assign("Empty message");
+  }
+  if (isFontSize(size) && size != fontSize) {
+    fontSize = size;
+    LOG_INFO("Font size changed to: %d", fontSize);
+  }
+  
+  // Saved to NVS by loop() once the user stops changing things
+  markSettingsDirty(now);
+  
+  // Queue the display update, the render task refreshes the panel
+  uint32_t sequence = requestRender(RENDER_MESSAGE, displayMessage.c_str(), displayMessage.length(), fontSize, -1,
+                                    fullRefresh);
+  power.onRender(now);
+  showingQRCode = false; // Switch to message display
+  playlistRunning = false;
+  return sequence;
+}
+
+// Static parts of the web page, kept in flash and streamed out in chunks
+// Only the escaped message and the font size selection are filled in per request
+const char STYLE_CSS[] PROGMEM =
+  "body { font-family: Arial; text-align: center; background: #f0f0f0; padding: 20px; }"
+  ".container { max-width: 400px; margin: 0 auto; background: white; padding: 20px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }"
+  "h1 { color: #333; }"
+  "textarea { width: 100%; height: 150px; padding: 10px; font-size: 16px; border: 2px solid #ddd; border-radius: 5px; box-sizing: border-box; font-family: Arial; }"
+  "label { display: block; margin: 10px 0 5px 0; font-weight: bold; }"
+  "select { width: 100%; padding: 8px; font-size: 16px; border: 2px solid #ddd; border-radius: 5px; box-sizing: border-box; }"
+  "button { background: #4CAF50; color: white; padding: 12px 30px; font-size: 16px; border: none; border-radius: 5px; cursor: pointer; margin-top: 10px; }"
+  "button:hover { background: #45a049; }"
+  ".current { margin-top: 20px; padding: 10px; background: #e8f5e9; border-radius: 5px; }";
+
+// Serve the stylesheet pre-compressed (set to 0 to send STYLE_CSS as plain text)
+#define SERVE_GZIPPED_CSS 1
+
+// STYLE_CSS compressed with gzip -9 -n, regenerate it whenever STYLE_CSS changes
+const uint8_t STYLE_CSS_GZ[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xb5, 0x92, 0x61, 0x6b, 0x83, 0x30,
+  0x10, 0x86, 0xff, 0xca, 0x41, 0x19, 0x6c, 0x30, 0x4b, 0xac, 0x75, 0xb4, 0xfa, 0xa9, 0x0c, 0xf6,
+  0x3f, 0x4e, 0x13, 0x35, 0x34, 0x4d, 0x24, 0xc6, 0x69, 0x3b, 0xfc, 0xef, 0x3b, 0x53, 0xd7, 0x62,
+  0x27, 0xfb, 0x36, 0xfc, 0xe4, 0x1d, 0x3c, 0xf7, 0xdc, 0xe5, 0xcd, 0x0c, 0x3f, 0xc3, 0x17, 0x14,
+  0x46, 0xbb, 0xa0, 0xc0, 0x93, 0x54, 0xe7, 0x04, 0x0e, 0x56, 0xa2, 0x4a, 0xc1, 0x89, 0xde, 0x05,
+  0xa8, 0x64, 0xa9, 0x13, 0xc8, 0x85, 0x76, 0xc2, 0xa6, 0x90, 0x61, 0x7e, 0x2c, 0xad, 0x69, 0x35,
+  0x4f, 0x60, 0x55, 0xb0, 0xf1, 0x4b, 0xa1, 0x46, 0xce, 0xa5, 0x2e, 0x13, 0xd8, 0xb0, 0xba, 0x4f,
+  0x61, 0x58, 0xe7, 0x44, 0x43, 0xa9, 0x85, 0x25, 0xf2, 0x09, 0xfb, 0xa0, 0x93, 0xdc, 0x55, 0x09,
+  0x6c, 0x99, 0xef, 0x9f, 0xd0, 0x96, 0x92, 0x98, 0x0c, 0xb0, 0x75, 0x66, 0xce, 0xec, 0x2a, 0xe9,
+  0xc4, 0x2f, 0x62, 0x66, 0x2c, 0x17, 0x36, 0xb0, 0xc8, 0x65, 0xdb, 0x24, 0x10, 0x4e, 0xc5, 0x3e,
+  0x68, 0x2a, 0xe4, 0xa6, 0x1b, 0x51, 0x9b, 0xba, 0xf7, 0x75, 0xb0, 0x65, 0x86, 0xcf, 0xec, 0xd5,
+  0x7f, 0xeb, 0xf0, 0x85, 0x74, 0xaa, 0x90, 0x34, 0x72, 0xa3, 0x8c, 0x25, 0xe7, 0x28, 0x8a, 0xa8,
+  0x34, 0xae, 0x86, 0x56, 0x20, 0x35, 0x26, 0xb7, 0x90, 0xb1, 0xa7, 0x14, 0x2a, 0x21, 0xcb, 0xca,
+  0xd1, 0x5f, 0xec, 0x47, 0xdc, 0x34, 0xae, 0x13, 0xfd, 0x91, 0x1a, 0x79, 0x11, 0x54, 0x78, 0xbb,
+  0x7b, 0x25, 0x7e, 0x78, 0x63, 0x94, 0xe4, 0xb0, 0xe2, 0x9c, 0xff, 0xf2, 0x8d, 0x6f, 0xba, 0xf2,
+  0xe2, 0x71, 0x53, 0x9f, 0x4a, 0xe9, 0xe2, 0xe5, 0x07, 0x85, 0x99, 0x50, 0x24, 0xc7, 0x65, 0x53,
+  0x2b, 0xa4, 0x46, 0xa6, 0x4c, 0x7e, 0xbc, 0x9f, 0xce, 0x6f, 0xca, 0x46, 0x30, 0xb0, 0x09, 0xd1,
+  0x4d, 0xea, 0x99, 0x51, 0x64, 0x30, 0x34, 0x42, 0x89, 0xdc, 0x3d, 0xee, 0x77, 0x5b, 0x68, 0xf7,
+  0x6f, 0xfb, 0x0c, 0x59, 0xeb, 0x9c, 0xd1, 0x34, 0x79, 0x96, 0x95, 0xed, 0xfb, 0xe1, 0x23, 0x26,
+  0xd7, 0xe9, 0x1d, 0x1e, 0xdf, 0x39, 0x1c, 0x47, 0x46, 0x7f, 0x5f, 0x59, 0x1b, 0x2d, 0x96, 0x5d,
+  0xf2, 0xd6, 0x36, 0x23, 0xb5, 0x36, 0xf2, 0x1a, 0xd3, 0xeb, 0x9d, 0x02, 0x67, 0xea, 0x9f, 0xb7,
+  0x9b, 0xb4, 0x92, 0xca, 0x7c, 0xfa, 0x58, 0xce, 0xe5, 0x62, 0x64, 0xdb, 0xbd, 0x4f, 0x6e, 0x6b,
+  0x2d, 0x45, 0xdd, 0xe7, 0xf6, 0x8e, 0xd8, 0x2c, 0xa5, 0x61, 0x46, 0x10, 0xbb, 0x22, 0x16, 0xfb,
+  0x65, 0xbb, 0xe1, 0x1b, 0x53, 0xb2, 0xde, 0xa3, 0x64, 0x03, 0x00, 0x00,
+};
+
+const char PAGE_HEAD[] PROGMEM =
+  "<!DOCTYPE html><html><head>"
+  "<meta name='viewport' content='width=device-width, initial-scale=1'>"
+  "<title>E-Paper Message</title>"
+  "<link rel='stylesheet' href='/style.css'>"
+  "</head><body>"
+  "<div class='container'>"
+  "<h1>📱 E-Paper Message</h1>"
+  "<form method='POST' action='/send' accept-charset='UTF-8'>"
+  "<textarea name='message' placeholder='Enter your message here...' maxlength='" STRINGIFY(MAX_MESSAGE_BYTES) "'>";
+
+const char PAGE_FONT_SELECT[] PROGMEM =
+  "</textarea><br>"
+  "<label for='fontsize'>Font Size:</label>"
+  "<select name='fontsize' id='fontsize'>";
+
+const char PAGE_CURRENT[] PROGMEM =
+  "</select><br>"
+  "<button type='submit'>Send to Display</button>"
+  "</form>"
+  "<div class='current'><strong>Current:</strong><br>";
+
+const char PAGE_TAIL[] PROGMEM = "</div></div></body></html>";
+
+const char PAGE_REDIRECT[] PROGMEM = "<script>setTimeout(function(){window.location.href='/';}, 2000);</script>";
+
+const char* const FONT_SIZE_NAMES[] = { "Small (9pt)", "Medium (12pt)", "Large (18pt)", "X-Large (24pt)",
+                                        "Auto-fit" };
+
+// Collects small pieces of the page and sends them as ~1 KB chunks
+struct ChunkWriter {
+  char buf[1024];
+  size_t len = 0;
+  
+  void flush() {
+    if (len > 0) {
+      server.sendContent(buf, len);
+      len = 0;
+    }
+  }
+  
+  void add(const char* data, size_t n) {
+    while (n > 0) {
+      size_t room = sizeof(buf) - len;
+      size_t part = (n < room) ? n : room;
+      memcpy_P(buf + len, data, part);
+      len += part;
+      data += part;
+      n -= part;
+      if (len == sizeof(buf)) flush();
+    }
+  }
+  
+  void add(const char* text) { add(text, strlen_P(text)); }
+  
+  // Add text with the HTML special characters escaped
+  void addEscaped(const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      char c = text[i];
+      switch (c) {
+        case '&': add("&amp;", 5); break;
+        case '<': add("&lt;", 4); break;
+        case '>': add("&gt;", 4); break;
+        case '"': add("&quot;", 6); break;
+        case '\'': add("&#39;", 5); break;
+        default: add(&c, 1); break;
+      }
+    }
+  }
+};
+
+// ETag for the page, changes whenever the message or font size does
+void getPageETag(char* etag, size_t size) {
+  // FNV-1a hash over the message and font size
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < displayMessage.length(); i++) {
+    hash = (hash ^ (uint8_t)displayMessage.text[i]) * 16777619u;
+  }
+  hash = (hash ^ (uint8_t)fontSize) * 16777619u;
+  snprintf(etag, size, "\"%08x\"", hash);
+}
+
+// Stream the HTML page with form, optionally redirecting back to / afterwards
+void sendPage(bool redirect) {
+  METRIC_TIMER(pageMetric);
+  unsigned long startTime = micros();
+  
+  if (!redirect) {
+    char etag[12];
+    getPageETag(etag, sizeof(etag));
+    server.sendHeader("ETag", etag);
+    server.sendHeader("Cache-Control", "no-cache");
+    if (strcmp(server.header("If-None-Match"), etag) == 0) {
+      server.send(304);
+      return;
+    }
+  }
+  
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/html; charset=UTF-8", "");
+  unsigned long firstByteTime = micros() - startTime;
+  
+  ChunkWriter page;
+  page.add(PAGE_HEAD);
+  page.addEscaped(displayMessage.c_str(), displayMessage.length());
+  page.add(PAGE_FONT_SELECT);
+  for (int size = 1; size <= FONT_SIZE_AUTO; size++) {
+    char option[40];
+    snprintf(option, sizeof(option), "<option value='%d'%s>", size, fontSize == size ? " selected" : "");
+    page.add(option);
+    page.add(FONT_SIZE_NAMES[size - 1]);
+    page.add("</option>");
+  }
+  page.add(PAGE_CURRENT);
+  page.addEscaped(displayMessage.c_str(), displayMessage.length());
+  page.add(PAGE_TAIL);
+  if (redirect) page.add(PAGE_REDIRECT);
+  page.flush();
+  server.sendContent("");  // End of chunked response
+  bootMilestone(bootFirstResponse);
+  
+  LOG_DEBUG("Page sent: TTFB %lu us, total %lu us, free heap %u, min free heap %u",
+            firstByteTime, micros() - startTime, ESP.getFreeHeap(), ESP.getMinFreeHeap());
+}
+
+// Handle root page
+void handleRoot() {
+  METRIC_TIMER(requestMetric);
+  powerOnRequest();
+  LOG_DEBUG("Root page requested from: %s", server.client().remoteIP().toString().c_str());
+  sendPage(false);
+  powerOnResponse();
+}
+
+// Handle stylesheet, cached by the browser for a day
+void handleStyle() {
+  METRIC_TIMER(requestMetric);
+  powerOnRequest();
+  server.sendHeader("Cache-Control", "max-age=86400");
+#if SERVE_GZIPPED_CSS
+  server.sendHeader("Content-Encoding", "gzip");
+  server.send_P(200, "text/css", (const char*)STYLE_CSS_GZ, sizeof(STYLE_CSS_GZ));
+#else
+  server.send_P(200, "text/css", STYLE_CSS);
+#endif
+  powerOnResponse();
+}
+
+// Handle log page: the most recent entries still in the ring buffer
+void handleLogs() {
+  METRIC_TIMER(requestMetric);
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; charset=UTF-8", "");
+  ChunkWriter page;
+  static LogEntry entry;
+  char line[LOG_TEXT_LEN + 24];
+  uint32_t head = logHead.load(std::memory_order_acquire);
+  uint32_t seq = (head > LOG_ENTRIES) ? head - LOG_ENTRIES : 0;
+  for (; seq != head; seq++) {
+    if (!logRead(seq, entry)) continue;
+    int n = snprintf(line, sizeof(line), "[%lu] %c %s\n", (unsigned long)entry.time,
+                     LOG_LEVEL_LETTERS[entry.level], entry.text);
+    page.add(line, (n < (int)sizeof(line)) ? n : sizeof(line) - 1);
+  }
+  snprintf(line, sizeof(line), "dropped: %u\n", (unsigned)logDropped.load());
+  page.add(line);
+  page.flush();
+  server.sendContent("");
+}
+
+extern bool imageHoldsFrame;
+
+// Handle screen dump: the current frame as a binary PBM (P4) image
+// The frame rows are already in PBM bit order, so they are sent as they are,
+// under frameMutex so no half drawn frame goes out. Sending does not wait for
+// the client, what the socket does not take is copied into the queue
+// An image upload holds the frame across loop() calls, it is not waited for
+void handleScreen() {
+  METRIC_TIMER(requestMetric);
+  if (imageHoldsFrame || xSemaphoreTake(frameMutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+    server.send(503, "text/plain", "display busy");
+    return;
+  }
+  char header[24];
+  int headerLength = snprintf(header, sizeof(header), "P4\n%d %d\n", FRAME_WIDTH, FRAME_HEIGHT);
+  server.setContentLength(headerLength + sizeof(frame.rows));
+  server.send(200, "image/x-portable-bitmap", "");
+  server.sendContent(header, headerLength);
+  server.sendContent((const char*)frame.rows, sizeof(frame.rows));
+  xSemaphoreGive(frameMutex);
+}
+
+// Handle playlist: GET shows the entries and cache statistics, POST edits it
+// POST takes action=add|set|remove|clear|start|stop with index, message,
+// fontsize and interval (seconds) as needed
+void handlePlaylist() {
+  METRIC_TIMER(requestMetric);
+  powerOnRequest();
+  if (server.method() == HTTP_POST) {
+    const char* action = server.arg("action");
+    int index = server.hasArg("index") ? atoi(server.arg("index")) : -1;
+    static MessageBuffer message;
+    message.assign(server.arg("message"));
+    message.trim();
+    int size = server.hasArg("fontsize") ? atoi(server.arg("fontsize")) : fontSize;
+    if (!isFontSize(size)) size = fontSize;
+    unsigned long now = millis();
+    bool ok = false;
+    
+    if (strcmp(action, "add") == 0) {
+      ok = playlistAdd(message.c_str(), message.length(), size);
+    } else if (strcmp(action, "set") == 0) {
+      ok = playlistSet(index, message.c_str(), message.length(), size, now);
+    } else if (strcmp(action, "remove") == 0) {
+      ok = playlistRemove(index);
+    } else if (strcmp(action, "clear") == 0) {
+      playlistClear();
+      ok = true;
+    } else if (strcmp(action, "start") == 0) {
+      ok = playlistStart(atol(server.arg("interval")), now);
+    } else if (strcmp(action, "stop") == 0) {
+      playlistStop(now);
+      ok = true;
+    }
+    if (!ok) {
+      server.send(400, "text/plain", "Bad Request");
+      powerOnResponse();
+      return;
+    }
+    LOG_INFO("Playlist %s: %d entries, %s", action, playlistLength, playlistRunning ? "running" : "stopped");
+  }
+  
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; charset=UTF-8", "");
+  ChunkWriter page;
+  char line[96];
+  snprintf(line, sizeof(line), "%s, %lu s per entry, showing %d of %d\n",
+           playlistRunning ? "running" : "stopped", playlistInterval / 1000,
+           playlistLength ? playlistPosition + 1 : 0, playlistLength);
+  page.add(line);
+  for (int i = 0; i < playlistLength; i++) {
+    snprintf(line, sizeof(line), "%d: [size %d] ", i, playlist[i].fontSize);
+    page.add(line);
+    page.add(playlist[i].message.c_str());
+    page.add("\n");
+  }
+  uint32_t lookups = playlistHits + playlistMisses;
+  snprintf(line, sizeof(line), "cache: %u hits, %u misses (%u%%), last rotation %lu ms\n",
+           playlistHits, playlistMisses, lookups ? playlistHits * 100 / lookups : 0, lastRotationTime);
+  page.add(line);
+  page.flush();
+  server.sendContent("");
+  powerOnResponse();
+}
 
-// Web server on port 80
-WebServer server(80);
+#if ENABLE_BENCH
+// Benchmarks of the hot paths, run on the device at /bench
+// Each case runs a fixed number of times on private buffers (the render task
+// keeps the display frame), timed with the CPU cycle counter
+// Allocations are counted by wrapping malloc/calloc/realloc at link time
+// (see [env:bench] in platformio.ini), only those made by the calling task
+TaskHandle_t benchTask = NULL;
+volatile uint32_t benchAllocs = 0;
 
-// Store the message to display
-String displayMessage = "Hello World!";
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
 
-// Store the font size (1=small, 2=medium, 3=large, 4=xlarge)
-int fontSize = 2; // Default to medium (12pt)
+void* __wrap_malloc(size_t size) {
+  if (benchTask != NULL && xTaskGetCurrentTaskHandle() == benchTask) benchAllocs++;
+  return __real_malloc(size);
+}
+void* __wrap_calloc(size_t count, size_t size) {
+  if (benchTask != NULL && xTaskGetCurrentTaskHandle() == benchTask) benchAllocs++;
+  return __real_calloc(count, size);
+}
+void* __wrap_realloc(void* ptr, size_t size) {
+  if (benchTask != NULL && xTaskGetCurrentTaskHandle() == benchTask) benchAllocs++;
+  return __real_realloc(ptr, size);
+}
+}
 
-// E-paper display
-GxEPD2_BW<GxEPD2_370_GDEY037T03, GxEPD2_370_GDEY037T03::HEIGHT> display(GxEPD2_370_GDEY037T03(EPD_CS, EPD_DC, EPD_RST, EPD_BUSY));
+// Inputs and scratch space shared by the cases
+struct BenchContext {
+  MessageBuffer message;
+  MessageBuffer update;
+  MessageBuffer longMessage;
+  MessageBuffer fullMessage;
+  char qrData[96];
+  uint16_t text[MAX_TEXT_GLYPHS];
+  TextLayout layout;
+  TextLayout sizedLayout;
+  uint16_t fitText[MAX_TEXT_GLYPHS];
+  int fitLength;
+  FitMemo fit;
+  QRBitmap qr;
+  FrameBuffer frame;
+  uint8_t panel[sizeof(FrameBuffer)];
+  ChunkWriter page;
+};
 
-// Preferences for storing data in NVS (Non-Volatile Storage)
-Preferences preferences;
+// A case returns the glyph draw calls it makes, or sets up for the raster
+// stage to make, 0 if it draws no text
+typedef int (*BenchFunction)(BenchContext &ctx);
 
-// Track boot time and QR code display duration
-unsigned long bootTime = 0;
-const unsigned long QR_DISPLAY_DURATION = 60000; // 1 minute in milliseconds
-bool showingQRCode = true;
+int benchUtf8(BenchContext &ctx) {
+  handleUTF8(ctx.message.c_str(), ctx.message.length(), ctx.text, MAX_TEXT_GLYPHS, getFont(2));
+  return 0;
+}
+// Decoder throughput on a message of MAX_MESSAGE_BYTES
+int benchUtf8Full(BenchContext &ctx) {
+  handleUTF8(ctx.fullMessage.c_str(), ctx.fullMessage.length(), ctx.text, MAX_TEXT_GLYPHS, getFont(2));
+  return 0;
+}
+// Glyphs a layout hands to rasterizeLayout(), one draw call each
+int layoutDrawCalls(const TextLayout &layout) {
+  int count = 0;
+  for (int r = 0; r < layout.runCount; r++) count += layout.runs[r].length;
+  return count;
+}
+int benchLayout(BenchContext &ctx) {
+  layoutText(ctx.message.c_str(), ctx.message.length(), 2, ctx.layout);
+  return layoutDrawCalls(ctx.layout);
+}
+// A 200 character message at each fixed size
+int benchLayoutSize(BenchContext &ctx, int size) {
+  layoutText(ctx.longMessage.c_str(), ctx.longMessage.length(), size, ctx.sizedLayout);
+  return layoutDrawCalls(ctx.sizedLayout);
+}
+int benchLayout9(BenchContext &ctx) { return benchLayoutSize(ctx, 1); }
+int benchLayout12(BenchContext &ctx) { return benchLayoutSize(ctx, 2); }
+int benchLayout18(BenchContext &ctx) { return benchLayoutSize(ctx, 3); }
+int benchLayout24(BenchContext &ctx) { return benchLayoutSize(ctx, 4); }
+int benchRaster(BenchContext &ctx) { return rasterizeLayout(ctx.frame, ctx.layout); }
+// Same with every glyph bitmap read from the font file again
+int benchRasterCold(BenchContext &ctx) {
+  clearGlyphCache();
+  return rasterizeLayout(ctx.frame, ctx.layout);
+}
+// The submit path up to the panel: copy and trim the message, decode, lay out, rasterize
+int benchMessageUpdate(BenchContext &ctx) {
+  ctx.update.assign(ctx.message.c_str(), ctx.message.length());
+  ctx.update.trim();
+  layoutText(ctx.update.c_str(), ctx.update.length(), 2, ctx.layout);
+  return rasterizeLayout(ctx.frame, ctx.layout);
+}
+// Auto-fit of a 200 character message, from nothing and after a one character edit
+int benchAutoFit(BenchContext &ctx) {
+  memset(&ctx.fit, 0, sizeof(ctx.fit));
+  fitFontSize(ctx.fitText, ctx.fitLength, ctx.fit);
+  return 0;
+}
+int benchAutoFitEdit(BenchContext &ctx) {
+  ctx.fitText[100] = (ctx.fitText[100] == 'x') ? 'y' : 'x';
+  fitFontSize(ctx.fitText, ctx.fitLength, ctx.fit);
+  return 0;
+}
+int benchPageEscape(BenchContext &ctx) {
+  ctx.page.addEscaped(ctx.message.c_str(), ctx.message.length());
+  ctx.page.len = 0;  // Nothing is sent
+  return 0;
+}
+int benchQRGenerate(BenchContext &ctx) {
+  const uint8_t versions[] = { 3 };
+  generateQRBitmap(ctx.qrData, versions, 1, ctx.qr);
+  return 0;
+}
+int benchQRDraw(BenchContext &ctx) {
+  drawQRCode(ctx.frame, ctx.qr, 10, 10, 5);
+  return 0;
+}
+int benchFrameToPanel(BenchContext &ctx) {
+  frameToPanel(ctx.frame, 0, FRAME_HEIGHT, ctx.panel);
+  return 0;
+}
 
-// Function to draw a real QR code on the display
-void drawQRCode(QRCode qrcode, int x, int y, int scale) {
-  // Draw the QR code module by module
-  for (uint8_t qy = 0; qy < qrcode.size; qy++) {
-    for (uint8_t qx = 0; qx < qrcode.size; qx++) {
-      if (qrcode_getModule(&qrcode, qx, qy)) {
-        display.fillRect(x + qx * scale, y + qy * scale, scale, scale, GxEPD_BLACK);
-      }
-    }
+struct BenchCase {
+  const char* name;
+  BenchFunction run;
+  int iterations;
+};
+
+const BenchCase BENCH_CASES[] = {
+  { "utf8_decode", benchUtf8, 200 },
+  { "utf8_decode_512", benchUtf8Full, 100 },
+  { "layout", benchLayout, 200 },
+  { "layout_9pt", benchLayout9, 100 },
+  { "layout_12pt", benchLayout12, 100 },
+  { "layout_18pt", benchLayout18, 100 },
+  { "layout_24pt", benchLayout24, 100 },
+  { "raster", benchRaster, 50 },
+  { "raster_cold", benchRasterCold, 20 },
+  { "message_update", benchMessageUpdate, 50 },
+  { "autofit", benchAutoFit, 100 },
+  { "autofit_edit", benchAutoFitEdit, 200 },
+  { "page_escape", benchPageEscape, 200 },
+  { "qr_generate", benchQRGenerate, 5 },
+  { "qr_draw", benchQRDraw, 50 },
+  { "frame_to_panel", benchFrameToPanel, 10 },
+};
+
+struct BenchResult {
+  unsigned long nsPerOp;
+  unsigned long allocsPerOp;
+  int drawCalls;  // Per call
+};
+
+// Fill in the inputs of the cases
+void prepareBench(BenchContext &ctx) {
+  ctx.message.assign("Halló heimur! Þetta er prófun á skjánum með íslenskum stöfum: "
+                     "á é í ó ú ý þ æ ö ð. The quick brown fox jumps.");
+  char fill[MAX_MESSAGE_BYTES * 2];
+  size_t filled = 0;
+  while (filled + ctx.message.length() <= sizeof(fill)) {
+    memcpy(fill + filled, ctx.message.c_str(), ctx.message.length());
+    filled += ctx.message.length();
   }
+  ctx.fullMessage.assign(fill, filled);  // Cut to MAX_MESSAGE_BYTES
+  snprintf(ctx.qrData, sizeof(ctx.qrData), "WIFI:T:WPA;S:%s;P:%s;;", ssid, password);
+  layoutText(ctx.message.c_str(), ctx.message.length(), 2, ctx.layout);
+  const char fitMessage[] = "Halló heimur! Þetta er prófun á skjánum með íslenskum stöfum: á é í ó ú ý þ æ ö ð. "
+                            "The quick brown fox jumps over the lazy dog while the panel waits for its next "
+                            "refresh, and the message keeps growing.";
+  ctx.longMessage.assign(fitMessage, strlen(fitMessage));
+  ctx.fitLength = handleUTF8(fitMessage, strlen(fitMessage), ctx.fitText, MAX_TEXT_GLYPHS, getFont(2));
+  const uint8_t versions[] = { 3 };
+  generateQRBitmap(ctx.qrData, versions, 1, ctx.qr);
 }
 
-// Function to draw a character with accent support (forward declaration)
-int drawCharWithAccent(char c, int x, int y);
+// Run one case once to warm up caches, then time its iterations and count
+// the allocations they make
+BenchResult runBenchCase(const BenchCase &c, BenchContext &ctx) {
+  uint32_t mhz = getCpuFrequencyMhz();
+  benchTask = xTaskGetCurrentTaskHandle();
+  c.run(ctx);
+  benchAllocs = 0;
+  int drawCalls = 0;
+  uint32_t startCycles = ESP.getCycleCount();
+  for (int i = 0; i < c.iterations; i++) drawCalls = c.run(ctx);
+  uint32_t cycles = ESP.getCycleCount() - startCycles;
+  uint32_t allocs = benchAllocs;
+  benchTask = NULL;
+  BenchResult result;
+  result.nsPerOp = (unsigned long)((uint64_t)cycles * 1000 / mhz / c.iterations);
+  result.allocsPerOp = (allocs + c.iterations - 1) / c.iterations;
+  result.drawCalls = drawCalls;
+  return result;
+}
 
-// Function to display two QR codes side by side
-void displayQRCode() {
-  Serial.println("Generating QR codes...");
-  
-  // Get the IP address that ESP32 assigned itself
-  IPAddress IP = WiFi.softAPIP();
-  
-  // Create WiFi QR code string (left QR code)
-  String wifiQRData = "WIFI:T:WPA;S:" + String(ssid) + ";P:" + String(password) + ";;";
-  
-  // Create web address QR code string (right QR code)
-  String webQRData = "http://" + IP.toString();
-  
-  Serial.println("WiFi QR Data: " + wifiQRData);
-  Serial.println("Web QR Data: " + webQRData);
-  
-  // Generate WiFi QR code (use version 3 for more data capacity)
-  QRCode wifiQR;
-  uint8_t wifiQRDataBuffer[qrcode_getBufferSize(3)];
-  int wifiResult = qrcode_initText(&wifiQR, wifiQRDataBuffer, 3, 0, wifiQRData.c_str());
-  
-  if (wifiResult != 0) {
-    Serial.println("WiFi QR code generation failed, trying version 2...");
-    // Fallback to version 2 if version 3 fails
-    uint8_t wifiQRDataBuffer2[qrcode_getBufferSize(2)];
-    wifiResult = qrcode_initText(&wifiQR, wifiQRDataBuffer2, 2, 0, wifiQRData.c_str());
-    if (wifiResult != 0) {
-      Serial.println("WiFi QR code generation failed!");
-      return;
-    }
+// Look up the limits for a case in a table, NULL if it has none
+const BenchThreshold* findBenchThreshold(const BenchThreshold* table, size_t count, const char* name) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(table[i].name, name) == 0) return &table[i];
   }
-  
-  // Generate Web QR code
-  QRCode webQR;
-  uint8_t webQRDataBuffer[qrcode_getBufferSize(2)];
-  int webResult = qrcode_initText(&webQR, webQRDataBuffer, 2, 0, webQRData.c_str());
-  
-  if (webResult != 0) {
-    Serial.println("Web QR code generation failed!");
+  return NULL;
+}
+
+// Whether a result is within its limits, a time limit of 0 is not checked
+bool benchWithinLimits(const BenchResult &result, const BenchThreshold* limit) {
+  if (limit == NULL) return true;
+  if (limit->maxNsPerOp != 0 && result.nsPerOp > limit->maxNsPerOp) return false;
+  return result.allocsPerOp <= limit->maxAllocsPerOp;
+}
+
+// One report line per case
+void formatBenchLine(char* line, size_t size, const char* name, const BenchResult &result,
+                     const BenchThreshold* limit, bool ok) {
+  char nsLimit[24] = "-";
+  if (limit != NULL && limit->maxNsPerOp != 0) snprintf(nsLimit, sizeof(nsLimit), "%lu", limit->maxNsPerOp);
+  snprintf(line, size, "%-16s %10lu ns/op %4lu allocs/op %4d draws  limit %10s ns %4lu allocs  %s\n", name,
+           result.nsPerOp, result.allocsPerOp, result.drawCalls, nsLimit, limit ? limit->maxAllocsPerOp : 0UL,
+           ok ? "ok" : "FAIL");
+}
+
+// Handle benchmark run: one line per case, 500 if any case is over its limits
+void handleBench() {
+  powerOnRequest();  // Runs at full clock
+  BenchContext* ctx = new (std::nothrow) BenchContext();
+  if (ctx == NULL) {
+    server.send(503, "text/plain", "Not enough memory");
+    powerOnResponse();
     return;
   }
+  prepareBench(*ctx);
   
-  Serial.println("Both QR codes generated successfully!");
-  Serial.println("WiFi QR size: " + String(wifiQR.size) + " modules");
-  Serial.println("Web QR size: " + String(webQR.size) + " modules");
-  
-  display.setFullWindow();
-  display.firstPage();
-  do
-  {
-    display.fillScreen(GxEPD_WHITE);
-    
-    // Target display size for both QR codes (same pixel size)
-    int targetDisplaySize = 175;  // Target size in pixels (25 modules * 7 scale)
-    
-    // Calculate scale for each QR code to achieve same display size
-    int wifiScale = targetDisplaySize / wifiQR.size;
-    int webScale = targetDisplaySize / webQR.size;
-    
-    // Actual display sizes
-    int wifiDisplaySize = wifiQR.size * wifiScale;
-    int webDisplaySize = webQR.size * webScale;
-    
-    // Use the larger of the two for spacing calculations
-    int maxDisplaySize = (wifiDisplaySize > webDisplaySize) ? wifiDisplaySize : webDisplaySize;
-    
-    // Calculate spacing - two QR codes with more gap between them
-    int gap = 60;  // Larger gap between QR codes
-    int totalWidth = (maxDisplaySize * 2) + gap;
-    int startX = (display.width() - totalWidth) / 2;
-    int labelY = 10;  // Y position for labels
-    int qrY = labelY + 20;  // Y position for QR codes (below labels)
-    
-    // Center each QR code within its allocated space
-    int leftQRX = startX + (maxDisplaySize - wifiDisplaySize) / 2;
-    int rightQRX = startX + maxDisplaySize + gap + (maxDisplaySize - webDisplaySize) / 2;
-    
-    // Set font for labels
-    display.setFont(&FreeMonoBold9pt7b);
-    display.setTextColor(GxEPD_BLACK);
-    
-    // Draw left label (centered above QR code)
-    int leftLabelX = startX + (maxDisplaySize / 2) - 15;  // Approximate center
-    display.setCursor(leftLabelX, labelY);
-    display.print("WiFi");
-    
-    // Draw left QR code (WiFi join)
-    drawQRCode(wifiQR, leftQRX, qrY, wifiScale);
-    
-    // Draw right label (centered above QR code)
-    int rightLabelX = startX + maxDisplaySize + gap + (maxDisplaySize / 2) - 10;  // Approximate center
-    display.setCursor(rightLabelX, labelY);
-    display.print("Web");
-    
-    // Draw right QR code (Web address)
-    drawQRCode(webQR, rightQRX, qrY, webScale);
-    
+  String report;
+  bool passed = true;
+  for (const BenchCase &c : BENCH_CASES) {
+    BenchResult result = runBenchCase(c, *ctx);
+    const BenchThreshold* limit =
+      findBenchThreshold(BENCH_THRESHOLDS, sizeof(BENCH_THRESHOLDS) / sizeof(BENCH_THRESHOLDS[0]), c.name);
+    bool ok = benchWithinLimits(result, limit);
+    passed = passed && ok;
+    char line[128];
+    formatBenchLine(line, sizeof(line), c.name, result, limit, ok);
+    report += line;
   }
-  while (display.nextPage());
+  delete ctx;
   
-  Serial.println("Both QR codes displayed!");
-  Serial.println("Left: WiFi join, Right: Web address");
+  report += passed ? "PASS\n" : "FAIL\n";
+  LOG_INFO("Benchmarks at %u MHz: %s", getCpuFrequencyMhz(), passed ? "PASS" : "FAIL");
+  server.send(passed ? 200 : 500, "text/plain; charset=UTF-8", report);
+  powerOnResponse();
 }
+#endif
 
-// Function to handle UTF-8 characters (including Icelandic)
-// Converts UTF-8 encoded characters to displayable format
-// Note: FreeMono fonts may not support all extended ASCII characters
-String handleUTF8(String text) {
-  String result = "";
-  Serial.print("Original UTF-8: ");
-  for (int i = 0; i < text.length(); i++) {
-    Serial.print("0x");
-    if (text[i] < 16) Serial.print("0");
-    Serial.print((unsigned char)text[i], HEX);
-    Serial.print(" ");
-  }
-  Serial.println();
-  
-  for (int i = 0; i < text.length(); i++) {
-    unsigned char c = text[i];
-    // Check if this is a UTF-8 multi-byte character
-    if ((c & 0x80) == 0) {
-      // Single byte ASCII character
-      result += (char)c;
-    } else if ((c & 0xE0) == 0xC0) {
-      // Two-byte UTF-8 character (like ó, á, é, etc.)
-      if (i + 1 < text.length()) {
-        unsigned char c2 = text[i + 1];
-        // Map common Icelandic characters to Latin-1/ISO-8859-1 codes
-        // These match the UTF-8 to ISO-8859-1 conversion
-        if (c == 0xC3) {
-          switch (c2) {
-            case 0xB3: result += (char)0xF3; break; // ó -> 0xF3 (243)
-            case 0xA1: result += (char)0xE1; break; // á -> 0xE1 (225)
-            case 0xA9: result += (char)0xE9; break; // é -> 0xE9 (233)
-            case 0xAD: result += (char)0xED; break; // í -> 0xED (237)
-            case 0xBA: result += (char)0xFA; break; // ú -> 0xFA (250)
-            case 0xBD: result += (char)0xFD; break; // ý -> 0xFD (253)
-            case 0xBE: result += (char)0xFE; break; // þ -> 0xFE (254)
-            case 0xB0: result += (char)0xF0; break; // ð -> 0xF0 (240)
-            case 0x93: result += (char)0xD3; break; // Ó -> 0xD3 (211)
-            case 0x81: result += (char)0xC1; break; // Á -> 0xC1 (193)
-            case 0x89: result += (char)0xC9; break; // É -> 0xC9 (201)
-            case 0x8D: result += (char)0xCD; break; // Í -> 0xCD (205)
-            case 0x9A: result += (char)0xDA; break; // Ú -> 0xDA (218)
-            case 0x9D: result += (char)0xDD; break; // Ý -> 0xDD (221)
-            case 0x9E: result += (char)0xDE; break; // Þ -> 0xDE (222)
-            case 0x90: result += (char)0xD0; break; // Ð -> 0xD0 (208)
-            default: 
-              Serial.print("Unknown UTF-8: 0xC3 0x");
-              Serial.println(c2, HEX);
-              result += '?'; 
-              break;
-          }
-          i++; // Skip the next byte as we've processed it
-        } else {
-          result += '?'; // Unknown UTF-8 sequence
-        }
-      }
+#if ENABLE_METRICS
+// Append one histogram in Prometheus text format (cumulative buckets, seconds)
+void addHistogram(ChunkWriter &page, const Histogram &metric) {
+  Histogram h = metric.snapshot();
+  char line[128];
+  snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", h.name, h.help, h.name);
+  page.add(line);
+  uint32_t cumulative = 0;
+  for (size_t i = 0; i <= METRIC_BUCKET_COUNT; i++) {
+    cumulative += h.buckets[i];
+    if (i < METRIC_BUCKET_COUNT) {
+      uint32_t us = METRIC_BUCKETS_US[i];
+      snprintf(line, sizeof(line), "%s_bucket{le=\"%u.%06u\"} %u\n", h.name,
+               (unsigned)(us / 1000000), (unsigned)(us % 1000000), cumulative);
     } else {
-      // Other UTF-8 sequences - skip or replace with ?
-      result += '?';
+      snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %u\n", h.name, cumulative);
     }
+    page.add(line);
   }
-  
-  Serial.print("Converted: ");
-  Serial.println(result);
-  return result;
+  uint64_t sumUs = h.sumUs;
+  snprintf(line, sizeof(line), "%s_sum %lu.%06lu\n%s_count %u\n", h.name,
+           (unsigned long)(sumUs / 1000000), (unsigned long)(sumUs % 1000000), h.name, h.count);
+  page.add(line);
 }
 
-// Function to draw a character with accent support
-// Returns the width of the character drawn
-int drawCharWithAccent(char c, int x, int y) {
-  // Calculate character width based on font size
-  int charWidth;
-  int accentOffset;
-  switch(fontSize) {
-    case 1: charWidth = 9; accentOffset = 12; break;
-    case 2: charWidth = 11; accentOffset = 14; break;
-    case 3: charWidth = 16; accentOffset = 20; break;
-    case 4: charWidth = 21; accentOffset = 26; break;
-    default: charWidth = 11; accentOffset = 14; break;
-  }
-  char baseChar = c;
-  bool hasAccent = false;
-  
-  Serial.print("drawCharWithAccent: char=0x");
-  Serial.print((unsigned char)c, HEX);
-  Serial.print(" (");
-  Serial.print((unsigned char)c);
-  Serial.print(")");
-  
-  // Map extended ASCII Icelandic characters to base characters + accent
-  if ((unsigned char)c >= 0x80) {
-    switch ((unsigned char)c) {
-      case 0xF3: baseChar = 'o'; hasAccent = true; break; // ó
-      case 0xE1: baseChar = 'a'; hasAccent = true; break; // á
-      case 0xE9: baseChar = 'e'; hasAccent = true; break; // é
-      case 0xED: baseChar = 'i'; hasAccent = true; break; // í
-      case 0xFA: baseChar = 'u'; hasAccent = true; break; // ú
-      case 0xFD: baseChar = 'y'; hasAccent = true; break; // ý
-      case 0xD3: baseChar = 'O'; hasAccent = true; break; // Ó
-      case 0xC1: baseChar = 'A'; hasAccent = true; break; // Á
-      case 0xC9: baseChar = 'E'; hasAccent = true; break; // É
-      case 0xCD: baseChar = 'I'; hasAccent = true; break; // Í
-      case 0xDA: baseChar = 'U'; hasAccent = true; break; // Ú
-      case 0xDD: baseChar = 'Y'; hasAccent = true; break; // Ý
-      case 0xFE: baseChar = 'p'; hasAccent = false; break; // þ
-      case 0xF0: baseChar = 'd'; hasAccent = false; break; // ð
-      case 0xDE: baseChar = 'P'; hasAccent = false; break; // Þ
-      case 0xD0: baseChar = 'D'; hasAccent = false; break; // Ð
-      default: 
-        baseChar = '?'; 
-        Serial.print(" -> UNKNOWN");
-        break;
-    }
-    Serial.print(" -> baseChar='");
-    Serial.print(baseChar);
-    Serial.print("' hasAccent=");
-    Serial.print(hasAccent);
-  }
-  Serial.println();
-  
-  // Draw the base character
-  display.setCursor(x, y);
-  display.print(baseChar);
-  
-  // Draw accent mark if needed (acute accent - single diagonal line)
-  if (hasAccent) {
-    // Draw a single diagonal line for the acute accent (from bottom-left to top-right)
-    // Adjust accent position based on font size
-    int accentX1, accentY1, accentX2, accentY2;
-    switch(fontSize) {
-      case 1: accentX1 = x + 2; accentY1 = y - 11; accentX2 = x + 6; accentY2 = y - 13; break;
-      case 2: accentX1 = x + 2; accentY1 = y - 13; accentX2 = x + 7; accentY2 = y - 16; break;
-      case 3: accentX1 = x + 3; accentY1 = y - 18; accentX2 = x + 10; accentY2 = y - 22; break;
-      case 4: accentX1 = x + 4; accentY1 = y - 24; accentX2 = x + 13; accentY2 = y - 29; break;
-      default: accentX1 = x + 2; accentY1 = y - 13; accentX2 = x + 7; accentY2 = y - 16; break;
-    }
-    display.drawLine(accentX1, accentY1, accentX2, accentY2, GxEPD_BLACK);
-  }
-  
-  return charWidth;
+// Append one gauge or counter
+void addMetric(ChunkWriter &page, const char* name, const char* type, const char* help, uint32_t value) {
+  char line[256];
+  snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %u\n", name, help, name, type, name, value);
+  page.add(line);
 }
 
-// Function to update the e-paper display with text message
-void updateDisplay(String message) {
-  Serial.println("Updating display with: " + message);
-  Serial.print("Font size: ");
-  Serial.println(fontSize);
+// Handle metrics scrape: latency histograms, heap gauges and a few counters
+void handleMetrics() {
+  // Heap figures are sampled first so the page itself does not show up in them
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t minFreeHeap = ESP.getMinFreeHeap();
+  uint32_t largestBlock = ESP.getMaxAllocHeap();
   
-  // Handle UTF-8 characters (including Icelandic)
-  String processedMessage = handleUTF8(message);
-  
-  display.setFullWindow();
-  display.firstPage();
-  do
-  {
-    display.fillScreen(GxEPD_WHITE);
-    
-    // Set font based on fontSize (1=9pt, 2=12pt, 3=18pt, 4=24pt)
-    switch(fontSize) {
-      case 1: display.setFont(&FreeMonoBold9pt7b); break;
-      case 2: display.setFont(&FreeMonoBold12pt7b); break;
-      case 3: display.setFont(&FreeMonoBold18pt7b); break;
-      case 4: display.setFont(&FreeMonoBold24pt7b); break;
-      default: display.setFont(&FreeMonoBold12pt7b); break;
-    }
-    display.setTextColor(GxEPD_BLACK);
-    
-    // Calculate line height and character width based on font size
-    // Include spacing between characters in the width calculation
-    int lineHeight, charWidth, charSpacing, startY;
-    switch(fontSize) {
-      case 1: lineHeight = 20; charWidth = 9; charSpacing = 0; startY = 20; break;
-      case 2: lineHeight = 25; charWidth = 11; charSpacing = 1; startY = 25; break;
-      case 3: lineHeight = 35; charWidth = 16; charSpacing = 2; startY = 30; break;
-      case 4: lineHeight = 45; charWidth = 21; charSpacing = 3; startY = 35; break;
-      default: lineHeight = 25; charWidth = 11; charSpacing = 1; startY = 25; break;
-    }
-    // Total width per character including spacing
-    int totalCharWidth = charWidth + charSpacing;
-    
-    // Word wrap the message with accent support
-    int y = startY;
-    int x = 10;
-    int lineStartX = 10;
-    int maxLineWidth = display.width() - 20;
-    
-    for (int i = 0; i < processedMessage.length(); i++) {
-      char c = processedMessage[i];
-      
-      if (c == '\n' || c == '\r') {
-        // New line
-        y += lineHeight;
-        x = lineStartX;
-      } else {
-        // Check if we need to wrap (use totalCharWidth which includes spacing)
-        if (x + totalCharWidth > lineStartX + maxLineWidth && i > 0) {
-          // Find last space to break at word boundary
-          int lastSpace = -1;
-          for (int j = i - 1; j >= 0 && j > i - 30; j--) {
-            if (processedMessage[j] == ' ') {
-              lastSpace = j;
-              break;
-            }
-          }
-          
-          if (lastSpace >= 0) {
-            // Rewind and print up to last space
-            y += lineHeight;
-            x = lineStartX;
-            i = lastSpace + 1; // Skip the space
-            continue;
-          } else {
-            // No space found, break here
-            y += lineHeight;
-            x = lineStartX;
-          }
-        }
-        
-        // Draw character with accent support
-        int charWidthDrawn = drawCharWithAccent(c, x, y);
-        // Add spacing between characters (already calculated in charSpacing)
-        x += charWidthDrawn + charSpacing;
-      }
-    }
-  }
-  while (display.nextPage());
-  
-  Serial.println("Display updated!");
-}
-
-// HTML page with form
-String getHTML() {
-  String html = "<!DOCTYPE html><html><head>";
-  html += "<meta name='viewport' content='width=device-width, initial-scale=1'>";
-  html += "<title>E-Paper Message</title>";
-  html += "<style>";
-  html += "body { font-family: Arial; text-align: center; background: #f0f0f0; padding: 20px; }";
-  html += ".container { max-width: 400px; margin: 0 auto; background: white; padding: 20px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }";
-  html += "h1 { color: #333; }";
-  html += "textarea { width: 100%; height: 150px; padding: 10px; font-size: 16px; border: 2px solid #ddd; border-radius: 5px; box-sizing: border-box; }";
-  html += "button { background: #4CAF50; color: white; padding: 12px 30px; font-size: 16px; border: none; border-radius: 5px; cursor: pointer; margin-top: 10px; }";
-  html += "button:hover { background: #45a049; }";
-  html += ".current { margin-top: 20px; padding: 10px; background: #e8f5e9; border-radius: 5px; }";
-  html += "</style></head><body>";
-  html += "<div class='container'>";
-  html += "<h1>📱 E-Paper Message</h1>";
-  html += "<form method='POST' action='/send' accept-charset='UTF-8'>";
-  html += "<textarea name='message' placeholder='Enter your message here...' maxlength='200' style='font-family: Arial;'>" + displayMessage + "</textarea><br>";
-  html += "<label for='fontsize' style='display: block; margin: 10px 0 5px 0; font-weight: bold;'>Font Size:</label>";
-  html += "<select name='fontsize' id='fontsize' style='width: 100%; padding: 8px; font-size: 16px; border: 2px solid #ddd; border-radius: 5px; box-sizing: border-box;'>";
-  html += "<option value='1'" + String(fontSize == 1 ? " selected" : "") + ">Small (9pt)</option>";
-  html += "<option value='2'" + String(fontSize == 2 ? " selected" : "") + ">Medium (12pt)</option>";
-  html += "<option value='3'" + String(fontSize == 3 ? " selected" : "") + ">Large (18pt)</option>";
-  html += "<option value='4'" + String(fontSize == 4 ? " selected" : "") + ">X-Large (24pt)</option>";
-  html += "</select><br>";
-  html += "<button type='submit'>Send to Display</button>";
-  html += "</form>";
-  html += "<div class='current'><strong>Current:</strong><br>" + displayMessage + "</div>";
-  html += "</div></body></html>";
-  return html;
-}
-
-// Handle root page
-void handleRoot() {
-  Serial.println("Root page requested from: " + server.client().remoteIP().toString());
-  server.send(200, "text/html; charset=UTF-8", getHTML());
-  Serial.println("Root page sent successfully");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; version=0.0.4", "");
+  ChunkWriter page;
+  for (const Histogram* h : METRICS) addHistogram(page, *h);
+  addMetric(page, "epaper_heap_free_bytes", "gauge", "Free heap", freeHeap);
+  addMetric(page, "epaper_heap_min_free_bytes", "gauge", "Lowest free heap since boot", minFreeHeap);
+  addMetric(page, "epaper_heap_largest_block_bytes", "gauge", "Largest allocatable heap block", largestBlock);
+  addMetric(page, "epaper_uptime_seconds", "counter", "Time since boot", millis() / 1000);
+  addMetric(page, "epaper_boot_first_response_ms", "gauge", "Time from boot to the first HTTP 200 (0 = none yet)",
+            bootFirstResponse / 1000);
+  addMetric(page, "epaper_boot_first_render_ms", "gauge", "Time from boot to the first panel refresh (0 = none yet)",
+            bootFirstRender / 1000);
+  addMetric(page, "epaper_cpu_mhz", "gauge", "Current CPU clock", getCpuFrequencyMhz());
+  addMetric(page, "epaper_stations", "gauge", "Stations associated with the AP", WiFi.softAPgetStationNum());
+  addMetric(page, "epaper_loop_wakeups_total", "counter", "Times loop() ran, each woken by an event or a deadline",
+            loopWakeups);
+  addMetric(page, "epaper_renders_total", "counter", "Display renders completed", renderCount);
+  addMetric(page, "epaper_panel_bytes_total", "counter", "Image bytes written to the panel", panelBytesSent);
+  addMetric(page, "epaper_panel_transfer_bytes_per_second", "gauge", "Throughput of the last panel write",
+            panelTransferRate);
+  addMetric(page, "epaper_panel_busy_ms_total", "counter", "Time the render task slept waiting for BUSY", panelBusyMs);
+  addMetric(page, "epaper_panel_busy_wakeups_total", "counter", "BUSY waits woken by an edge or timeout",
+            panelBusyWakeups);
+  addMetric(page, "epaper_http_connections_total", "counter", "HTTP connections accepted", httpConnections);
+  addMetric(page, "epaper_http_connections_open", "gauge", "HTTP connections open", server.activeConnections());
+  addMetric(page, "epaper_http_requests_total", "counter", "HTTP requests handled", httpRequests);
+  addMetric(page, "epaper_http_reused_total", "counter", "HTTP requests on a kept-alive connection",
+            httpReusedRequests);
+  addMetric(page, "epaper_http_rejected_total", "counter", "HTTP requests refused by the server", httpRejected);
+  addMetric(page, "epaper_serial_frames_total", "counter", "Serial control frames received", serialFrames);
+  addMetric(page, "epaper_serial_bad_frames_total", "counter", "Serial frames dropped for a bad CRC or length",
+            serialBadFrames);
+  addMetric(page, "epaper_playlist_cache_hits_total", "counter", "Playlist frames served from the cache", playlistHits);
+  addMetric(page, "epaper_playlist_cache_misses_total", "counter", "Playlist frames rendered", playlistMisses);
+#if !FONTS_BUILTIN
+  addMetric(page, "epaper_glyph_cache_hits_total", "counter", "Glyph bitmaps drawn from the cache", glyphCacheHits);
+  addMetric(page, "epaper_glyph_cache_misses_total", "counter", "Glyph bitmaps read from a font file",
+            glyphCacheMisses);
+  addMetric(page, "epaper_font_loads_total", "counter", "Font glyph tables read from LittleFS", fontLoads);
+  addMetric(page, "epaper_font_load_ms", "gauge", "Time to read the last glyph table", fontLoadTime);
+#endif
+  addMetric(page, "epaper_settings_writes_total", "counter", "Settings records written to NVS", settingsWrites);
+  addMetric(page, "epaper_settings_writes_avoided_total", "counter", "Settings changes that needed no write of their own",
+            settingsWritesAvoided);
+  addMetric(page, "epaper_log_dropped_total", "counter", "Log entries dropped", logDropped.load());
+  page.flush();
+  server.sendContent("");
 }
+#endif
 
 // Handle form submission
 void handleSend() {
+  METRIC_TIMER(requestMetric);
+  powerOnRequest();
   if (server.hasArg("message")) {
     // Get the raw message - server.arg() should handle URL decoding
-    displayMessage = server.arg("message");
+    // (it points into the request buffer, showMessage makes the only copy)
+    const char* message = server.arg("message");
+    size_t length = strlen(message);
     
     // Get font size if provided
-    if (server.hasArg("fontsize")) {
-      int newFontSize = server.arg("fontsize").toInt();
-      if (newFontSize >= 1 && newFontSize <= 4) {
-        fontSize = newFontSize;
-        Serial.print("Font size changed to: ");
-        Serial.println(fontSize);
-      }
-    }
-    
-    Serial.println("=== Raw message received ===");
-    Serial.print("Length: ");
-    Serial.println(displayMessage.length());
-    Serial.print("Bytes: ");
-    for (int i = 0; i < displayMessage.length(); i++) {
-      Serial.print("0x");
-      if ((unsigned char)displayMessage[i] < 16) Serial.print("0");
-      Serial.print((unsigned char)displayMessage[i], HEX);
-      Serial.print(" ");
-    }
-    Serial.println();
-    Serial.print("As string: ");
-    Serial.println(displayMessage);
-    
-    displayMessage.trim();
-    
-    if (displayMessage.length() == 0) {
-      displayMessage = "Empty message";
-    }
+    int size = server.hasArg("fontsize") ? atoi(server.arg("fontsize")) : fontSize;
     
-    // Save message and font size to NVS storage
-    preferences.begin("epaper", false);
-    preferences.putString("message", displayMessage);
-    preferences.putInt("fontsize", fontSize);
-    preferences.end();
-    Serial.println("Message and font size saved to storage");
+    LOG_DEBUG("Raw message received, length %u", (unsigned)length);
+    LOG_HEXDUMP("Bytes", message, length);
     
-    // Update the display
-    updateDisplay(displayMessage);
-    showingQRCode = false; // Switch to message display
+    showMessage(message, length, size, false, millis());
     
     // Send response
-    server.send(200, "text/html; charset=UTF-8", getHTML() + "<script>setTimeout(function(){window.location.href='/';}, 2000);</script>");
-    Serial.println("Message processed and displayed");
+    sendPage(true);
+    LOG_INFO("Message processed and queued for display");
   } else {
     server.send(400, "text/plain", "Bad Request");
   }
+  powerOnResponse();
 }
 
-void setup() {
-  Serial.begin(115200);
-  delay(1000);
+// Update API for scripts: POST /api/v1/display with one operation or a batch,
+// answered with a short status instead of the page
+//
+// JSON body: {"op":"show","message":"Hi","font":2,"full":true} or {"ops":[{...},...]}
+//   op: show (default), playlist_add, playlist_clear, playlist_start ("interval"
+//   in seconds) or playlist_stop; full forces a full refresh; font is 1-4 or 5 (auto-fit)
+// Binary body (first byte 0x01): version, op count, then for each op:
+//   op (ApiOp), font, flags (bit 0 = full refresh), arg u16 LE (interval),
+//   length u16 LE, message bytes
+// Answer: {"ok":true,"applied":N,"seq":S} or, for binary, status, applied, seq u32 LE
+// A failed JSON request is answered with "ok":false and an "error" text
+// seq is the render sequence number, the WebSocket reports it once it is on the panel
+enum ApiOp { API_SHOW = 1, API_PLAYLIST_ADD, API_PLAYLIST_CLEAR, API_PLAYLIST_START, API_PLAYLIST_STOP };
+const char* const API_OP_NAMES[] = { "", "show", "playlist_add", "playlist_clear", "playlist_start", "playlist_stop" };
+#define API_BINARY_VERSION 1
+#define API_MAX_BODY 4096
+#define API_MAX_OPS 16
+enum ApiStatus { API_OK, API_BAD_REQUEST, API_TOO_LARGE, API_BAD_OP };
+
+char apiBody[API_MAX_BODY];
+size_t apiBodyLength = 0;
+bool apiBodyTooLarge = false;
+
+// Collect the raw request body, binary safe
+void handleApiBody() {
+  HTTPRaw &raw = server.raw();
+  if (raw.status == RAW_START) {
+    apiBodyLength = 0;
+    apiBodyTooLarge = false;
+  } else if (raw.status == RAW_WRITE) {
+    if (apiBodyLength + raw.currentSize > API_MAX_BODY) {
+      apiBodyTooLarge = true;
+      return;
+    }
+    memcpy(apiBody + apiBodyLength, raw.buf, raw.currentSize);
+    apiBodyLength += raw.currentSize;
+  }
+}
+
+// Apply one operation, sequence is updated for ops that render
+bool applyApiOp(int op, const char* message, size_t length, int size, bool fullRefresh, long arg,
+                unsigned long now, uint32_t &sequence) {
+  if (!isFontSize(size)) size = fontSize;
+  switch (op) {
+    case API_SHOW:
+      sequence = showMessage(message, length, size, fullRefresh, now);
+      return true;
+    case API_PLAYLIST_ADD:
+      return playlistAdd(message, length, size);
+    case API_PLAYLIST_CLEAR:
+      playlistClear();
+      return true;
+    case API_PLAYLIST_START:
+      if (!playlistStart(arg, now)) return false;
+      sequence = renderRequestCount;
+      return true;
+    case API_PLAYLIST_STOP:
+      playlistStop(now);
+      sequence = renderRequestCount;
+      return true;
+  }
+  return false;
+}
+
+// Apply one operation of a JSON body, error says why it was not applied
+bool applyJsonOp(JsonVariantConst item, unsigned long now, uint32_t &sequence, const char* &error) {
+  if (!item.is<JsonObjectConst>()) {
+    error = "operation is not an object";
+    return false;
+  }
+  const char* name = item["op"] | "show";
+  int op = 1;
+  while (op <= API_PLAYLIST_STOP && strcmp(API_OP_NAMES[op], name) != 0) op++;
+  if (op > API_PLAYLIST_STOP) {
+    error = "unknown op";
+    return false;
+  }
+  if ((op == API_SHOW || op == API_PLAYLIST_ADD) && !item["message"].is<const char*>()) {
+    error = "message missing";
+    return false;
+  }
+  const char* message = item["message"] | "";
+  if (!applyApiOp(op, message, strlen(message), item["font"] | fontSize, item["full"] | false,
+                  item["interval"] | 0L, now, sequence)) {
+    error = "operation not possible now";
+    return false;
+  }
+  return true;
+}
+
+// Run the operations of a JSON body, returns the status
+ApiStatus runJsonOps(int &applied, uint32_t &sequence, const char* &error) {
+  static StaticJsonDocument<2048> doc;
+  if (deserializeJson(doc, apiBody, apiBodyLength)) {  // Strings stay in apiBody
+    error = "invalid JSON";
+    return API_BAD_REQUEST;
+  }
+  if (!doc.is<JsonObject>()) {
+    error = "body is not a JSON object";
+    return API_BAD_REQUEST;
+  }
+  unsigned long now = millis();
+  JsonVariantConst ops = doc["ops"];
+  if (ops.isNull()) {
+    if (!applyJsonOp(doc.as<JsonVariantConst>(), now, sequence, error)) return API_BAD_OP;
+    applied++;
+    return API_OK;
+  }
+  if (!ops.is<JsonArrayConst>()) {
+    error = "ops is not an array";
+    return API_BAD_REQUEST;
+  }
+  if (ops.size() > API_MAX_OPS) {
+    error = "too many operations";
+    return API_TOO_LARGE;
+  }
+  for (JsonVariantConst item : ops.as<JsonArrayConst>()) {
+    if (!applyJsonOp(item, now, sequence, error)) return API_BAD_OP;
+    applied++;
+  }
+  return API_OK;
+}
+
+// Run the operations of a binary body, returns the status
+ApiStatus runBinaryOps(int &applied, uint32_t &sequence) {
+  const uint8_t* p = (const uint8_t*)apiBody;
+  const uint8_t* end = p + apiBodyLength;
+  if (apiBodyLength < 2 || p[0] != API_BINARY_VERSION) return API_BAD_REQUEST;
+  int count = p[1];
+  if (count > API_MAX_OPS) return API_TOO_LARGE;
+  p += 2;
+  unsigned long now = millis();
+  for (int i = 0; i < count; i++) {
+    if (end - p < 7) return API_BAD_REQUEST;
+    uint8_t op = p[0];
+    uint8_t size = p[1];
+    uint8_t flags = p[2];
+    uint16_t arg = p[3] | (p[4] << 8);
+    uint16_t length = p[5] | (p[6] << 8);
+    p += 7;
+    if (end - p < length) return API_BAD_REQUEST;
+    const char* message = (const char*)p;  // Used in place, not terminated
+    p += length;
+    if (!applyApiOp(op, message, length, size, flags & 1, arg, now, sequence)) return API_BAD_OP;
+    applied++;
+  }
+  return API_OK;
+}
+
+// Handle API request once the body is in
+void handleApi() {
+  METRIC_TIMER(requestMetric);
+  powerOnRequest();
+  int applied = 0;
+  uint32_t sequence = renderedSequence;
+  bool binary = apiBodyLength > 0 && apiBody[0] == API_BINARY_VERSION;
+  ApiStatus status = API_TOO_LARGE;
+  const char* error = "body too large";
+  if (!apiBodyTooLarge) {
+    status = binary ? runBinaryOps(applied, sequence) : runJsonOps(applied, sequence, error);
+  }
+  int code = (status == API_OK) ? 200 : (status == API_TOO_LARGE) ? 413 : 400;
+  if (code == 200) bootMilestone(bootFirstResponse);
   
-  Serial.println("Initializing e-paper display...");
+  if (binary) {
+    uint8_t reply[6] = { (uint8_t)status, (uint8_t)applied, (uint8_t)sequence, (uint8_t)(sequence >> 8),
+                         (uint8_t)(sequence >> 16), (uint8_t)(sequence >> 24) };
+    server.setContentLength(sizeof(reply));
+    server.send(code, "application/octet-stream", "");
+    server.sendContent((const char*)reply, sizeof(reply));
+  } else {
+    char reply[128];
+    if (status == API_OK) {
+      snprintf(reply, sizeof(reply), "{\"ok\":true,\"applied\":%d,\"seq\":%u}", applied, sequence);
+    } else {
+      snprintf(reply, sizeof(reply), "{\"ok\":false,\"applied\":%d,\"seq\":%u,\"error\":\"%s\"}", applied,
+               sequence, error);
+    }
+    server.send(code, "application/json", reply);
+  }
+  LOG_DEBUG("API %s request: %u bytes, %d ops applied, status %d", binary ? "binary" : "JSON",
+            (unsigned)apiBodyLength, applied, status);
+  powerOnResponse();
+}
+
+// WebSocket events: new clients are told the last rendered sequence
+void onWebSocketEvent(uint8_t client, WStype_t type, uint8_t* payload, size_t length) {
+  if (type == WStype_CONNECTED) {
+    char event[64];
+    snprintf(event, sizeof(event), "{\"event\":\"hello\",\"seq\":%u}", renderedSequence);
+    webSocket.sendTXT(client, event);
+  }
+}
+
+// Push a render-complete event when the render task finished something new
+void notifyRendered() {
+  static uint32_t notifiedSequence = 0;
+  uint32_t sequence = renderedSequence;
+  if (sequence == notifiedSequence) return;
+  notifiedSequence = sequence;
+  char event[64];
+  snprintf(event, sizeof(event), "{\"event\":\"rendered\",\"seq\":%u,\"ms\":%lu}", sequence, renderedTime);
+  webSocket.broadcastTXT(event);
+}
+
+// Image uploads: the body is decoded into the frame as it arrives, the frame
+// is only held once the header passed the checks. Uploads come from the web
+// server or the serial port, both in loop(); while one of them is using the
+// decoder the other is turned away
+enum ImageSource { IMAGE_FROM_NONE, IMAGE_FROM_HTTP, IMAGE_FROM_SERIAL };
+ImageDecoder imageDecoder;
+ImageSource imageOwner = IMAGE_FROM_NONE;
+bool imageHoldsFrame = false;
+uint32_t imageFreeHeapStart = 0;
+uint32_t imageFreeHeapLowest = 0;
+unsigned long imageDecodeTime = 0;  // us spent in the decoder
+
+// Done with the upload, successful or not
+void endImage() {
+  if (imageHoldsFrame) xSemaphoreGive(frameMutex);
+  imageHoldsFrame = false;
+  imageOwner = IMAGE_FROM_NONE;
+}
+
+// Start of an upload of bodyLength bytes in the given format
+// Returns false if the other source is in the middle of one
+bool beginImage(ImageSource source, ImageFormat format, size_t bodyLength) {
+  if (imageOwner != IMAGE_FROM_NONE && imageOwner != source) return false;
+  endImage();
+  imageOwner = source;
+  imageUploadStart = millis();
+  imageFreeHeapStart = imageFreeHeapLowest = ESP.getFreeHeap();
+  imageDecodeTime = 0;
+  imageDecoder.begin(format);
+  // An RLE frame with one run per pixel is the largest valid upload
+  if (bodyLength > (size_t)FRAME_WIDTH * FRAME_HEIGHT + 6) imageDecoder.fail(413, "upload too large");
+  return true;
+}
+
+// Once the header is in: check the body size against it and take the frame
+void takeImageFrame(size_t bodyLength) {
+  ImageDecoder &d = imageDecoder;
+  bool exact = d.format != IMAGE_RLE;
+  if (bodyLength > d.maxBodySize() || (exact && bodyLength != d.maxBodySize())) {
+    return d.fail(bodyLength > d.maxBodySize() ? 413 : 400, "body size does not match the image");
+  }
+  if (xSemaphoreTake(frameMutex, pdMS_TO_TICKS(5000)) != pdTRUE) {
+    return d.fail(503, "display busy");
+  }
+  imageHoldsFrame = true;
+  frameClear(frame);
+}
+
+// Decode the next chunk of a body of bodyLength bytes
+void feedImage(size_t bodyLength, const uint8_t* data, size_t n) {
+  ImageDecoder &d = imageDecoder;
+  if (d.headerDone && !imageHoldsFrame && d.error == NULL) takeImageFrame(bodyLength);  // Raw, no header
+  unsigned long decodeStart = micros();
+  while (n > 0 && d.error == NULL) {
+    bool hadHeader = d.headerDone;
+    size_t used = d.feed(frame, data, n);
+    data += used;
+    n -= used;
+    if (!hadHeader && d.headerDone && d.error == NULL) takeImageFrame(bodyLength);
+  }
+  imageDecodeTime += micros() - decodeStart;
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < imageFreeHeapLowest) imageFreeHeapLowest = freeHeap;
+}
+
+// Queue the decoded image and end the upload, returns the render sequence number
+// Queued while the frame is still held, anything queued before is dropped
+uint32_t showImage(unsigned long now) {
+  imageSequence = requestRender(RENDER_IMAGE, "", 0, fontSize, -1);
+  endImage();
+  power.onRender(now);
+  showingQRCode = false;
+  playlistRunning = false;
+  LOG_INFO("Image %dx%d received in %lu ms, decode %lu us, peak heap use %u bytes", imageDecoder.width,
+           imageDecoder.height, now - imageUploadStart, imageDecodeTime, imageFreeHeapStart - imageFreeHeapLowest);
+  return imageSequence;
+}
+
+bool httpImageRefused = false;  // The serial port had the decoder when the upload started
+
+// Answer a rejected upload straight away instead of reading the rest of it
+void rejectImageBody() {
+  server.rejectRaw(imageDecoder.errorCode, imageDecoder.error);
+  endImage();
+}
+
+void handleImageBody() {
+  HTTPRaw &raw = server.raw();
+  if (raw.status == RAW_START) {
+    // The format is picked with the first chunk
+    httpImageRefused = !beginImage(IMAGE_FROM_HTTP, IMAGE_PBM, server.clientContentLength());
+    if (httpImageRefused) {
+      server.rejectRaw(503, "display busy");
+    } else if (imageDecoder.error != NULL) {
+      rejectImageBody();
+    }
+  } else if (httpImageRefused) {
+    return;
+  } else if (raw.status == RAW_WRITE) {
+    const uint8_t* data = raw.buf;
+    size_t n = raw.currentSize;
+    if (raw.totalSize == n && imageDecoder.error == NULL) {
+      // First chunk: format from the query, or sniffed from the first byte
+      const char* format = server.arg("format");
+      ImageFormat f = (strcmp(format, "pbm") == 0 || (*format == '\0' && data[0] == 'P')) ? IMAGE_PBM :
+                      (strcmp(format, "rle") == 0 || (*format == '\0' && data[0] == 'R')) ? IMAGE_RLE : IMAGE_RAW;
+      imageDecoder.begin(f);
+    }
+    feedImage(server.clientContentLength(), data, n);
+    if (imageDecoder.error != NULL) rejectImageBody();
+  } else if (raw.status == RAW_ABORTED) {
+    // The panel never saw the half decoded frame, every render redraws it
+    endImage();
+    LOG_WARN("Image upload aborted after %u bytes", (unsigned)raw.totalSize);
+  }
+}
+
+// Handle image upload once the body is in
+void handleImage() {
+  METRIC_TIMER(requestMetric);
+  powerOnRequest();
+  ImageDecoder &d = imageDecoder;
+  if (httpImageRefused || imageOwner != IMAGE_FROM_HTTP) {
+    server.send(503, "text/plain", "display busy");
+    powerOnResponse();
+    return;
+  }
+  if (d.error == NULL && !d.complete()) d.fail(400, "image data incomplete");
+  if (d.error != NULL) {
+    endImage();
+    LOG_WARN("Image rejected: %s", d.error);
+    server.send(d.errorCode, "text/plain", d.error);
+    powerOnResponse();
+    return;
+  }
   
-  // Initialize display
-  display.init(115200, true, 2, false);
-  display.setRotation(1);
-  display.setFont(&FreeMonoBold9pt7b);
-  display.setTextColor(GxEPD_BLACK);
+  uint32_t sequence = showImage(millis());
+  char reply[128];
+  snprintf(reply, sizeof(reply), "{\"width\":%d,\"height\":%d,\"decode_us\":%lu,\"peak_heap\":%u,\"seq\":%u}",
+           d.width, d.height, imageDecodeTime, imageFreeHeapStart - imageFreeHeapLowest, sequence);
+  server.send(200, "application/json", reply);
+  powerOnResponse();
+}
+
+// Serial control: commands in the frames described above SerialType, for
+// bench and provisioning rigs that have no WiFi. Handled in loop() like the
+// web requests; every command gets a reply whose payload starts with a status
+#define SERIAL_DEFAULT_BAUD 115200
+#define SERIAL_RX_BUFFER 2304       // Two full frames
+#define SERIAL_FRAME_TIMEOUT 500    // ms for the rest of a started frame
+#define SERIAL_BAUD_CONFIRM 2000    // ms for a valid frame at a new baud rate before going back
+#define SERIAL_IMAGE_TIMEOUT 3000   // ms between image chunks before the upload is dropped
+enum SerialStatus { SERIAL_OK, SERIAL_BAD_FRAME, SERIAL_BAD_COMMAND, SERIAL_BAD_ARGS, SERIAL_BUSY };
+const uint32_t SERIAL_BAUD_RATES[] = { 115200, 230400, 460800, 921600, 1500000, 2000000 };
+
+uint8_t serialFrame[5 + SERIAL_MAX_PAYLOAD + 4];
+size_t serialFrameLength = 0;    // Bytes of the current frame received
+unsigned long serialLastByte = 0;
+uint32_t serialBaud = SERIAL_DEFAULT_BAUD;
+unsigned long serialBaudChanged = 0;  // Set until a frame arrives at the new rate
+size_t serialImageLength = 0;    // Body length announced by SERIAL_IMAGE_START
+size_t serialImageReceived = 0;
+unsigned long serialImageLast = 0;
+
+void serialReply(uint8_t type, uint8_t seq, uint8_t status, const void* data = NULL, size_t length = 0) {
+  static uint8_t payload[SERIAL_MAX_PAYLOAD];
+  if (length > SERIAL_MAX_PAYLOAD - 1) length = SERIAL_MAX_PAYLOAD - 1;
+  payload[0] = status;
+  if (length > 0) memcpy(payload + 1, data, length);
+  serialSendFrame(type | SERIAL_REPLY, seq, payload, 1 + length);
+}
+
+void serialReplySequence(uint8_t type, uint8_t seq, uint32_t sequence) {
+  serialReply(type, seq, SERIAL_OK, &sequence, sizeof(sequence));
+}
+
+// The image upload failed: report why and let go of the frame
+void serialImageError(uint8_t type, uint8_t seq) {
+  const char* error = imageDecoder.error ? imageDecoder.error : "image data incomplete";
+  LOG_WARN("Serial image rejected: %s", error);
+  serialReply(type, seq, SERIAL_BAD_ARGS, error, strlen(error));
+  endImage();
+}
+
+// Counters as "name value" lines
+size_t formatSerialMetrics(char* out, size_t size) {
+  int n = snprintf(out, size,
+                   "uptime_ms %lu\nheap_free %u\nheap_min_free %u\nrender_requests %u\nrenders %u\n"
+                   "rendered_seq %u\nfont %d\nmessage_bytes %u\nhttp_requests %u\npanel_bytes %u\n"
+                   "panel_busy_ms %u\nsettings_writes %u\nlog_dropped %u\nserial_frames %u\n"
+                   "serial_bad_frames %u\nserial_baud %u\n",
+                   millis(), ESP.getFreeHeap(), ESP.getMinFreeHeap(), renderRequestCount, renderCount,
+                   renderedSequence, fontSize, (unsigned)displayMessage.length(), httpRequests, panelBytesSent,
+                   panelBusyMs, settingsWrites, logDropped.load(), serialFrames, serialBadFrames, serialBaud);
+  return (n < 0) ? 0 : ((size_t)n < size ? n : size - 1);
+}
+
+// Run one command from a valid frame
+void serialCommand(uint8_t type, uint8_t seq, const uint8_t* p, size_t n, unsigned long now) {
+  switch (type) {
+    case SERIAL_HELLO: {
+      uint8_t hello[7] = { 1, (uint8_t)SERIAL_MAX_PAYLOAD, (uint8_t)(SERIAL_MAX_PAYLOAD >> 8), (uint8_t)serialBaud,
+                           (uint8_t)(serialBaud >> 8), (uint8_t)(serialBaud >> 16), (uint8_t)(serialBaud >> 24) };
+      serialReply(type, seq, SERIAL_OK, hello, sizeof(hello));
+      return;
+    }
+    case SERIAL_SET_BAUD: {
+      uint32_t baud = 0;
+      if (n == 4) memcpy(&baud, p, 4);
+      bool supported = false;
+      for (uint32_t rate : SERIAL_BAUD_RATES) supported |= (rate == baud);
+      if (!supported) break;
+      serialReply(type, seq, SERIAL_OK);
+      // The reply goes out at the old rate; no log line may start until the
+      // new rate is set
+      xSemaphoreTake(serialTxMutex, portMAX_DELAY);
+      Serial.flush();
+      Serial.updateBaudRate(baud);
+      xSemaphoreGive(serialTxMutex);
+      serialBaud = baud;
+      serialBaudChanged = now;
+      LOG_INFO("Serial at %u baud", baud);
+      return;
+    }
+    case SERIAL_SET_MESSAGE:
+      if (n < 2) break;
+      serialReplySequence(type, seq, showMessage((const char*)p + 2, n - 2, p[0], p[1] & 1, now));
+      return;
+    case SERIAL_SET_FONT: {
+      if (n != 1 || !isFontSize(p[0])) break;
+      MessageBuffer text = displayMessage;  // showMessage() assigns to displayMessage
+      serialReplySequence(type, seq, showMessage(text.c_str(), text.length(), p[0], false, now));
+      return;
+    }
+    case SERIAL_IMAGE_START: {
+      if (n != 5 || p[0] > IMAGE_RLE) break;
+      uint32_t length;
+      memcpy(&length, p + 1, 4);
+      if (!beginImage(IMAGE_FROM_SERIAL, (ImageFormat)p[0], length)) {
+        serialReply(type, seq, SERIAL_BUSY);
+        return;
+      }
+      if (imageDecoder.error) return serialImageError(type, seq);
+      serialImageLength = length;
+      serialImageReceived = 0;
+      serialImageLast = now;
+      serialReply(type, seq, SERIAL_OK);
+      return;
+    }
+    case SERIAL_IMAGE_DATA:
+      if (imageOwner != IMAGE_FROM_SERIAL) break;
+      serialImageReceived += n;
+      serialImageLast = now;
+      if (serialImageReceived > serialImageLength) imageDecoder.fail(400, "more data than announced");
+      feedImage(serialImageLength, p, n);
+      if (imageDecoder.error) return serialImageError(type, seq);
+      serialReply(type, seq, SERIAL_OK);
+      return;
+    case SERIAL_IMAGE_END:
+      if (imageOwner != IMAGE_FROM_SERIAL) break;
+      if (!imageDecoder.complete()) return serialImageError(type, seq);
+      serialReplySequence(type, seq, showImage(now));
+      return;
+    case SERIAL_READ_METRICS: {
+      static char text[SERIAL_MAX_PAYLOAD - 1];
+      serialReply(type, seq, SERIAL_OK, text, formatSerialMetrics(text, sizeof(text)));
+      return;
+    }
+    default:
+      serialReply(type, seq, SERIAL_BAD_COMMAND);
+      return;
+  }
+  serialReply(type, seq, SERIAL_BAD_ARGS);
+}
+
+// Read what has arrived and run complete frames, never blocks
+// Anything outside a frame (a terminal typing at us) is skipped
+void serialPoll(unsigned long now) {
+  if (serialFrameLength > 0 && now - serialLastByte > SERIAL_FRAME_TIMEOUT) serialFrameLength = 0;
+  if (serialBaudChanged && now - serialBaudChanged > SERIAL_BAUD_CONFIRM) {
+    // The host never got there, go back to where it can reach us
+    serialBaudChanged = 0;
+    serialBaud = SERIAL_DEFAULT_BAUD;
+    xSemaphoreTake(serialTxMutex, portMAX_DELAY);
+    Serial.flush();
+    Serial.updateBaudRate(serialBaud);
+    xSemaphoreGive(serialTxMutex);
+    LOG_WARN("No frame at the new baud rate, back to %u", serialBaud);
+  }
+  if (imageOwner == IMAGE_FROM_SERIAL && now - serialImageLast > SERIAL_IMAGE_TIMEOUT) {
+    LOG_WARN("Serial image upload timed out after %u bytes", (unsigned)serialImageReceived);
+    endImage();
+  }
   
-  // Load saved message and font size from NVS storage
-  preferences.begin("epaper", true); // true = read-only
-  if (preferences.isKey("message")) {
-    displayMessage = preferences.getString("message", "Hello World!");
-    Serial.println("Loaded saved message: " + displayMessage);
+  int available;
+  while ((available = Serial.available()) > 0) {
+    serialLastByte = now;
+    if (serialFrameLength == 0) {
+      if (Serial.read() == SERIAL_SYNC) serialFrame[serialFrameLength++] = SERIAL_SYNC;
+      continue;
+    }
+    size_t payloadLength = serialFrame[3] | (serialFrame[4] << 8);
+    size_t frameLength = (serialFrameLength < 5) ? 5 : 5 + payloadLength + 4;
+    size_t want = frameLength - serialFrameLength;
+    if (want > (size_t)available) want = available;
+    serialFrameLength += Serial.read(serialFrame + serialFrameLength, want);
+    if (serialFrameLength < 5) continue;
+    payloadLength = serialFrame[3] | (serialFrame[4] << 8);
+    if (payloadLength > SERIAL_MAX_PAYLOAD) {
+      serialBadFrames++;
+      serialFrameLength = 0;  // Not a frame after all, hunt for the next sync byte
+      continue;
+    }
+    if (serialFrameLength < 5 + payloadLength + 4) continue;
+    
+    serialFrameLength = 0;
+    uint8_t type = serialFrame[1];
+    uint8_t seq = serialFrame[2];
+    uint32_t crc;
+    memcpy(&crc, serialFrame + 5 + payloadLength, 4);
+    if (crc != crc32_le(0, serialFrame + 1, 4 + payloadLength)) {
+      serialBadFrames++;
+      serialReply(type, seq, SERIAL_BAD_FRAME);
+      continue;
+    }
+    serialFrames++;
+    serialFramed = true;
+    serialBaudChanged = 0;
+    power.onActivity(now);
+    serialCommand(type, seq, serialFrame + 5, payloadLength, now);
   }
-  if (preferences.isKey("fontsize")) {
-    fontSize = preferences.getInt("fontsize", 2);
-    Serial.print("Loaded saved font size: ");
-    Serial.println(fontSize);
+}
+
+// A frame is partly received
+bool serialPending() {
+  return serialFrameLength > 0 || Serial.available() > 0;
+}
+
+// ms until serialPoll() has to give up on something, NO_DEADLINE if nothing
+// is under way; new bytes wake loop() through onSerialReceive()
+unsigned long serialUntilTimeout(unsigned long now) {
+  if (Serial.available() > 0) return 0;
+  unsigned long wait = NO_DEADLINE;
+  if (serialFrameLength > 0) wait = untilTimeout(now, serialLastByte, SERIAL_FRAME_TIMEOUT);
+  if (serialBaudChanged) {
+    unsigned long until = untilTimeout(now, serialBaudChanged, SERIAL_BAUD_CONFIRM);
+    if (until < wait) wait = until;
   }
-  preferences.end();
+  if (imageOwner == IMAGE_FROM_SERIAL) {
+    unsigned long until = untilTimeout(now, serialImageLast, SERIAL_IMAGE_TIMEOUT);
+    if (until < wait) wait = until;
+  }
+  return wait;
+}
+
+// Bytes arrived on the UART (runs on its event task), wake loop()
+void onSerialReceive() {
+  if (mainLoopTask != NULL) xTaskNotifyGive(mainLoopTask);
+}
+
+// Format line i of the boot report, returns false past the last line
+// Stages show the time since the app started and since the previous stage
+bool formatBootLine(int i, char* out, size_t size) {
+  if (i < bootStageCount) {
+    uint32_t previous = (i > 0) ? bootStages[i - 1].time : 0;
+    snprintf(out, size, "%-20s %6lu ms  (+%lu ms)", bootStages[i].name,
+             (unsigned long)bootStages[i].time / 1000, (unsigned long)(bootStages[i].time - previous) / 1000);
+    return true;
+  }
+  const char* names[] = { "display ready", "first panel refresh", "first HTTP 200" };
+  uint32_t times[] = { bootDisplayReady, bootFirstRender, bootFirstResponse };
+  i -= bootStageCount;
+  if (i >= 3) return false;
+  if (times[i] == 0) {
+    snprintf(out, size, "%-20s pending", names[i]);
+  } else {
+    snprintf(out, size, "%-20s %6lu ms", names[i], (unsigned long)times[i] / 1000);
+  }
+  return true;
+}
+
+// Log the boot report once the QR codes are on the panel, and the first
+// HTTP 200 whenever it comes
+void logBootReport() {
+  static bool reportLogged = false;
+  static bool responseLogged = false;
+  char line[64];
+  if (!reportLogged && bootFirstRender != 0) {
+    reportLogged = true;
+    for (int i = 0; formatBootLine(i, line, sizeof(line)); i++) LOG_INFO("Boot: %s", line);
+  }
+  if (!responseLogged && bootFirstResponse != 0) {
+    responseLogged = true;
+    LOG_INFO("Boot: first HTTP 200 after %lu ms", (unsigned long)bootFirstResponse / 1000);
+  }
+}
+
+// Handle boot timing report
+void handleBoot() {
+  METRIC_TIMER(requestMetric);
+  powerOnRequest();
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain", "");
+  ChunkWriter page;
+  char line[64];
+  for (int i = 0; formatBootLine(i, line, sizeof(line)); i++) {
+    page.add(line);
+    page.add("\n");
+  }
+  page.flush();
+  server.sendContent("");
+  powerOnResponse();
+}
+
+// Boot order: the access point and web server come up first, the panel
+// (init and the QR code refresh, several seconds) is left to the render task
+void setup() {
+  Serial.setRxBufferSize(SERIAL_RX_BUFFER);  // Must come before begin()
+  Serial.begin(SERIAL_DEFAULT_BAUD);
+  Serial.onReceive(onSerialReceive);
+  startLogTask();
+  bootStage("serial + log");
   
-  // Record boot time
-  bootTime = millis();
-  showingQRCode = true;
+  // Load saved message and font size from NVS storage
+  setupSettings();
+  bootStage("settings");
   
   // Start WiFi Access Point first
-  Serial.println("Setting up WiFi Access Point...");
+  LOG_INFO("Setting up WiFi Access Point...");
   WiFi.softAP(ssid, password);
   
+  // Station changes wake loop() from its idle wait
+  mainLoopTask = xTaskGetCurrentTaskHandle();
+  WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_AP_STACONNECTED);
+  WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_AP_STADISCONNECTED);
+  
   // Get the IP address that ESP32 assigned itself
   // ESP32 automatically assigns itself 192.168.4.1 when creating an AP
   // This is the default gateway IP for the access point network
   IPAddress IP = WiFi.softAPIP();
-  Serial.print("AP IP address: ");
-  Serial.println(IP);
-  Serial.println("Note: ESP32 assigns itself this IP automatically");
-  
-  // Show QR codes on display (will switch to message after 1 minute)
-  displayQRCode();
-  Serial.print("SSID: ");
-  Serial.println(ssid);
-  Serial.print("Password: ");
-  Serial.println(password);
-  Serial.println("QR codes will display for 1 minute, then switch to saved message");
+  LOG_INFO("AP IP address: %s (assigned automatically)", IP.toString().c_str());
+  bootStage("wifi ap");
   
   // Set up web server routes
   server.on("/", handleRoot);
   server.on("/send", HTTP_POST, handleSend);
+  server.on("/style.css", handleStyle);
+  server.on("/logs", handleLogs);
+  server.on("/screen.pbm", handleScreen);
+  server.on("/playlist", handlePlaylist);
+  server.on("/api/v1/display", HTTP_POST, handleApi, handleApiBody);
+  server.on("/image", HTTP_POST, handleImage, handleImageBody);
+  server.on("/boot", handleBoot);
+#if ENABLE_BENCH
+  server.on("/bench", handleBench);
+#endif
+#if ENABLE_METRICS
+  server.on("/metrics", handleMetrics);
+#endif
+  
+  // Headers needed for cache validation
+  const char* headerKeys[] = { "If-None-Match" };
+  server.collectHeaders(headerKeys, 1);
   
   // Catch-all handler - any other URL will show the message page
   server.onNotFound(handleRoot);
   
   // Start server
   server.begin();
-  Serial.println("Web server started!");
-  Serial.println("Connect to WiFi: " + String(ssid));
-  Serial.println("Then open: http://" + IP.toString());
+  webSocket.begin();
+  webSocket.onEvent(onWebSocketEvent);
+  startNetWatch();
+  bootStage("http server");
+  
+  // Show QR codes on display (will switch to message after 1 minute)
+  bootTime = millis();
+  showingQRCode = true;
+  startRenderTask();
+  requestRender(RENDER_QR_CODES);
+  bootStage("render queued");
+  
+  // Frames for the playlist (may format the filesystem on first boot)
+  setupPlaylistCache();
+  setupFonts(playlistFlashReady);
+  bootStage("playlist cache");
+  
+  LOG_INFO("SSID: %s", ssid);
+  LOG_INFO("Password: %s", password);
+  LOG_INFO("QR codes will display for 1 minute, then switch to saved message");
+  LOG_INFO("Web server started!");
+  LOG_INFO("Connect to WiFi: %s", ssid);
+  LOG_INFO("Then open: http://%s", IP.toString().c_str());
+  LOG_INFO("Boot: setup done after %lu ms, see /boot", (unsigned long)micros() / 1000);
 }
 
 void loop() {
+  loopWakeups++;
   // Handle web server requests
   server.handleClient();
+  serialPoll(millis());
+  webSocket.loop();
+  notifyRendered();
+  logBootReport();
+  
+  unsigned long now = millis();
+  
+  // A station joined or left: stay responsive for the page load that follows
+  if (stationEvent) {
+    stationEvent = false;
+    LOG_DEBUG("WiFi AP Status: %d connected", WiFi.softAPgetStationNum());
+    power.onActivity(now);
+  }
   
   // Check if 1 minute has passed since boot and switch from QR codes to message
-  if (showingQRCode && (millis() - bootTime >= QR_DISPLAY_DURATION)) {
-    Serial.println("1 minute elapsed, switching to saved message...");
+  if (showingQRCode && (now - bootTime >= QR_DISPLAY_DURATION)) {
+    LOG_INFO("1 minute elapsed, switching to saved message...");
     showingQRCode = false;
-    updateDisplay(displayMessage);
+    if (playlistRunning && playlistLength > 0) {
+      showPlaylistPosition(now);
+    } else {
+      requestRender(RENDER_MESSAGE);
+      power.onRender(now);
+    }
   }
+  unsigned long untilRotation = rotatePlaylistIfDue(now);
   
-  // Debug: Print connection status every 10 seconds
-  static unsigned long lastDebug = 0;
-  if (millis() - lastDebug > 10000) {
-    lastDebug = millis();
-    unsigned long elapsed = millis() - bootTime;
-    Serial.println("WiFi AP Status: " + String(WiFi.softAPgetStationNum()) + " connected");
-    Serial.println("Server running on: http://" + WiFi.softAPIP().toString());
-    if (showingQRCode) {
-      Serial.print("Time until message display: ");
-      Serial.print((QR_DISPLAY_DURATION - elapsed) / 1000);
-      Serial.println(" seconds");
-    }
+  // Settle into a lower power state once traffic stops
+  // Merged requests are never rendered on their own, so compare sequences, not counts
+  power.update(now, WiFi.softAPgetStationNum(), renderedSequence != renderRequestCount);
+  applyPowerState();
+  unsigned long untilFlush = flushSettingsIfDue(now);
+  if (power.shouldHibernate(now)) {
+    flushSettings();  // Nothing left pending while we are asleep
+    requestRender(RENDER_HIBERNATE);
   }
   
-  delay(10);
+  // Sleep until a socket, the render task, a station or the UART wakes us,
+  // or until the next deadline: the QR timeout, a settings flush, the
+  // playlist, the power policy, a web server or serial timeout
+  unsigned long wait = power.untilChange(now);
+  if (showingQRCode) {
+    unsigned long untilMessage = QR_DISPLAY_DURATION - (now - bootTime);
+    if (untilMessage < wait) wait = untilMessage;
+  }
+  if (untilFlush < wait) wait = untilFlush;
+  if (untilRotation < wait) wait = untilRotation;
+  unsigned long untilServer = armNetWatch(now);
+  if (untilServer < wait) wait = untilServer;
+  unsigned long untilSerial = serialUntilTimeout(now);
+  if (untilSerial < wait) wait = untilSerial;
+  // Ticks from ms without pdMS_TO_TICKS(), which overflows past 71 minutes
+  TickType_t ticks = (wait / portTICK_PERIOD_MS < portMAX_DELAY) ? wait / portTICK_PERIOD_MS : portMAX_DELAY - 1;
+  ulTaskNotifyTake(pdTRUE, (wait == NO_DEADLINE) ? portMAX_DELAY : ticks);
 }
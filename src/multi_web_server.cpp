@@ -0,0 +1,609 @@
+#include "multi_web_server.h"
+#include "log.h"
+
+uint32_t httpConnections = 0;     // Accepted
+uint32_t httpRequests = 0;        // Handled
+uint32_t httpReusedRequests = 0;  // Handled on a kept-alive connection
+uint32_t httpRejected = 0;        // Answered with an error by the server itself
+
+void MultiWebServer::begin() {
+  listener.begin();
+  listener.setNoDelay(true);
+}
+
+void MultiWebServer::collectHeaders(const char* keys[], size_t count) {
+  headerCount = (count < HTTP_MAX_HEADERS) ? count : HTTP_MAX_HEADERS;
+  for (size_t i = 0; i < headerCount; i++) headerKeys[i] = keys[i];
+}
+
+void MultiWebServer::handleClient() {
+  acceptClients();
+  for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+    HttpConnection &c = connections[(nextSlot + i) % HTTP_MAX_CLIENTS];
+    if (c.state != HTTP_FREE) service(c);
+  }
+  nextSlot = (nextSlot + 1) % HTTP_MAX_CLIENTS;
+}
+
+bool MultiWebServer::pending() const {
+  for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+    const HttpConnection &c = connections[i];
+    if (c.state == HTTP_READ_BODY || c.state == HTTP_READ_RAW || (c.state == HTTP_READ_HEAD && c.length > 0) ||
+        c.queueSent < c.queueLength) {
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned long MultiWebServer::waitSet(unsigned long now, NetWaitSet &set) {
+  if (canAccept(now) && listener.hasClient()) return 0;  // Taken off the backlog already
+  unsigned long wait = NO_DEADLINE;
+  for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+    HttpConnection &c = connections[i];
+    if (c.state == HTTP_FREE) continue;
+    if (c.queueSent < c.queueLength) {
+      set.add(c.client.fd(), set.writable);
+      unsigned long until = untilTimeout(now, c.lastActivity, HTTP_REQUEST_TIMEOUT);
+      if (until < wait) wait = until;
+      continue;
+    }
+    if (c.state == HTTP_READ_RAW && !c.rawStarted && rawOwner != NULL && rawOwner != &c) continue;
+    // A pipelined request, or bytes the client already took off the socket
+    if ((c.state == HTTP_READ_HEAD && c.scanned < c.length) || c.client.available() > 0) return 0;
+    set.add(c.client.fd(), set.readable);
+    bool idle = c.state == HTTP_READ_HEAD && c.length == 0;
+    unsigned long timeout = idle ? HTTP_IDLE_TIMEOUT : HTTP_REQUEST_TIMEOUT;
+    if (idle && !canAccept(now)) timeout = HTTP_EVICT_IDLE;  // Could make room for the backlog
+    unsigned long until = untilTimeout(now, c.lastActivity, timeout);
+    if (until < wait) wait = until;
+  }
+  return wait;
+}
+
+bool MultiWebServer::canAccept(unsigned long now) const {
+  for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+    const HttpConnection &c = connections[i];
+    if (c.state == HTTP_FREE || evictable(c, now)) return true;
+  }
+  return false;
+}
+
+int MultiWebServer::activeConnections() const {
+  int count = 0;
+  for (int i = 0; i < HTTP_MAX_CLIENTS; i++) count += connections[i].state != HTTP_FREE;
+  return count;
+}
+
+const char* MultiWebServer::arg(const char* name) const {
+  const char* value = findArg(name);
+  return value ? value : "";
+}
+
+const char* MultiWebServer::header(const char* name) const {
+  for (size_t i = 0; i < headerCount; i++) {
+    if (strcasecmp(headerKeys[i], name) == 0 && current->headers[i]) return current->headers[i];
+  }
+  return "";
+}
+
+void MultiWebServer::rejectRaw(int code, const char* message) {
+  rawRejectCode = code;
+  rawRejectMessage = message;
+}
+
+void MultiWebServer::sendHeader(const char* name, const char* value) {
+  size_t space = sizeof(responseHeaders) - responseHeadersLength;
+  int n = snprintf(responseHeaders + responseHeadersLength, space, "%s: %s\r\n", name, value);
+  if (n > 0 && (size_t)n < space) responseHeadersLength += n;
+}
+
+void MultiWebServer::sendContent(const char* content, size_t length) {
+  if (!headSent || chunkedDone || headOnly) return;
+  if (chunked) {
+    char size[12];
+    if (length == 0) {
+      write("0\r\n\r\n", 5);
+      chunkedDone = true;
+      return;
+    }
+    write(size, snprintf(size, sizeof(size), "%x\r\n", (unsigned)length));
+    write(content, length);
+    write("\r\n", 2);
+  } else if (length > 0) {
+    write(content, length);
+  }
+}
+
+void MultiWebServer::addRoute(const char* uri, HTTPMethod method, bool anyMethod, HttpHandler handler,
+                              HttpHandler rawHandler) {
+  if (routeCount == HTTP_MAX_ROUTES) {
+    LOG_ERROR("HTTP route table full, %s not added", uri);
+    return;
+  }
+  HttpRoute route = { uri, method, anyMethod, handler, rawHandler };
+  routes[routeCount++] = route;
+}
+
+const HttpRoute* MultiWebServer::findRoute(const HttpConnection &c) const {
+  for (int i = 0; i < routeCount; i++) {
+    const HttpRoute &r = routes[i];
+    if (strcmp(r.uri, c.uri) == 0 && (r.anyMethod || r.method == HTTP_ANY || r.method == c.method)) return &r;
+  }
+  return NULL;
+}
+
+const char* MultiWebServer::findArg(const char* name) const {
+  for (int i = 0; i < current->argCount; i++) {
+    if (strcmp(current->args[i].name, name) == 0) return current->args[i].value;
+  }
+  return NULL;
+}
+
+void MultiWebServer::acceptClients() {
+  while (listener.hasClient()) {
+    unsigned long now = millis();
+    HttpConnection* slot = NULL;
+    HttpConnection* idlest = NULL;
+    for (int i = 0; i < HTTP_MAX_CLIENTS && slot == NULL; i++) {
+      HttpConnection &c = connections[i];
+      if (c.state == HTTP_FREE) {
+        slot = &c;
+      } else if (evictable(c, now) && (idlest == NULL || c.lastActivity < idlest->lastActivity)) {
+        idlest = &c;
+      }
+    }
+    if (slot == NULL && idlest != NULL) {
+      close(*idlest);
+      slot = idlest;
+    }
+    if (slot == NULL) return;
+    slot->client = listener.available();
+    if (!slot->client) return;
+    slot->client.setNoDelay(true);
+    slot->state = HTTP_READ_HEAD;
+    slot->requests = 0;
+    slot->length = 0;
+    slot->scanned = 0;
+    slot->lastActivity = now;
+    httpConnections++;
+  }
+}
+
+void MultiWebServer::close(HttpConnection &c) {
+  c.client.stop();
+  freeQueue(c);
+  c.state = HTTP_FREE;
+}
+
+void MultiWebServer::closeWhenSent(HttpConnection &c) {
+  if (c.queueLength == 0) return close(c);
+  c.state = HTTP_CLOSING;
+}
+
+void MultiWebServer::freeQueue(HttpConnection &c) {
+  free(c.queue);
+  queued -= c.queueSize;
+  c.queue = NULL;
+  c.queueSize = 0;
+  c.queueLength = 0;
+  c.queueSent = 0;
+}
+
+int MultiWebServer::sendSome(HttpConnection &c, const char* data, size_t length) {
+  int sent = lwip_send(c.client.fd(), data, length, MSG_DONTWAIT);
+  if (sent < 0) return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : -1;
+  return sent;
+}
+
+bool MultiWebServer::sendQueued(HttpConnection &c, unsigned long now) {
+  if (c.queueLength == 0) return true;
+  int sent = sendSome(c, c.queue + c.queueSent, c.queueLength - c.queueSent);
+  if (sent > 0) {
+    c.queueSent += sent;
+    c.lastActivity = now;
+  }
+  if (sent < 0 || (sent == 0 && now - c.lastActivity > HTTP_REQUEST_TIMEOUT)) {
+    close(c);
+    return false;
+  }
+  if (c.queueSent < c.queueLength) return false;
+  freeQueue(c);
+  return true;
+}
+
+bool MultiWebServer::enqueue(HttpConnection &c, const char* data, size_t length) {
+  size_t needed = c.queueLength + length;
+  if (needed > c.queueSize) {
+    size_t size = c.queueSize ? c.queueSize : HTTP_QUEUE_MIN;
+    while (size < needed) size *= 2;
+    if (queued - c.queueSize + size > HTTP_MAX_QUEUED) return false;
+    char* grown = (char*)realloc(c.queue, size);
+    if (grown == NULL) return false;
+    queued += size - c.queueSize;
+    c.queue = grown;
+    c.queueSize = size;
+  }
+  memcpy(c.queue + c.queueLength, data, length);
+  c.queueLength = needed;
+  return true;
+}
+
+void MultiWebServer::readAvailable(HttpConnection &c, size_t limit) {
+  int available = c.client.available();
+  if (available <= 0 || c.length >= limit) return;
+  size_t n = (size_t)available < limit - c.length ? (size_t)available : limit - c.length;
+  int got = c.client.read((uint8_t*)c.buffer + c.length, n);
+  if (got > 0) {
+    c.length += got;
+    c.lastActivity = millis();
+  }
+}
+
+void MultiWebServer::service(HttpConnection &c) {
+  unsigned long now = millis();
+  // The next request waits until the last response is out
+  if (!sendQueued(c, now)) return;
+  if (c.state == HTTP_CLOSING) return close(c);
+  if (c.state == HTTP_READ_RAW) {
+    serviceRaw(c, now);
+    return;
+  }
+  size_t before = c.length;
+  if (c.state == HTTP_READ_HEAD) {
+    readAvailable(c, HTTP_MAX_REQUEST);
+    // Look for the blank line from where the last read could have split it
+    size_t from = (c.scanned > 3) ? c.scanned - 3 : 0;
+    const char* end = NULL;
+    for (size_t i = from; i + 3 < c.length && end == NULL; i++) {
+      if (memcmp(c.buffer + i, "\r\n\r\n", 4) == 0) end = c.buffer + i + 4;
+    }
+    c.scanned = c.length;
+    if (end != NULL) {
+      c.headLength = end - c.buffer;
+      startRequest(c);
+      return;
+    }
+    if (c.length == HTTP_MAX_REQUEST) return reject(c, 431, "Request Header Fields Too Large");
+  } else {
+    readAvailable(c, c.headLength + c.contentLength);
+    if (c.length >= c.headLength + c.contentLength) {
+      char* body = c.buffer + c.headLength;
+      char saved = body[c.contentLength];  // Possibly the start of a pipelined request
+      body[c.contentLength] = '\0';
+      if (c.contentType && strncasecmp(c.contentType, "application/x-www-form-urlencoded", 33) == 0) {
+        parseArgs(c, body);
+      } else if (c.argCount < HTTP_MAX_ARGS) {
+        HttpArg plain = { "plain", body };
+        c.args[c.argCount++] = plain;
+      }
+      dispatch(c);
+      body[c.contentLength] = saved;
+      finishRequest(c, c.headLength + c.contentLength);
+      return;
+    }
+  }
+  if (c.length == before) {
+    // Nothing new: closed by the client or timed out
+    unsigned long timeout = (c.state == HTTP_READ_HEAD && c.length == 0) ? HTTP_IDLE_TIMEOUT : HTTP_REQUEST_TIMEOUT;
+    if (!c.client.connected() || now - c.lastActivity > timeout) close(c);
+  }
+}
+
+void MultiWebServer::startRequest(HttpConnection &c) {
+  if (!parseHead(c)) return reject(c, 400, "Bad Request");
+  // Give up the slot after this request when others are waiting for one
+  if (c.requests + 1 >= HTTP_MAX_KEEPALIVE || (activeConnections() == HTTP_MAX_CLIENTS && listener.hasClient())) {
+    c.keepAlive = false;
+  }
+  c.route = findRoute(c);
+  if (c.route && c.route->rawHandler) {
+    // Raw handlers see start and end even without a body, like with WebServer
+    c.state = HTTP_READ_RAW;
+    c.rawStarted = false;
+    serviceRaw(c, millis());
+  } else if (c.contentLength == 0) {
+    dispatch(c);
+    finishRequest(c, c.headLength);
+  } else if (c.contentLength > HTTP_MAX_REQUEST - c.headLength) {
+    reject(c, 413, "Payload Too Large");
+  } else {
+    c.state = HTTP_READ_BODY;
+    service(c);
+  }
+}
+
+bool MultiWebServer::parseHead(HttpConnection &c) {
+  c.buffer[c.headLength - 2] = '\0';
+  c.argCount = 0;
+  c.contentLength = 0;
+  c.contentType = NULL;
+  for (size_t i = 0; i < HTTP_MAX_HEADERS; i++) c.headers[i] = NULL;
+  
+  char* line = c.buffer;
+  char* next = strstr(line, "\r\n");
+  if (next) *next = '\0';
+  char* uri = strchr(line, ' ');
+  if (uri == NULL) return false;
+  *uri++ = '\0';
+  char* version = strchr(uri, ' ');
+  if (version == NULL) return false;
+  *version++ = '\0';
+  static const struct { const char* name; HTTPMethod method; } METHODS[] = {
+    { "GET", HTTP_GET }, { "POST", HTTP_POST }, { "HEAD", HTTP_HEAD }, { "PUT", HTTP_PUT },
+    { "DELETE", HTTP_DELETE }, { "OPTIONS", HTTP_OPTIONS }, { "PATCH", HTTP_PATCH } };
+  size_t m = 0;
+  while (m < sizeof(METHODS) / sizeof(METHODS[0]) && strcmp(METHODS[m].name, line) != 0) m++;
+  if (m == sizeof(METHODS) / sizeof(METHODS[0])) return false;
+  c.method = METHODS[m].method;
+  c.http11 = strcmp(version, "HTTP/1.1") == 0;
+  c.keepAlive = c.http11;
+  
+  while (next) {
+    line = next + 2;
+    next = strstr(line, "\r\n");
+    if (next) *next = '\0';
+    char* value = strchr(line, ':');
+    if (value == NULL) continue;
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') value++;
+    if (strcasecmp(line, "Content-Length") == 0) {
+      if (!parseLength(value, c.contentLength)) return false;
+    } else if (strcasecmp(line, "Content-Type") == 0) {
+      c.contentType = value;
+    } else if (strcasecmp(line, "Connection") == 0) {
+      if (strcasecmp(value, "close") == 0) c.keepAlive = false;
+      if (strcasecmp(value, "keep-alive") == 0) c.keepAlive = true;
+    } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+      return false;  // Chunked request bodies are not supported
+    }
+    for (size_t i = 0; i < headerCount; i++) {
+      if (strcasecmp(line, headerKeys[i]) == 0) c.headers[i] = value;
+    }
+  }
+  
+  char* query = strchr(uri, '?');
+  if (query) {
+    *query++ = '\0';
+    parseArgs(c, query);
+  }
+  c.uri = uri;
+  return true;
+}
+
+bool MultiWebServer::parseLength(const char* text, size_t &length) {
+  const size_t limit = (size_t)-1 - HTTP_MAX_REQUEST;
+  size_t value = 0;
+  const char* p = text;
+  for (; *p >= '0' && *p <= '9'; p++) {
+    size_t digit = *p - '0';
+    if (value > (limit - digit) / 10) return false;
+    value = value * 10 + digit;
+  }
+  while (*p == ' ' || *p == '\t') p++;
+  if (p == text || *p != '\0') return false;
+  length = value;
+  return true;
+}
+
+void MultiWebServer::parseArgs(HttpConnection &c, char* text) {
+  while (*text && c.argCount < HTTP_MAX_ARGS) {
+    char* end = strchr(text, '&');
+    if (end) *end = '\0';
+    char* value = strchr(text, '=');
+    if (value) *value++ = '\0';
+    HttpArg arg = { urlDecode(text), value ? urlDecode(value) : "" };
+    c.args[c.argCount++] = arg;
+    if (end == NULL) break;
+    text = end + 1;
+  }
+}
+
+int MultiWebServer::hexValue(char h) {
+  if (h >= '0' && h <= '9') return h - '0';
+  if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+  if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+  return -1;
+}
+
+const char* MultiWebServer::urlDecode(char* text) {
+  char* out = text;
+  for (const char* in = text; *in; in++) {
+    if (*in == '+') {
+      *out++ = ' ';
+    } else if (*in == '%' && hexValue(in[1]) >= 0 && hexValue(in[2]) >= 0) {
+      *out++ = (char)(hexValue(in[1]) << 4 | hexValue(in[2]));
+      in += 2;
+    } else {
+      *out++ = *in;
+    }
+  }
+  *out = '\0';
+  return text;
+}
+
+void MultiWebServer::serviceRaw(HttpConnection &c, unsigned long now) {
+  if (!c.rawStarted) {
+    if (rawOwner != NULL && rawOwner != &c) return;  // The rest waits in the socket
+    rawOwner = &c;
+    c.rawStarted = true;
+    c.bodyRead = 0;
+    c.lastActivity = now;
+    current = &c;
+    rawBody.status = RAW_START;
+    rawBody.totalSize = 0;
+    rawBody.currentSize = 0;
+    rawRejectCode = 0;
+    c.route->rawHandler();
+    if (rawRejected(c)) return;
+    // Body bytes that came in with the head
+    size_t buffered = c.length - c.headLength;
+    if (buffered > c.contentLength) buffered = c.contentLength;
+    while (c.bodyRead < buffered) {
+      size_t n = buffered - c.bodyRead;
+      if (n > HTTP_RAW_BUFLEN) n = HTTP_RAW_BUFLEN;
+      memcpy(rawBody.buf, c.buffer + c.headLength + c.bodyRead, n);
+      rawWrite(c, n);
+      if (rawRejected(c)) return;
+    }
+  }
+  if (c.bodyRead < c.contentLength) {
+    int available = c.client.available();
+    if (available > 0) {
+      size_t n = c.contentLength - c.bodyRead;
+      if (n > (size_t)available) n = available;
+      if (n > HTTP_RAW_BUFLEN) n = HTTP_RAW_BUFLEN;
+      int got = c.client.read(rawBody.buf, n);
+      if (got > 0) {
+        c.lastActivity = now;
+        rawWrite(c, got);
+        if (rawRejected(c)) return;
+      }
+    } else if (!c.client.connected() || now - c.lastActivity > HTTP_REQUEST_TIMEOUT) {
+      current = &c;
+      rawBody.status = RAW_ABORTED;
+      rawBody.currentSize = 0;
+      c.route->rawHandler();
+      rawOwner = NULL;
+      close(c);
+      return;
+    }
+    if (c.bodyRead < c.contentLength) return;
+  }
+  current = &c;
+  rawBody.status = RAW_END;
+  rawBody.currentSize = 0;
+  c.route->rawHandler();
+  rawOwner = NULL;
+  dispatch(c);
+  // Bytes past the body that came in with the head belong to the next request
+  size_t used = c.headLength + c.contentLength;
+  finishRequest(c, (c.length > used) ? used : c.length);
+}
+
+bool MultiWebServer::rawRejected(HttpConnection &c) {
+  if (rawRejectCode == 0) return false;
+  rawOwner = NULL;
+  reject(c, rawRejectCode, rawRejectMessage);
+  return true;
+}
+
+void MultiWebServer::rawWrite(HttpConnection &c, size_t n) {
+  current = &c;
+  c.bodyRead += n;
+  rawBody.status = RAW_WRITE;
+  rawBody.currentSize = n;
+  rawBody.totalSize += n;
+  c.route->rawHandler();
+}
+
+void MultiWebServer::startResponse(HttpConnection &c) {
+  current = &c;
+  headSent = false;
+  headOnly = c.method == HTTP_HEAD;
+  c.queueFull = false;
+  chunked = false;
+  chunkedDone = false;
+  responseLength = HTTP_LENGTH_NOT_SET;
+  responseHeadersLength = 0;
+}
+
+void MultiWebServer::dispatch(HttpConnection &c) {
+  startResponse(c);
+  if (c.route) {
+    c.route->handler();
+  } else if (notFound) {
+    notFound();
+  } else {
+    send(404, "text/plain", "Not Found");
+  }
+  if (!headSent) send(500, "text/plain", "No response");
+  if (chunked && !chunkedDone) sendContent("", 0);
+  httpRequests++;
+  if (c.requests > 0) httpReusedRequests++;
+}
+
+void MultiWebServer::finishRequest(HttpConnection &c, size_t used) {
+  current = NULL;
+  c.requests++;
+  if (!c.keepAlive || !c.client.connected()) {
+    closeWhenSent(c);
+    return;
+  }
+  // Keep a pipelined request that already arrived
+  c.length -= used;
+  memmove(c.buffer, c.buffer + used, c.length);
+  c.scanned = 0;
+  c.state = HTTP_READ_HEAD;
+  c.lastActivity = millis();
+}
+
+void MultiWebServer::reject(HttpConnection &c, int code, const char* message) {
+  startResponse(c);
+  c.keepAlive = false;
+  send(code, "text/plain", message);
+  httpRejected++;
+  LOG_WARN("HTTP %d: %s", code, message);
+  current = NULL;
+  closeWhenSent(c);
+}
+
+const char* MultiWebServer::statusText(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+  }
+  return "";
+}
+
+void MultiWebServer::sendResponse(int code, const char* contentType, const char* content, size_t length) {
+  if (headSent) return;
+  headSent = true;
+  size_t declared = (responseLength != HTTP_LENGTH_NOT_SET) ? responseLength : length;
+  char head[160 + HTTP_RESPONSE_HEADERS];
+  int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n", code, statusText(code));
+  if (contentType) n += snprintf(head + n, sizeof(head) - n, "Content-Type: %s\r\n", contentType);
+  // 1xx, 204 and 304 have no body, and no Content-Length that could contradict
+  // the one of the full response
+  if (code < 200 || code == 204 || code == 304) {
+    headOnly = true;
+  } else if (declared == CONTENT_LENGTH_UNKNOWN) {
+    // HTTP/1.0 clients get the end of the body from the connection closing
+    chunked = current->http11;
+    if (chunked) n += snprintf(head + n, sizeof(head) - n, "Transfer-Encoding: chunked\r\n");
+    else current->keepAlive = false;
+  } else {
+    n += snprintf(head + n, sizeof(head) - n, "Content-Length: %u\r\n", (unsigned)declared);
+  }
+  n += snprintf(head + n, sizeof(head) - n, "Connection: %s\r\n%.*s\r\n",
+                current->keepAlive ? "keep-alive" : "close", (int)responseHeadersLength, responseHeaders);
+  write(head, n);
+  if (length > 0) sendContent(content, length);
+}
+
+void MultiWebServer::write(const char* data, size_t length) {
+  HttpConnection &c = *current;
+  if (c.queueFull) return;
+  if (c.queueLength == 0) {
+    int sent = sendSome(c, data, length);
+    if (sent < 0) {
+      c.keepAlive = false;
+      c.queueFull = true;
+      return;
+    }
+    data += sent;
+    length -= sent;
+  }
+  if (length == 0 || enqueue(c, data, length)) return;
+  LOG_WARN("HTTP response cut short, %u bytes queued", (unsigned)c.queueLength);
+  c.keepAlive = false;
+  c.queueFull = true;
+}
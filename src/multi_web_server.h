@@ -0,0 +1,282 @@
+// Web server on port 80 (see MultiWebServer), shared by the firmware and the
+// host tests
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+// Request types (HTTPMethod, HTTPRaw) shared with the Arduino WebServer API
+#include <WebServer.h>
+#include <lwip/sockets.h>
+#include <limits.h>
+
+// Web server on port 80: serves several connections at once from loop()
+// without blocking on any of them. Each connection reads into a fixed buffer
+// (request head plus form body), requests are handled once complete and
+// connections are kept alive. Handlers use the same calls as the Arduino
+// WebServer (arg, send, sendContent, raw, ...), so the routes did not change,
+// except that arg(), header() and uri() point into the request buffer
+// Responses never wait for a slow client: what the socket does not take right
+// away is queued on the heap and sent as the client reads it
+// Raw bodies (API, image uploads) stream to the raw handler chunk by chunk,
+// one upload at a time since those handlers keep their state in globals
+#define HTTP_MAX_CLIENTS 6          // lwIP has 10 sockets, the WebSocket server needs some
+#define HTTP_MAX_REQUEST 4096       // Head plus form body: a full form message of two-byte
+                                    // letters is 3 KB URL-encoded
+#define HTTP_MAX_ROUTES 16
+#define HTTP_MAX_ARGS 8
+#define HTTP_MAX_HEADERS 4          // Collected request headers
+#define HTTP_RESPONSE_HEADERS 256   // Extra response headers from sendHeader()
+#define HTTP_IDLE_TIMEOUT 5000      // ms a kept-alive connection waits for its next request
+#define HTTP_EVICT_IDLE 500         // ms idle before it gives its slot to a waiting connection
+#define HTTP_REQUEST_TIMEOUT 3000   // ms without progress on a started request
+#define HTTP_MAX_KEEPALIVE 100      // Requests per connection
+#define HTTP_QUEUE_MIN 1024         // First allocation for a connection's queued response
+#define HTTP_MAX_QUEUED 32768       // Queued response bytes of all connections together
+#define HTTP_LENGTH_NOT_SET ((size_t)-2)
+
+typedef void (*HttpHandler)();
+
+// Sockets loop() sleeps on (see armNetWatch()) and the wait for a deadline
+const unsigned long NO_DEADLINE = ULONG_MAX;
+struct NetWaitSet {
+  fd_set readable;
+  fd_set writable;
+  int maxFd;
+  
+  void clear() {
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    maxFd = -1;
+  }
+  void add(int fd, fd_set &set) {
+    FD_SET(fd, &set);
+    if (fd > maxFd) maxFd = fd;
+  }
+};
+
+// ms from now until more than timeout ms have passed since since
+inline unsigned long untilTimeout(unsigned long now, unsigned long since, unsigned long timeout) {
+  unsigned long elapsed = now - since;
+  return (elapsed > timeout) ? 0 : timeout - elapsed + 1;
+}
+
+struct HttpRoute {
+  const char* uri;
+  HTTPMethod method;
+  bool anyMethod;
+  HttpHandler handler;
+  HttpHandler rawHandler;  // Gets the body in chunks instead of as form arguments
+};
+
+struct HttpArg {
+  const char* name;
+  const char* value;
+};
+
+// HTTP_CLOSING: the last response is still being sent, then the connection closes
+enum HttpState { HTTP_FREE, HTTP_READ_HEAD, HTTP_READ_BODY, HTTP_READ_RAW, HTTP_CLOSING };
+
+struct HttpConnection {
+  WiFiClient client;
+  HttpState state;
+  unsigned long lastActivity;
+  uint16_t requests;         // Served on this connection
+  size_t length;             // Bytes in buffer
+  size_t scanned;            // Bytes already searched for the end of the head
+  size_t headLength;         // Head including the blank line, once complete
+  size_t contentLength;
+  size_t bodyRead;           // Raw body bytes passed on
+  bool rawStarted;
+  bool http11;
+  bool keepAlive;
+  HTTPMethod method;
+  const char* uri;
+  const char* contentType;
+  const HttpRoute* route;
+  HttpArg args[HTTP_MAX_ARGS];
+  int argCount;
+  const char* headers[HTTP_MAX_HEADERS];
+  char buffer[HTTP_MAX_REQUEST + 1];
+  char* queue;               // Response bytes the socket did not take yet
+  size_t queueSize;          // Allocated
+  size_t queueLength;
+  size_t queueSent;
+  bool queueFull;            // The response did not fit, the rest of it is dropped
+};
+
+// Counters for /metrics
+extern uint32_t httpConnections;     // Accepted
+extern uint32_t httpRequests;        // Handled
+extern uint32_t httpReusedRequests;  // Handled on a kept-alive connection
+extern uint32_t httpRejected;        // Answered with an error by the server itself
+
+class MultiWebServer {
+public:
+  explicit MultiWebServer(uint16_t port) : listener(port), listenPort(port) {}
+  
+  void begin();
+  
+  void on(const char* uri, HttpHandler handler) { addRoute(uri, HTTP_GET, true, handler, NULL); }
+  void on(const char* uri, HTTPMethod method, HttpHandler handler, HttpHandler rawHandler = NULL) {
+    addRoute(uri, method, false, handler, rawHandler);
+  }
+  void onNotFound(HttpHandler handler) { notFound = handler; }
+  
+  // Only these request headers are kept, the keys must stay valid
+  void collectHeaders(const char* keys[], size_t count);
+  
+  // Accept new connections and move every open one along, handling at most
+  // one request per connection and call
+  void handleClient();
+  
+  // A request is partly received or a response is still going out
+  bool pending() const;
+  
+  // What handleClient() waits for: adds the sockets whose input or output
+  // would move a connection along to set, returns the ms until the next
+  // connection times out, 0 when there is work without waiting, NO_DEADLINE
+  // with nothing open. Sockets it would leave alone (input behind a queued
+  // response or the raw body lock) are not added, they would wake loop()
+  // over and over. The listener is not in here (see armNetWatch())
+  unsigned long waitSet(unsigned long now, NetWaitSet &set);
+  
+  // A new connection would get a slot now
+  bool canAccept(unsigned long now) const;
+  
+  uint16_t port() const { return listenPort; }
+  
+  int activeConnections() const;
+  
+  // Request being handled, valid until the handler returns; missing
+  // arguments and headers are ""
+  bool hasArg(const char* name) const { return findArg(name) != NULL; }
+  const char* arg(const char* name) const;
+  const char* header(const char* name) const;
+  HTTPMethod method() const { return current->method; }
+  const char* uri() const { return current->uri; }
+  WiFiClient &client() { return current->client; }
+  size_t clientContentLength() const { return current->contentLength; }
+  HTTPRaw &raw() { return rawBody; }
+  // From a raw handler: answer with this error once the handler returns and
+  // close the connection, without reading the rest of the body
+  void rejectRaw(int code, const char* message);
+  
+  // Response, same order of calls as with WebServer
+  void sendHeader(const char* name, const char* value);
+  void setContentLength(size_t length) { responseLength = length; }
+  void send(int code, const char* contentType = NULL, const char* content = "") {
+    sendResponse(code, contentType, content, strlen(content));
+  }
+  void send(int code, const char* contentType, const String &content) {
+    sendResponse(code, contentType, content.c_str(), content.length());
+  }
+  void send_P(int code, const char* contentType, PGM_P content) {
+    sendResponse(code, contentType, content, strlen_P(content));
+  }
+  void send_P(int code, const char* contentType, PGM_P content, size_t length) {
+    sendResponse(code, contentType, content, length);
+  }
+  void sendContent(const String &content) { sendContent(content.c_str(), content.length()); }
+  void sendContent(const char* content) { sendContent(content, strlen(content)); }
+  void sendContent(const char* content, size_t length);
+  
+private:
+  WiFiServer listener;
+  uint16_t listenPort;
+  HttpConnection connections[HTTP_MAX_CLIENTS];
+  int nextSlot = 0;
+  HttpRoute routes[HTTP_MAX_ROUTES];
+  int routeCount = 0;
+  HttpHandler notFound = NULL;
+  const char* headerKeys[HTTP_MAX_HEADERS];
+  size_t headerCount = 0;
+  size_t queued = 0;  // Allocated for queued responses
+  
+  // Request being handled and its response
+  HttpConnection* current = NULL;
+  HttpConnection* rawOwner = NULL;
+  HTTPRaw rawBody;
+  int rawRejectCode = 0;
+  const char* rawRejectMessage = NULL;
+  bool headSent;
+  bool headOnly;  // HEAD request: the head of the GET response without its body
+  bool chunked;
+  bool chunkedDone;
+  size_t responseLength;
+  char responseHeaders[HTTP_RESPONSE_HEADERS];
+  size_t responseHeadersLength;
+  
+  void addRoute(const char* uri, HTTPMethod method, bool anyMethod, HttpHandler handler, HttpHandler rawHandler);
+  const HttpRoute* findRoute(const HttpConnection &c) const;
+  const char* findArg(const char* name) const;
+  
+  // Take new connections while there are free slots; with all slots busy a
+  // connection idling between requests makes room, otherwise the new one
+  // waits in the listen backlog
+  void acceptClients();
+  
+  // Idle between requests long enough to give its slot to a new connection
+  static bool evictable(const HttpConnection &c, unsigned long now) {
+    return c.state == HTTP_READ_HEAD && c.length == 0 && c.queueLength == 0 && now - c.lastActivity > HTTP_EVICT_IDLE;
+  }
+  
+  void close(HttpConnection &c);
+  
+  // Close once the response is sent
+  void closeWhenSent(HttpConnection &c);
+  
+  void freeQueue(HttpConnection &c);
+  
+  // Give the socket what it takes without waiting, returns the bytes sent or
+  // -1 when the connection is gone
+  static int sendSome(HttpConnection &c, const char* data, size_t length);
+  
+  // Move the queued response along; true once it is all sent. Closes the
+  // connection when the client went away or stopped reading
+  bool sendQueued(HttpConnection &c, unsigned long now);
+  
+  // Keep bytes the socket did not take, false if the queue cannot grow
+  bool enqueue(HttpConnection &c, const char* data, size_t length);
+  
+  // Read what has arrived into the buffer, never blocks
+  void readAvailable(HttpConnection &c, size_t limit);
+  
+  void service(HttpConnection &c);
+  
+  // The head is in: parse it and go on to the body
+  void startRequest(HttpConnection &c);
+  
+  // Request line and headers, split in place; the query goes into the arguments
+  bool parseHead(HttpConnection &c);
+  
+  // Digits only, and small enough that adding the head length cannot wrap
+  static bool parseLength(const char* text, size_t &length);
+  
+  // Split name=value&... and URL-decode both in place
+  void parseArgs(HttpConnection &c, char* text);
+  
+  static int hexValue(char h);
+  static const char* urlDecode(char* text);
+  
+  // Stream a raw body to the route's raw handler, one upload at a time
+  void serviceRaw(HttpConnection &c, unsigned long now);
+  
+  // The raw handler turned the body down: answer now, the rest is never read
+  bool rawRejected(HttpConnection &c);
+  
+  void rawWrite(HttpConnection &c, size_t n);
+  void startResponse(HttpConnection &c);
+  void dispatch(HttpConnection &c);
+  
+  // Done with the request that used the first `used` bytes of the buffer
+  void finishRequest(HttpConnection &c, size_t used);
+  
+  // Errors found by the server itself end the connection
+  void reject(HttpConnection &c, int code, const char* message);
+  
+  static const char* statusText(int code);
+  void sendResponse(int code, const char* contentType, const char* content, size_t length);
+  
+  // Straight to the socket while nothing is queued, the rest is queued. A
+  // response that does not fit is cut short and ends the connection
+  void write(const char* data, size_t length);
+};
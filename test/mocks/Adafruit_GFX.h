@@ -0,0 +1,4 @@
+// Only the font structures, for the generated font headers
+#pragma once
+#include <Arduino.h>
+#include "gfxfont.h"
@@ -0,0 +1,252 @@
+// Host stand-in for the parts of the ESP32 Arduino core the firmware uses
+// Time only moves when a test sets mockMillis (or calls delay()), serial
+// bytes go through Serial.input and Serial.output; the CPU cycle counter runs
+// on the host clock at 240 MHz, for the benchmarks
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define F(s) (s)
+#define IRAM_ATTR
+#define HEX 16
+#define DEC 10
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+inline size_t strlen_P(const char* s) { return strlen(s); }
+inline void* memcpy_P(void* dest, const void* src, size_t n) { return memcpy(dest, src, n); }
+inline uint8_t pgm_read_byte(const void* p) { return *(const uint8_t*)p; }
+inline uint16_t pgm_read_word(const void* p) { return *(const uint16_t*)p; }
+
+class String {
+public:
+  String(const char* s = "") : text(s ? s : "") {}
+  String(const std::string &s) : text(s) {}
+  explicit String(char c) : text(1, c) {}
+  explicit String(int value, unsigned char base = DEC) : text(format(value, base)) {}
+  explicit String(unsigned value, unsigned char base = DEC) : text(format(value, base)) {}
+  explicit String(long value, unsigned char base = DEC) : text(format(value, base)) {}
+  explicit String(unsigned long value, unsigned char base = DEC) : text(format(value, base)) {}
+
+  unsigned int length() const { return text.size(); }
+  bool isEmpty() const { return text.empty(); }
+  const char* c_str() const { return text.c_str(); }
+  char charAt(unsigned int i) const { return i < text.size() ? text[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  bool reserve(unsigned int size) { text.reserve(size); return true; }
+
+  bool concat(const char* s, unsigned int n) { text.append(s, n); return true; }
+  bool concat(const char* s) { text += s; return true; }
+  bool concat(const String &s) { text += s.text; return true; }
+  bool concat(char c) { text += c; return true; }
+  String &operator+=(const String &s) { concat(s); return *this; }
+  String &operator+=(const char* s) { concat(s); return *this; }
+  String &operator+=(char c) { concat(c); return *this; }
+  String &operator+=(int value) { text += format(value, DEC); return *this; }
+  String &operator+=(unsigned value) { text += format(value, DEC); return *this; }
+  String &operator+=(long value) { text += format(value, DEC); return *this; }
+  String &operator+=(unsigned long value) { text += format(value, DEC); return *this; }
+  friend String operator+(const String &a, const String &b) { return String(a.text + b.text); }
+  friend String operator+(const String &a, const char* b) { return String(a.text + b); }
+  friend String operator+(const char* a, const String &b) { return String(a + b.text); }
+
+  bool operator==(const String &s) const { return text == s.text; }
+  bool operator==(const char* s) const { return text == s; }
+  bool operator!=(const String &s) const { return text != s.text; }
+  bool operator!=(const char* s) const { return text != s; }
+  bool equalsIgnoreCase(const String &s) const { return strcasecmp(c_str(), s.c_str()) == 0; }
+  bool startsWith(const String &s) const { return text.compare(0, s.text.size(), s.text) == 0; }
+  bool endsWith(const String &s) const {
+    return text.size() >= s.text.size() && text.compare(text.size() - s.text.size(), s.text.size(), s.text) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const { return found(text.find(c, from)); }
+  int indexOf(const char* s, unsigned int from = 0) const { return found(text.find(s, from)); }
+  int lastIndexOf(char c) const { return found(text.rfind(c)); }
+  String substring(unsigned int from) const { return from < text.size() ? String(text.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < to && from < text.size() ? String(text.substr(from, to - from)) : String();
+  }
+  void remove(unsigned int from) { if (from < text.size()) text.erase(from); }
+  void remove(unsigned int from, unsigned int n) { if (from < text.size()) text.erase(from, n); }
+  void trim() {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+      text.clear();
+      return;
+    }
+    text = text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+  }
+  void toLowerCase() { for (size_t i = 0; i < text.size(); i++) text[i] = tolower((unsigned char)text[i]); }
+  void toUpperCase() { for (size_t i = 0; i < text.size(); i++) text[i] = toupper((unsigned char)text[i]); }
+  long toInt() const { return atol(text.c_str()); }
+  void toCharArray(char* buf, unsigned int size) const {
+    if (size == 0) return;
+    size_t n = std::min((size_t)size - 1, text.size());
+    memcpy(buf, text.data(), n);
+    buf[n] = '\0';
+  }
+
+private:
+  std::string text;
+
+  static int found(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+  static std::string format(long value, unsigned char base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%ld", value);
+    return buf;
+  }
+  static std::string format(unsigned long value, unsigned char base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%lu", value);
+    return buf;
+  }
+  static std::string format(int value, unsigned char base) { return format((long)value, base); }
+  static std::string format(unsigned value, unsigned char base) { return format((unsigned long)value, base); }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buf, size_t n) {
+    size_t done = 0;
+    while (done < n && write(buf[done])) done++;
+    return done;
+  }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t write(const char* buf, size_t n) { return write((const uint8_t*)buf, n); }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(const String &s) { return write(s.c_str(), s.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value, int base = DEC) { return print(String(value, base)); }
+  size_t print(unsigned value, int base = DEC) { return print(String(value, base)); }
+  size_t print(long value, int base = DEC) { return print(String(value, base)); }
+  size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(const T &value) { return print(value) + println(); }
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0) return 0;
+    return write(buf, std::min((size_t)n, sizeof(buf) - 1));
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() { return -1; }
+  void setTimeout(unsigned long timeout) {}
+};
+
+// Serial port: the firmware reads input and writes to output
+class HardwareSerial : public Stream {
+public:
+  std::string input;   // Bytes the host sent, not read yet
+  std::string output;  // Bytes the firmware sent
+  unsigned long baud = 0;
+
+  void begin(unsigned long rate) { baud = rate; }
+  void end() {}
+  void (*onBaudRate)() = NULL;  // Called as the rate changes
+  void (*onData)() = NULL;      // Set by onReceive(), the tests call it
+  void onReceive(void (*callback)()) { onData = callback; }
+  void updateBaudRate(unsigned long rate) {
+    baud = rate;
+    if (onBaudRate) onBaudRate();
+  }
+  size_t setRxBufferSize(size_t size) { return size; }
+  size_t setTxBufferSize(size_t size) { return size; }
+  operator bool() const { return true; }
+
+  int available() override { return input.size(); }
+  int read() override {
+    if (input.empty()) return -1;
+    uint8_t b = input[0];
+    input.erase(0, 1);
+    return b;
+  }
+  size_t read(uint8_t* buf, size_t n) {
+    n = std::min(n, input.size());
+    memcpy(buf, input.data(), n);
+    input.erase(0, n);
+    return n;
+  }
+  int peek() override { return input.empty() ? -1 : (uint8_t)input[0]; }
+  using Print::write;
+  size_t write(uint8_t b) override { output += (char)b; return 1; }
+  size_t write(const uint8_t* buf, size_t n) override { output.append((const char*)buf, n); return n; }
+  int availableForWrite() override { return 128; }
+};
+extern HardwareSerial Serial;
+
+extern unsigned long mockMillis;
+inline unsigned long millis() { return mockMillis; }
+inline unsigned long micros() { return mockMillis * 1000; }
+inline void delay(unsigned long ms) { mockMillis += ms; }
+inline void delayMicroseconds(unsigned int us) {}
+inline void yield() {}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) {}
+inline int digitalRead(uint8_t pin) { return LOW; }
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+inline void attachInterrupt(uint8_t pin, void (*handler)(), int mode) {}
+inline void detachInterrupt(uint8_t pin) {}
+
+inline bool psramFound() { return false; }
+inline void* ps_malloc(size_t size) { return NULL; }
+
+inline bool setCpuFrequencyMhz(uint32_t mhz) { return true; }
+inline uint32_t getCpuFrequencyMhz() { return 240; }
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return 200000; }
+  uint32_t getMinFreeHeap() { return 150000; }
+  uint32_t getMaxAllocHeap() { return 110000; }
+  uint32_t getHeapSize() { return 300000; }
+  uint32_t getCpuFreqMHz() { return 240; }
+  uint32_t getCycleCount() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count() * 240 / 1000;
+  }
+  void restart() {}
+};
+extern EspClass ESP;
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
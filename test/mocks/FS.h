@@ -0,0 +1,90 @@
+// File system in memory: mockFiles maps paths to contents
+#pragma once
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+extern std::map<std::string, std::string> mockFiles;
+
+namespace fs {
+
+class File : public Stream {
+public:
+  File() {}
+  File(const std::string &path, bool writing) : state(new State()) {
+    state->path = path;
+    state->writing = writing;
+  }
+
+  operator bool() const { return state && !state->closed; }
+  const char* name() const { return state ? state->path.c_str() : ""; }
+  size_t size() const { return *this ? contents().size() : 0; }
+  size_t position() const { return *this ? state->position : 0; }
+  bool seek(uint32_t pos) {
+    if (!*this || pos > contents().size()) return false;
+    state->position = pos;
+    return true;
+  }
+  void close() {
+    if (state) state->closed = true;
+  }
+
+  int available() override { return *this ? contents().size() - state->position : 0; }
+  int read() override {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+  size_t read(uint8_t* buf, size_t n) {
+    if (!*this || state->writing) return 0;
+    n = std::min(n, (size_t)available());
+    memcpy(buf, contents().data() + state->position, n);
+    state->position += n;
+    return n;
+  }
+  using Print::write;
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buf, size_t n) override {
+    if (!*this || !state->writing) return 0;
+    std::string &file = mockFiles[state->path];
+    file.replace(state->position, n, (const char*)buf, n);
+    state->position += n;
+    return n;
+  }
+
+private:
+  struct State {
+    std::string path;
+    size_t position = 0;
+    bool writing = false;
+    bool closed = false;
+  };
+  std::shared_ptr<State> state;  // Shared by copies, like the real handle
+
+  const std::string &contents() const { return mockFiles[state->path]; }
+};
+
+class FS {
+public:
+  File open(const char* path, const char* mode = FILE_READ, bool create = false) {
+    if (mode[0] == 'r') return exists(path) ? File(path, false) : File();
+    std::string &file = mockFiles[path];
+    if (mode[0] == 'w') file.clear();
+    File opened(path, true);
+    if (mode[0] == 'a') opened.seek(file.size());
+    return opened;
+  }
+  File open(const String &path, const char* mode = FILE_READ) { return open(path.c_str(), mode); }
+  bool exists(const char* path) { return mockFiles.count(path) > 0; }
+  bool remove(const char* path) { return mockFiles.erase(path) > 0; }
+  bool mkdir(const char* path) { return true; }
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,79 @@
+// Panel driver that draws nothing, the tests look at the frame buffer instead
+// It records the image writes and refreshes, in panel coordinates
+#pragma once
+#include <Arduino.h>
+#include <SPI.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "gfxfont.h"
+
+#define GxEPD_BLACK 0x0000
+#define GxEPD_WHITE 0xFFFF
+
+enum MockImageKind { MOCK_WRITE_IMAGE, MOCK_WRITE_FULL, MOCK_WRITE_AGAIN, MOCK_REFRESH_FULL, MOCK_REFRESH_PARTIAL };
+
+struct MockPanelWrite {
+  MockImageKind kind;
+  int16_t x, y, w, h;  // Whole panel for MOCK_REFRESH_FULL
+  size_t bytes;        // Image bytes sent, 0 for refreshes
+  bool invert;
+};
+
+class GxEPD2_370_GDEY037T03 {
+public:
+  static const uint16_t WIDTH = 240;
+  static const uint16_t HEIGHT = 416;
+  volatile uint32_t refreshes = 0;  // Full and partial
+  unsigned long refreshMs = 0;       // Real time a refresh takes
+  std::vector<MockPanelWrite> writes;
+
+  GxEPD2_370_GDEY037T03(int16_t cs, int16_t dc, int16_t rst, int16_t busy) {}
+  void selectSPI(SPIClass &spi, SPISettings settings) {}
+  void setBusyCallback(void (*callback)(const void*), const void* parameter = 0) {}
+  void writeImage(const uint8_t* bitmap, int16_t x, int16_t y, int16_t w, int16_t h, bool invert = false,
+                  bool mirrorY = false, bool pgm = false) {
+    record(MOCK_WRITE_IMAGE, x, y, w, h, invert);
+  }
+  void writeImageForFullRefresh(const uint8_t* bitmap, int16_t x, int16_t y, int16_t w, int16_t h,
+                                bool invert = false, bool mirrorY = false, bool pgm = false) {
+    record(MOCK_WRITE_FULL, x, y, w, h, invert);
+  }
+  void writeImageAgain(const uint8_t* bitmap, int16_t x, int16_t y, int16_t w, int16_t h, bool invert = false,
+                       bool mirrorY = false, bool pgm = false) {
+    record(MOCK_WRITE_AGAIN, x, y, w, h, invert);
+  }
+  void refresh(bool partialUpdateMode = false) {
+    wait();
+    refreshes++;
+    MockPanelWrite r = { MOCK_REFRESH_FULL, 0, 0, (int16_t)WIDTH, (int16_t)HEIGHT, 0, false };
+    writes.push_back(r);
+  }
+  void refresh(int16_t x, int16_t y, int16_t w, int16_t h) {
+    wait();
+    refreshes++;
+    MockPanelWrite r = { MOCK_REFRESH_PARTIAL, x, y, w, h, 0, false };
+    writes.push_back(r);
+  }
+
+private:
+  void wait() {
+    if (refreshMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(refreshMs));
+  }
+  void record(MockImageKind kind, int16_t x, int16_t y, int16_t w, int16_t h, bool invert) {
+    MockPanelWrite r = { kind, x, y, w, h, (size_t)(w + 7) / 8 * h, invert };
+    writes.push_back(r);
+  }
+};
+
+template <typename Driver, uint16_t PageHeight> class GxEPD2_BW {
+public:
+  Driver epd2;
+
+  volatile uint32_t inits = 0;
+
+  explicit GxEPD2_BW(Driver driver) : epd2(driver) {}
+  void init(uint32_t serialDiagnosticBitrate, bool initial, uint16_t resetDuration, bool pulldownRstMode) { inits++; }
+  void hibernate() {}
+  void powerOff() {}
+};
@@ -0,0 +1,48 @@
+// NVS in memory: mockPreferences maps "namespace/key" to the stored bytes
+#pragma once
+#include <Arduino.h>
+#include <map>
+#include <string>
+
+extern std::map<std::string, std::string> mockPreferences;
+extern unsigned mockPreferenceWrites;
+
+class Preferences {
+public:
+  bool begin(const char* name, bool readOnly = false) {
+    space = name;
+    return true;
+  }
+  void end() { space.clear(); }
+
+  bool isKey(const char* key) { return mockPreferences.count(path(key)) > 0; }
+  bool remove(const char* key) { return mockPreferences.erase(path(key)) > 0; }
+  size_t getBytesLength(const char* key) { return isKey(key) ? mockPreferences[path(key)].size() : 0; }
+
+  size_t putBytes(const char* key, const void* value, size_t length) {
+    mockPreferences[path(key)].assign((const char*)value, length);
+    mockPreferenceWrites++;
+    return length;
+  }
+  size_t getBytes(const char* key, void* buf, size_t maxLength) {
+    if (!isKey(key)) return 0;
+    const std::string &value = mockPreferences[path(key)];
+    if (value.size() > maxLength) return 0;
+    memcpy(buf, value.data(), value.size());
+    return value.size();
+  }
+  size_t putString(const char* key, const String &value) { return putBytes(key, value.c_str(), value.length()); }
+  String getString(const char* key, const String &defaultValue = String()) {
+    return isKey(key) ? String(mockPreferences[path(key)]) : defaultValue;
+  }
+  size_t putInt(const char* key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+  int32_t getInt(const char* key, int32_t defaultValue = 0) {
+    int32_t value;
+    return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+  }
+
+private:
+  std::string space;
+
+  std::string path(const char* key) const { return space + "/" + key; }
+};
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+public:
+  SPISettings() {}
+  SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {}
+};
+
+class SPIClass {
+public:
+  void begin() {}
+  void end() {}
+};
+extern SPIClass SPI;
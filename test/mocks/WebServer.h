@@ -0,0 +1,18 @@
+// Request types shared with the Arduino WebServer API, the firmware has its own server
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPRawStatus { RAW_START, RAW_WRITE, RAW_END, RAW_ABORTED };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define HTTP_RAW_BUFLEN 1436
+
+typedef struct {
+  HTTPRawStatus status;
+  size_t totalSize;
+  size_t currentSize;
+  uint8_t buf[HTTP_RAW_BUFLEN];
+  void* data;
+} HTTPRaw;
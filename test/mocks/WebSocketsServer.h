@@ -0,0 +1,21 @@
+// Keeps the last event broadcast, no clients ever connect
+#pragma once
+#include <Arduino.h>
+
+typedef enum { WStype_ERROR, WStype_DISCONNECTED, WStype_CONNECTED, WStype_TEXT, WStype_BIN } WStype_t;
+
+class WebSocketsServer {
+public:
+  typedef void (*WebSocketServerEvent)(uint8_t num, WStype_t type, uint8_t* payload, size_t length);
+  String lastBroadcast;
+
+  explicit WebSocketsServer(uint16_t port) {}
+  void begin() {}
+  void loop() {}
+  void onEvent(WebSocketServerEvent callback) {}
+  bool sendTXT(uint8_t num, const char* payload) { return true; }
+  bool broadcastTXT(const char* payload) {
+    lastBroadcast = payload;
+    return true;
+  }
+};
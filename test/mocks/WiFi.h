@@ -0,0 +1,96 @@
+// Access point and TCP in memory: a test opens a connection with mockConnect()
+// and plays the client on the returned MockSocket, the next WiFiServer to
+// look for clients accepts it
+#pragma once
+#include <Arduino.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include "IPAddress.h"
+
+typedef enum {
+  ARDUINO_EVENT_WIFI_AP_STACONNECTED = 12,
+  ARDUINO_EVENT_WIFI_AP_STADISCONNECTED = 13,
+} arduino_event_id_t;
+typedef arduino_event_id_t WiFiEvent_t;
+typedef void (*WiFiEventCb)(WiFiEvent_t event);
+
+struct MockSocket {
+  std::string input;         // Sent by the test, not read by the firmware yet
+  std::string output;        // Sent by the firmware
+  size_t sendWindow = 5744;  // Bytes the firmware can write before it has to wait
+  bool clientClosed = false; // The test is done sending, it still reads
+  bool serverClosed = false; // The firmware closed its end
+  int fd = -1;
+
+  // The test took what the firmware sent, as the client's ACKs would
+  std::string take() {
+    std::string sent;
+    sent.swap(output);
+    return sent;
+  }
+};
+
+std::shared_ptr<MockSocket> mockConnect(const std::string &request = std::string());
+
+class WiFiClient : public Stream {
+public:
+  WiFiClient() {}
+  explicit WiFiClient(const std::shared_ptr<MockSocket> &s) : socket(s) {}
+
+  operator bool() const { return socket && !socket->serverClosed; }
+  uint8_t connected() { return *this && (!socket->clientClosed || !socket->input.empty()); }
+  void stop() {
+    if (socket) socket->serverClosed = true;
+    socket.reset();
+  }
+  int setNoDelay(bool noDelay) { return 0; }
+  int fd() const { return socket ? socket->fd : -1; }
+  IPAddress remoteIP() const { return IPAddress(192, 168, 4, 2); }
+
+  int available() override { return *this ? socket->input.size() : 0; }
+  int read() override {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+  int read(uint8_t* buf, size_t n) {
+    if (!*this) return -1;
+    n = std::min(n, socket->input.size());
+    memcpy(buf, socket->input.data(), n);
+    socket->input.erase(0, n);
+    return n;
+  }
+  int availableForWrite() override {
+    return *this ? socket->sendWindow - std::min(socket->sendWindow, socket->output.size()) : 0;
+  }
+  using Print::write;
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buf, size_t n) override {
+    n = std::min(n, (size_t)availableForWrite());
+    if (n > 0) socket->output.append((const char*)buf, n);
+    return n;
+  }
+
+private:
+  std::shared_ptr<MockSocket> socket;
+};
+
+class WiFiServer {
+public:
+  explicit WiFiServer(uint16_t port) {}
+  void begin() {}
+  void setNoDelay(bool noDelay) {}
+  bool hasClient();
+  WiFiClient available();
+};
+
+class WiFiClass {
+public:
+  uint8_t stations = 0;
+
+  bool softAP(const char* ssid, const char* passphrase) { return true; }
+  IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+  uint8_t softAPgetStationNum() { return stations; }
+  int onEvent(WiFiEventCb callback, arduino_event_id_t event) { return 0; }
+};
+extern WiFiClass WiFi;
@@ -0,0 +1,10 @@
+// ESP-IDF's eventfd, the host has its own
+#pragma once
+#include <stddef.h>
+#include <sys/eventfd.h>
+
+typedef struct {
+  size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+inline int esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t* config) { return 0; }
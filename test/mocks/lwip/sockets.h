@@ -0,0 +1,20 @@
+// lwIP's socket calls the firmware uses, on the mock sockets of WiFi.h
+#pragma once
+#include <errno.h>
+#include <stddef.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0x08
+#endif
+
+// Mock sockets are numbered from 0
+#define LWIP_SOCKET_OFFSET 0
+#define CONFIG_LWIP_MAX_SOCKETS 10
+
+int lwip_send(int s, const void* data, size_t size, int flags);
+int lwip_getsockopt(int s, int level, int name, void* value, socklen_t* length);
+int lwip_getsockname(int s, struct sockaddr* name, socklen_t* length);
@@ -0,0 +1,50 @@
+// Allocation hook for the host tests, include once per test program (after
+// main.cpp): malloc, calloc and realloc of the whole program, operator new
+// included, go through here and are counted in mockAllocs (glibc only)
+#pragma once
+#include <stddef.h>
+#include <stdlib.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+}
+
+volatile unsigned long mockAllocs = 0;
+
+extern "C" {
+#if ENABLE_BENCH
+// The firmware counts for /bench in its link-time wrappers ([env:bench]),
+// here they sit between the hook and the C library
+void* __real_malloc(size_t size) { return __libc_malloc(size); }
+void* __real_calloc(size_t count, size_t size) { return __libc_calloc(count, size); }
+void* __real_realloc(void* ptr, size_t size) { return __libc_realloc(ptr, size); }
+
+void* malloc(size_t size) __THROW {
+  mockAllocs++;
+  return __wrap_malloc(size);
+}
+void* calloc(size_t count, size_t size) __THROW {
+  mockAllocs++;
+  return __wrap_calloc(count, size);
+}
+void* realloc(void* ptr, size_t size) __THROW {
+  mockAllocs++;
+  return __wrap_realloc(ptr, size);
+}
+#else
+void* malloc(size_t size) __THROW {
+  mockAllocs++;
+  return __libc_malloc(size);
+}
+void* calloc(size_t count, size_t size) __THROW {
+  mockAllocs++;
+  return __libc_calloc(count, size);
+}
+void* realloc(void* ptr, size_t size) __THROW {
+  mockAllocs++;
+  return __libc_realloc(ptr, size);
+}
+#endif
+}
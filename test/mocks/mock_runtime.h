@@ -0,0 +1,191 @@
+// Definitions behind the mocks, include once per test program (after main.cpp)
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <SPI.h>
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <rom/crc.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+unsigned long mockMillis = 0;
+HardwareSerial Serial;
+EspClass ESP;
+SPIClass SPI;
+WiFiClass WiFi;
+fs::LittleFSFS LittleFS;
+std::map<std::string, std::string> mockFiles;
+std::map<std::string, std::string> mockPreferences;
+unsigned mockPreferenceWrites = 0;
+
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *buf++;
+    for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+// --- TCP -----------------------------------------------------------------
+
+static std::deque<std::shared_ptr<MockSocket> > mockBacklog;
+static std::vector<std::weak_ptr<MockSocket> > mockSockets;  // By fd
+
+std::shared_ptr<MockSocket> mockConnect(const std::string &request) {
+  std::shared_ptr<MockSocket> socket(new MockSocket());
+  socket->input = request;
+  socket->fd = mockSockets.size();
+  mockSockets.push_back(socket);
+  mockBacklog.push_back(socket);
+  return socket;
+}
+
+bool WiFiServer::hasClient() { return !mockBacklog.empty(); }
+
+WiFiClient WiFiServer::available() {
+  if (mockBacklog.empty()) return WiFiClient();
+  WiFiClient client(mockBacklog.front());
+  mockBacklog.pop_front();
+  return client;
+}
+
+// Every mock socket is a connection accepted by the web server on port 80
+static std::shared_ptr<MockSocket> mockSocket(int s) {
+  std::shared_ptr<MockSocket> socket = (s >= 0 && (size_t)s < mockSockets.size()) ? mockSockets[s].lock() : NULL;
+  if (socket && socket->serverClosed) socket.reset();
+  if (!socket) errno = EBADF;
+  return socket;
+}
+
+// Takes what fits in the send window, like a non-blocking lwIP socket
+int lwip_send(int s, const void* data, size_t size, int flags) {
+  std::shared_ptr<MockSocket> socket = mockSocket(s);
+  if (!socket) return -1;
+  size_t room = socket->sendWindow - std::min(socket->sendWindow, socket->output.size());
+  if (room == 0) {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
+  size = std::min(size, room);
+  socket->output.append((const char*)data, size);
+  return size;
+}
+
+int lwip_getsockopt(int s, int level, int name, void* value, socklen_t* length) {
+  if (!mockSocket(s) || level != SOL_SOCKET || name != SO_ACCEPTCONN) return -1;
+  *(int*)value = 0;
+  return 0;
+}
+
+int lwip_getsockname(int s, struct sockaddr* name, socklen_t* length) {
+  if (!mockSocket(s)) return -1;
+  struct sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(80);
+  memcpy(name, &local, std::min((size_t)*length, sizeof(local)));
+  return 0;
+}
+
+// --- FreeRTOS --------------------------------------------------------------
+
+struct MockTask {};
+static MockTask mockMainTask;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stackDepth, void* parameter,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  if (handle) *handle = new MockTask();  // Never runs, the tests call what it would
+  return pdPASS;
+}
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stackDepth, void* parameter,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(task, name, stackDepth, parameter, priority, handle, tskNO_AFFINITY);
+}
+void vTaskDelay(TickType_t ticks) { mockMillis += ticks; }
+TickType_t xTaskGetTickCount() { return mockMillis; }
+TaskHandle_t xTaskGetCurrentTaskHandle() { return &mockMainTask; }
+BaseType_t xPortGetCoreID() { return 1; }
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 1024; }
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) { return 0; }
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { return pdPASS; }
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {}
+
+// Items live in storage sized at creation, like in FreeRTOS, so sending and
+// receiving allocate nothing. A blocking call waits in real time, so a test
+// can run a task function on a std::thread against them
+struct MockQueue {
+  size_t length;
+  size_t itemSize;
+  std::vector<uint8_t> storage;
+  size_t head;
+  size_t count;
+  std::mutex lock;
+  std::condition_variable changed;
+};
+
+// Wait until ready() or ticks (ms) run out, with the queue locked
+template <typename Ready> static bool mockWait(MockQueue* queue, std::unique_lock<std::mutex> &held, TickType_t ticks,
+                                               Ready ready) {
+  if (ticks == portMAX_DELAY) {
+    queue->changed.wait(held, ready);
+    return true;
+  }
+  return queue->changed.wait_for(held, std::chrono::milliseconds(ticks), ready);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  MockQueue* queue = new MockQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  queue->storage.resize(length * itemSize);
+  queue->head = 0;
+  queue->count = 0;
+  return queue;
+}
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> held(queue->lock);
+  if (!mockWait(queue, held, ticks, [queue] { return queue->count < queue->length; })) return pdFALSE;
+  size_t slot = (queue->head + queue->count) % queue->length;
+  if (queue->itemSize > 0) memcpy(&queue->storage[slot * queue->itemSize], item, queue->itemSize);
+  queue->count++;
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void* item) {
+  {
+    std::lock_guard<std::mutex> held(queue->lock);
+    queue->count = 0;
+  }
+  return xQueueSend(queue, item, 0);
+}
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> held(queue->lock);
+  if (!mockWait(queue, held, ticks, [queue] { return queue->count > 0; })) return pdFALSE;
+  if (queue->itemSize > 0) memcpy(item, &queue->storage[queue->head * queue->itemSize], queue->itemSize);
+  queue->head = (queue->head + 1) % queue->length;
+  queue->count--;
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> held(queue->lock);
+  return queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() { return xQueueCreate(1, 0); }
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  SemaphoreHandle_t mutex = xSemaphoreCreateBinary();
+  xSemaphoreGive(mutex);
+  return mutex;
+}
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) { return xQueueReceive(semaphore, NULL, ticks); }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return xQueueSend(semaphore, NULL, 0); }
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* woken) { return xSemaphoreGive(semaphore); }
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore) { return uxQueueMessagesWaiting(semaphore); }
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+// Same results as the ROM function: zlib's CRC-32 when chained from 0
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
@@ -0,0 +1,138 @@
+// The /bench cases on the host: each case is timed and its allocations are
+// counted the way /bench does it, and fails when it is over its host limit
+#define ENABLE_BENCH 1
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+#include "mock_alloc.h"
+
+// Limits for a build without optimization on a desktop or CI machine, about
+// five times the measured time so a slow runner does not fail; a case that
+// gets much slower, or allocates at all, does. Every case needs an entry.
+const BenchThreshold HOST_BENCH_THRESHOLDS[] = {
+  { "utf8_decode",      5000, 0 },
+  { "utf8_decode_512",  20000, 0 },
+  { "layout",          15000, 0 },
+  { "layout_9pt",      20000, 0 },
+  { "layout_12pt",     20000, 0 },
+  { "layout_18pt",     20000, 0 },
+  { "layout_24pt",     20000, 0 },
+  { "raster",         120000, 0 },
+  { "raster_cold",    150000, 0 },
+  { "message_update", 150000, 0 },
+  { "autofit",         25000, 0 },  // Both well under a millisecond
+  { "autofit_edit",    10000, 0 },
+  { "page_escape",      6000, 0 },
+  { "qr_generate",     50000, 0 },  // Stand-in QR library on the host (test/mocks/qrcode.h)
+  { "qr_draw",         20000, 0 },
+  { "frame_to_panel", 400000, 0 },
+};
+
+static BenchContext* ctx;
+static const BenchCase* benchCase;
+
+void setUp() {}
+void tearDown() {}
+
+// Fastest of a few runs, a busy CI machine only ever makes a case slower
+static BenchResult measure(const BenchCase &c) {
+  BenchResult best = runBenchCase(c, *ctx);
+  for (int i = 0; i < 2; i++) {
+    BenchResult result = runBenchCase(c, *ctx);
+    if (result.nsPerOp < best.nsPerOp) best.nsPerOp = result.nsPerOp;
+    if (result.allocsPerOp > best.allocsPerOp) best.allocsPerOp = result.allocsPerOp;
+  }
+  return best;
+}
+
+void test_bench_case() {
+  const BenchThreshold* limit = findBenchThreshold(
+    HOST_BENCH_THRESHOLDS, sizeof(HOST_BENCH_THRESHOLDS) / sizeof(HOST_BENCH_THRESHOLDS[0]), benchCase->name);
+  TEST_ASSERT_NOT_NULL_MESSAGE(limit, "no host limit for this case");
+  BenchResult result = measure(*benchCase);
+  bool ok = benchWithinLimits(result, limit);
+  char line[128];
+  formatBenchLine(line, sizeof(line), benchCase->name, result, limit, ok);
+  line[strlen(line) - 1] = '\0';
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE_MESSAGE(ok, line);
+}
+
+// The allocation hook sees what the firmware's wrappers would count
+void test_allocations_are_counted() {
+  benchTask = xTaskGetCurrentTaskHandle();
+  benchAllocs = 0;
+  void* block = malloc(16);
+  free(block);
+  std::string* text = new std::string(100, 'x');
+  delete text;
+  benchTask = NULL;
+  TEST_ASSERT_EQUAL_UINT32(3, benchAllocs);
+}
+
+// The layout benchmark's draw calls are the glyphs the raster stage draws:
+// one per glyph, nothing drawn twice, fewer at the larger sizes as more lines
+// break (the space at a break is not drawn) or fall off the panel
+void test_layout_draw_calls_at_each_size() {
+  int previous = MAX_TEXT_GLYPHS;
+  for (int size = 1; size <= FONT_SIZES; size++) {
+    int draws = benchLayoutSize(*ctx, size);
+    TEST_ASSERT_EQUAL_INT(draws, rasterizeLayout(ctx->frame, ctx->sizedLayout));
+    TEST_ASSERT_TRUE(draws <= ctx->sizedLayout.textLength);
+    TEST_ASSERT_TRUE(draws <= previous);
+    previous = draws;
+  }
+}
+
+static const BenchCase &findCase(const char* name) {
+  for (const BenchCase &c : BENCH_CASES) {
+    if (strcmp(c.name, name) == 0) return c;
+  }
+  TEST_FAIL_MESSAGE("no such case");
+  return BENCH_CASES[0];
+}
+
+// Auto-fit of the 200 character message takes well under a millisecond even
+// from nothing, and re-fitting after an edit re-wraps fewer lines than that
+void test_autofit_is_fast_and_incremental() {
+  BenchResult full = measure(findCase("autofit"));
+  BenchResult edit = measure(findCase("autofit_edit"));
+  TEST_ASSERT_LESS_THAN(1000000, full.nsPerOp);
+  TEST_ASSERT_LESS_THAN(1000000, edit.nsPerOp);
+  
+  benchAutoFit(*ctx);
+  uint32_t fullLines = ctx->fit.linesWrapped;
+  benchAutoFitEdit(*ctx);
+  uint32_t editLines = ctx->fit.linesWrapped - fullLines;
+  TEST_ASSERT_GREATER_THAN(0, editLines);
+  TEST_ASSERT_LESS_THAN(fullLines, editLines);
+}
+
+// The decoder keeps up at least 20 MB/s on a full size message, a quarter of
+// what an unoptimized host build does
+void test_utf8_decoder_throughput() {
+  BenchResult result = measure(findCase("utf8_decode_512"));
+  TEST_ASSERT_GREATER_THAN(MAX_MESSAGE_BYTES - 4, ctx->fullMessage.length());
+  unsigned long mbPerSecond = ctx->fullMessage.length() * 1000UL / (result.nsPerOp ? result.nsPerOp : 1);
+  char line[64];
+  snprintf(line, sizeof(line), "utf8_decode_512  %lu MB/s", mbPerSecond);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_GREATER_OR_EQUAL(20, mbPerSecond);
+}
+
+int main(int argc, char** argv) {
+  ctx = new BenchContext();
+  prepareBench(*ctx);
+  UNITY_BEGIN();
+  RUN_TEST(test_allocations_are_counted);
+  RUN_TEST(test_layout_draw_calls_at_each_size);
+  RUN_TEST(test_autofit_is_fast_and_incremental);
+  RUN_TEST(test_utf8_decoder_throughput);
+  for (const BenchCase &c : BENCH_CASES) {
+    benchCase = &c;
+    UnityDefaultTestRun(test_bench_case, c.name, __LINE__);
+  }
+  int failures = UNITY_END();
+  delete ctx;
+  return failures;
+}
@@ -0,0 +1,51 @@
+// Boot order: setup() brings the web server up without waiting for the panel,
+// which the render task initialises on its own, so the page answers first
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+#include <thread>
+
+static const unsigned long WAIT_MS = 5000;
+
+void setUp() {}
+void tearDown() {}
+
+void test_page_answers_before_the_panel_is_initialised() {
+  mockMillis = 1;  // Milestones at 0 would read as not reached
+  setup();
+  TEST_ASSERT_EQUAL_UINT32(0, display.inits);
+  TEST_ASSERT_EQUAL_UINT32(0, bootDisplayReady);
+  TEST_ASSERT_EQUAL_UINT32(1, uxQueueMessagesWaiting(renderMailbox));  // The QR screen
+
+  std::shared_ptr<MockSocket> socket = mockConnect("GET / HTTP/1.1\r\nHost: 192.168.4.1\r\n\r\n");
+  socket->clientClosed = true;
+  std::string response;
+  for (int i = 0; i < 20 && !socket->serverClosed; i++) {
+    loop();
+    mockMillis += 1;
+    response += socket->take();
+  }
+  TEST_ASSERT_EQUAL_INT(0, response.compare(0, 12, "HTTP/1.1 200"));
+  TEST_ASSERT_TRUE(response.find("</html>") != std::string::npos);
+  TEST_ASSERT_NOT_EQUAL(0, bootFirstResponse);
+  TEST_ASSERT_EQUAL_UINT32(0, display.inits);
+}
+
+// The render task then sets up the panel and draws the QR screen
+void test_render_task_initialises_the_panel_afterwards() {
+  std::thread render(renderTask, (void*)NULL);
+  render.detach();  // Blocks on the mailbox until the program exits
+  for (unsigned long waited = 0; waited < WAIT_MS && bootFirstRender == 0; waited++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  TEST_ASSERT_NOT_EQUAL(0, bootFirstRender);
+  TEST_ASSERT_EQUAL_UINT32(1, display.inits);
+  TEST_ASSERT_GREATER_THAN(bootFirstResponse, bootDisplayReady);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_page_answers_before_the_panel_is_initialised);
+  RUN_TEST(test_render_task_initialises_the_panel_afterwards);
+  return UNITY_END();
+}
@@ -0,0 +1,155 @@
+// Partial refresh in updateDisplay(): the band of the panel each update
+// writes, the bytes that takes, and when a full refresh is forced
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+
+// Wraps to several lines at 12pt; the font is monospaced, so changing one
+// letter never moves a line break
+static char message[] = "The quick brown fox jumps over the lazy dog while the panel waits for "
+                        "its next refresh, and the message keeps growing past the second line.";
+static const size_t FULL_BYTES = FRAME_HEIGHT / 8 * FRAME_WIDTH;
+
+static std::vector<MockPanelWrite> &writes = display.epd2.writes;
+
+static void show(int size = 2) { updateDisplay(message, strlen(message), size); }
+
+static void assertWrite(const MockPanelWrite &w, MockImageKind kind, int x, int width) {
+  TEST_ASSERT_EQUAL_INT(kind, w.kind);
+  TEST_ASSERT_EQUAL_INT(x, w.x);
+  TEST_ASSERT_EQUAL_INT(0, w.y);
+  TEST_ASSERT_EQUAL_INT(width, w.w);
+  TEST_ASSERT_EQUAL_INT(FRAME_WIDTH, w.h);
+}
+
+// Index of the glyph run (line) holding text position i
+static int lineOf(const TextLayout &layout, int i) {
+  for (int r = 0; r < layout.runCount; r++) {
+    if (i >= layout.runs[r].start && i < layout.runs[r].start + layout.runs[r].length) return r;
+  }
+  return -1;
+}
+
+void setUp() {
+  lastFrameValid = false;
+  partialRefreshCount = 0;
+  show();
+  writes.clear();
+}
+void tearDown() {}
+
+void test_first_update_is_a_full_refresh_of_the_whole_panel() {
+  lastFrameValid = false;
+  uint32_t sentBefore = panelBytesSent;
+  show();
+  TEST_ASSERT_EQUAL_INT(3, writes.size());
+  assertWrite(writes[0], MOCK_WRITE_FULL, 0, FRAME_HEIGHT);
+  TEST_ASSERT_EQUAL_INT(MOCK_REFRESH_FULL, writes[1].kind);
+  assertWrite(writes[2], MOCK_WRITE_AGAIN, 0, FRAME_HEIGHT);
+  TEST_ASSERT_TRUE(writes[0].invert);
+  TEST_ASSERT_EQUAL_UINT32(FULL_BYTES, writes[0].bytes);
+  TEST_ASSERT_EQUAL_UINT32(2 * FULL_BYTES, panelBytesSent - sentBefore);
+}
+
+void test_one_line_edit_pushes_only_that_band() {
+  TEST_ASSERT_GREATER_THAN(2, lastLayout.runCount);
+  FrameBuffer before = frame;
+  char* word = strstr(message, "lazy");
+  int line = lineOf(lastLayout, word - message);
+  TEST_ASSERT_GREATER_THAN(0, line);
+
+  word[0] = 'h';  // "hazy"
+  uint32_t sentBefore = panelBytesSent;
+  show();
+  word[0] = 'l';
+
+  // The line's rows from its ascent to its descent, widened to whole bytes
+  // of the panel, which runs along the frame's columns
+  int top = (lastLayout.runs[line].y - lastLayout.ascent) & ~7;
+  int bottom = (lastLayout.runs[line].y + lastLayout.descent) | 7;
+  int height = bottom + 1 - top;
+  int panelX = FRAME_HEIGHT - top - height;
+  TEST_ASSERT_EQUAL_INT(3, writes.size());
+  assertWrite(writes[0], MOCK_WRITE_IMAGE, panelX, height);
+  assertWrite(writes[1], MOCK_REFRESH_PARTIAL, panelX, height);
+  assertWrite(writes[2], MOCK_WRITE_AGAIN, panelX, height);
+  size_t bytes = height / 8 * FRAME_WIDTH;
+  TEST_ASSERT_EQUAL_UINT32(bytes, writes[0].bytes);
+  TEST_ASSERT_EQUAL_UINT32(2 * bytes, panelBytesSent - sentBefore);
+  TEST_ASSERT_TRUE(bytes * 4 < FULL_BYTES);
+
+  // Only rows inside the band changed
+  bool changed = false;
+  for (int y = 0; y < FRAME_HEIGHT; y++) {
+    bool same = memcmp(before.rows[y], frame.rows[y], sizeof(frame.rows[y])) == 0;
+    if (y < top || y > bottom) TEST_ASSERT_TRUE(same);
+    changed = changed || !same;
+  }
+  TEST_ASSERT_TRUE(changed);
+}
+
+// Edits on two lines push one band from the first to the second
+void test_edits_on_two_lines_push_the_band_between_them() {
+  char* first = strstr(message, "quick");
+  char* second = strstr(message, "second");
+  int firstLine = lineOf(lastLayout, first - message);
+  int secondLine = lineOf(lastLayout, second - message);
+  TEST_ASSERT_TRUE(secondLine > firstLine);
+
+  first[0] = 'Q';
+  second[0] = 'S';
+  show();
+  first[0] = 'q';
+  second[0] = 's';
+
+  int top = (lastLayout.runs[firstLine].y - lastLayout.ascent) & ~7;
+  int bottom = (lastLayout.runs[secondLine].y + lastLayout.descent) | 7;
+  if (bottom >= FRAME_HEIGHT) bottom = FRAME_HEIGHT - 1;
+  int height = bottom + 1 - top;
+  TEST_ASSERT_EQUAL_INT(3, writes.size());
+  assertWrite(writes[0], MOCK_WRITE_IMAGE, FRAME_HEIGHT - top - height, height);
+}
+
+void test_unchanged_message_writes_nothing() {
+  show();
+  TEST_ASSERT_EQUAL_INT(0, writes.size());
+  TEST_ASSERT_EQUAL_INT(0, partialRefreshCount);
+}
+
+// FULL_REFRESH_EVERY partial refreshes in a row, then a full one to clear the ghosting
+void test_full_refresh_after_full_refresh_every_partials() {
+  char* word = strstr(message, "lazy");
+  for (int i = 1; i <= FULL_REFRESH_EVERY; i++) {
+    word[0] = (i % 2) ? 'h' : 'l';
+    writes.clear();
+    show();
+    TEST_ASSERT_EQUAL_INT(MOCK_WRITE_IMAGE, writes[0].kind);
+    TEST_ASSERT_EQUAL_INT(MOCK_REFRESH_PARTIAL, writes[1].kind);
+    TEST_ASSERT_EQUAL_INT(i, partialRefreshCount);
+  }
+  word[0] = (word[0] == 'h') ? 'l' : 'h';
+  writes.clear();
+  show();
+  word[0] = 'l';
+  TEST_ASSERT_EQUAL_INT(MOCK_WRITE_FULL, writes[0].kind);
+  TEST_ASSERT_EQUAL_INT(MOCK_REFRESH_FULL, writes[1].kind);
+  TEST_ASSERT_EQUAL_UINT32(FULL_BYTES, writes[0].bytes);
+  TEST_ASSERT_EQUAL_INT(0, partialRefreshCount);
+}
+
+void test_font_size_change_is_a_full_refresh() {
+  show(3);
+  TEST_ASSERT_EQUAL_INT(MOCK_WRITE_FULL, writes[0].kind);
+  TEST_ASSERT_EQUAL_INT(MOCK_REFRESH_FULL, writes[1].kind);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_update_is_a_full_refresh_of_the_whole_panel);
+  RUN_TEST(test_one_line_edit_pushes_only_that_band);
+  RUN_TEST(test_edits_on_two_lines_push_the_band_between_them);
+  RUN_TEST(test_unchanged_message_writes_nothing);
+  RUN_TEST(test_full_refresh_after_full_refresh_every_partials);
+  RUN_TEST(test_font_size_change_is_a_full_refresh);
+  return UNITY_END();
+}
@@ -0,0 +1,356 @@
+// The web server's request parsing, keep-alive and raw bodies, over mock sockets
+// Builds against the module alone (src/multi_web_server.cpp), without main.cpp
+#include <unity.h>
+#include "multi_web_server.h"
+#include "mock_runtime.h"
+
+MultiWebServer server(80);
+
+// The server's warnings, main.cpp has the real log
+void logWrite(uint8_t level, const char* format, ...) {}
+
+static size_t rawBytes;
+static size_t rawLimit;
+static int rawStarts, rawEnds, rawAborts;
+static int uploads;
+
+static void handleEcho() {
+  char body[128];
+  snprintf(body, sizeof(body), "%s|%s|%s", server.arg("a"), server.arg("b"), server.header("X-Test"));
+  server.send(200, "text/plain", body);
+}
+
+// More than a send window of body, in pieces
+static void handleBig() {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain", "");
+  for (int i = 0; i < 100; i++) server.sendContent(std::string(100, 'a' + i % 26).c_str());
+  server.sendContent("");
+}
+
+static void handleForm() {
+  server.send(200, "text/plain", server.arg("message"));
+}
+
+static void handleUpload() {
+  uploads++;
+  char body[32];
+  snprintf(body, sizeof(body), "%u", (unsigned)rawBytes);
+  server.send(200, "text/plain", body);
+}
+
+static void handleUploadBody() {
+  HTTPRaw &raw = server.raw();
+  if (raw.status == RAW_START) rawStarts++;
+  if (raw.status == RAW_WRITE) rawBytes += raw.currentSize;
+  if (raw.status == RAW_WRITE && rawBytes > rawLimit) server.rejectRaw(413, "too much");
+  if (raw.status == RAW_END) rawEnds++;
+  if (raw.status == RAW_ABORTED) rawAborts++;
+}
+
+static void handleCached() {
+  server.sendHeader("ETag", "\"1\"");
+  server.send(304);
+}
+
+static void handleMissing() {
+  server.send(404, "text/plain", "nothing here");
+}
+
+// Let the server work on what the clients sent so far
+static void poll(int times = 8) {
+  for (int i = 0; i < times; i++) {
+    server.handleClient();
+    mockMillis += 1;
+  }
+}
+
+static std::string request(const std::string &text) {
+  std::shared_ptr<MockSocket> socket = mockConnect(text);
+  socket->clientClosed = true;  // Sent everything, still reads the answer
+  poll();
+  return socket->take();
+}
+
+static int status(const std::string &response) {
+  return response.compare(0, 9, "HTTP/1.1 ") == 0 ? atoi(response.c_str() + 9) : -1;
+}
+
+static std::string body(const std::string &response) {
+  size_t end = response.find("\r\n\r\n");
+  return end == std::string::npos ? std::string() : response.substr(end + 4);
+}
+
+static int count(const std::string &text, const std::string &part) {
+  int n = 0;
+  for (size_t at = text.find(part); at != std::string::npos; at = text.find(part, at + 1)) n++;
+  return n;
+}
+
+void setUp() {
+  rawBytes = 0;
+  rawLimit = (size_t)-1;
+  uploads = 0;
+  rawStarts = rawEnds = rawAborts = 0;
+}
+void tearDown() {
+  poll();  // Let connections left open time out of the way
+  mockMillis += HTTP_IDLE_TIMEOUT + 1;
+  poll();
+}
+
+void test_query_arguments_are_url_decoded() {
+  std::string response = request("GET /echo?a=x%20y+z&b=%C3%BE HTTP/1.1\r\nX-Test: yes\r\n\r\n");
+  TEST_ASSERT_EQUAL_INT(200, status(response));
+  TEST_ASSERT_EQUAL_STRING("x y z|\xC3\xBE|yes", body(response).c_str());
+}
+
+void test_form_body_is_parsed() {
+  std::string response = request(
+      "POST /form HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: 18\r\n\r\n"
+      "message=Hall%C3%B3");
+  TEST_ASSERT_EQUAL_INT(200, status(response));
+  TEST_ASSERT_EQUAL_STRING("Hall\xC3\xB3", body(response).c_str());
+}
+
+void test_body_arriving_later_is_waited_for() {
+  std::shared_ptr<MockSocket> socket = mockConnect(
+      "POST /form HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: 9\r\n\r\nmess");
+  poll();
+  TEST_ASSERT_EQUAL_INT(0, socket->output.size());
+  TEST_ASSERT_TRUE(server.pending());
+  socket->input += "age=x";
+  poll();
+  TEST_ASSERT_EQUAL_STRING("x", body(socket->take()).c_str());
+}
+
+void test_bad_content_length_is_rejected() {
+  const char* lengths[] = { "12x", "-1", "", " ", "99999999999999999999999", "18446744073709551615" };
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+    std::shared_ptr<MockSocket> socket =
+        mockConnect(std::string("POST /form HTTP/1.1\r\nContent-Length: ") + lengths[i] + "\r\n\r\nmessage=x");
+    poll();
+    TEST_ASSERT_EQUAL_INT_MESSAGE(400, status(socket->take()), lengths[i]);
+    TEST_ASSERT_TRUE(socket->serverClosed);
+  }
+}
+
+void test_form_larger_than_the_buffer_is_rejected() {
+  std::shared_ptr<MockSocket> socket = mockConnect("POST /form HTTP/1.1\r\nContent-Length: 5000\r\n\r\nmessage=");
+  poll();
+  TEST_ASSERT_EQUAL_INT(413, status(socket->take()));
+  TEST_ASSERT_TRUE(socket->serverClosed);
+}
+
+// The page's form allows MAX_MESSAGE_BYTES (main.cpp) letters, each maybe two bytes
+static const int FORM_MESSAGE_BYTES = 512;
+
+void test_longest_form_message_fits() {
+  std::string message;
+  for (int i = 0; i < FORM_MESSAGE_BYTES; i++) message += "%C3%BE";  // þ
+  std::string form = "message=" + message;
+  char head[256];
+  snprintf(head, sizeof(head),
+           "POST /form HTTP/1.1\r\nHost: 192.168.4.1\r\nUser-Agent: Mozilla/5.0 (Linux; Android 14) "
+           "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0 Mobile Safari/537.36\r\n"
+           "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %u\r\n\r\n",
+           (unsigned)form.size());
+  std::string response = request(head + form);
+  TEST_ASSERT_EQUAL_INT(200, status(response));
+  TEST_ASSERT_EQUAL_INT(2 * FORM_MESSAGE_BYTES, body(response).size());
+}
+
+void test_pipelined_requests_share_a_connection() {
+  uint32_t reused = httpReusedRequests;
+  std::shared_ptr<MockSocket> socket = mockConnect("GET /echo?a=1 HTTP/1.1\r\n\r\nGET /echo?a=2 HTTP/1.1\r\n\r\n");
+  poll();
+  std::string responses = socket->take();
+  TEST_ASSERT_EQUAL_INT(2, count(responses, "HTTP/1.1 200 OK"));
+  TEST_ASSERT_EQUAL_INT(2, count(responses, "Connection: keep-alive"));
+  TEST_ASSERT_TRUE(responses.find("\r\n\r\n1||") != std::string::npos);
+  TEST_ASSERT_TRUE(responses.find("\r\n\r\n2||") != std::string::npos);
+  TEST_ASSERT_FALSE(socket->serverClosed);
+  TEST_ASSERT_EQUAL_UINT32(reused + 1, httpReusedRequests);
+}
+
+void test_http10_and_connection_close_end_the_connection() {
+  std::shared_ptr<MockSocket> socket = mockConnect("GET /echo HTTP/1.0\r\n\r\n");
+  poll();
+  TEST_ASSERT_TRUE(socket->take().find("Connection: close") != std::string::npos);
+  TEST_ASSERT_TRUE(socket->serverClosed);
+  socket = mockConnect("GET /echo HTTP/1.1\r\nConnection: close\r\n\r\n");
+  poll();
+  TEST_ASSERT_EQUAL_INT(200, status(socket->take()));
+  TEST_ASSERT_TRUE(socket->serverClosed);
+}
+
+void test_malformed_requests_are_rejected() {
+  TEST_ASSERT_EQUAL_INT(400, status(request("BREW /echo HTTP/1.1\r\n\r\n")));
+  TEST_ASSERT_EQUAL_INT(400, status(request("GET\r\n\r\n")));
+  TEST_ASSERT_EQUAL_INT(400, status(request("POST /form HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n")));
+  std::string huge = "GET /echo HTTP/1.1\r\nX-Big: " + std::string(HTTP_MAX_REQUEST, 'x') + "\r\n\r\n";
+  TEST_ASSERT_EQUAL_INT(431, status(request(huge)));
+}
+
+void test_unknown_path_goes_to_not_found() {
+  std::string response = request("GET /nowhere HTTP/1.1\r\n\r\n");
+  TEST_ASSERT_EQUAL_INT(404, status(response));
+  TEST_ASSERT_EQUAL_STRING("nothing here", body(response).c_str());
+}
+
+void test_raw_body_is_streamed_in_chunks() {
+  std::string upload(5000, 'p');
+  std::shared_ptr<MockSocket> socket = mockConnect("POST /upload HTTP/1.1\r\nContent-Length: 5000\r\n\r\n");
+  poll();
+  for (size_t sent = 0; sent < upload.size(); sent += 700) {
+    socket->input += upload.substr(sent, 700);
+    poll(2);
+  }
+  poll();
+  std::string response = socket->take();
+  TEST_ASSERT_EQUAL_INT(200, status(response));
+  TEST_ASSERT_EQUAL_STRING("5000", body(response).c_str());
+  TEST_ASSERT_EQUAL_INT(1, rawStarts);
+  TEST_ASSERT_EQUAL_INT(1, rawEnds);
+}
+
+void test_raw_body_cut_short_is_aborted() {
+  std::shared_ptr<MockSocket> socket = mockConnect("POST /upload HTTP/1.1\r\nContent-Length: 5000\r\n\r\npart");
+  poll();
+  socket->clientClosed = true;
+  poll();
+  TEST_ASSERT_EQUAL_INT(1, rawAborts);
+  TEST_ASSERT_EQUAL_INT(0, rawEnds);
+  TEST_ASSERT_TRUE(socket->serverClosed);
+}
+
+void test_raw_body_rejected_by_the_handler_is_not_read() {
+  rawLimit = 1000;
+  std::shared_ptr<MockSocket> socket = mockConnect("POST /upload HTTP/1.1\r\nContent-Length: 5000\r\n\r\n");
+  poll();
+  socket->input += std::string(4000, 'p');
+  poll();
+  std::string response = socket->take();
+  TEST_ASSERT_EQUAL_INT(413, status(response));
+  TEST_ASSERT_EQUAL_STRING("too much", body(response).c_str());
+  TEST_ASSERT_TRUE(socket->serverClosed);
+  TEST_ASSERT_TRUE(rawBytes < 4000);  // Stopped after the chunk that went over
+  TEST_ASSERT_EQUAL_INT(0, rawEnds);
+  TEST_ASSERT_EQUAL_INT(0, uploads);
+}
+
+// Chunked body of handleBig()
+static std::string unchunk(const std::string &chunked) {
+  std::string out;
+  for (size_t at = 0; at < chunked.size();) {
+    size_t length = strtoul(chunked.c_str() + at, NULL, 16);
+    at = chunked.find("\r\n", at) + 2;
+    out += chunked.substr(at, length);
+    at += length + 2;
+  }
+  return out;
+}
+
+void test_response_is_queued_for_a_slow_client() {
+  std::shared_ptr<MockSocket> socket = mockConnect("GET /big HTTP/1.1\r\n\r\nGET /echo?a=next HTTP/1.1\r\n\r\n");
+  socket->sendWindow = 1000;
+  poll();
+  std::string received = socket->take();
+  TEST_ASSERT_EQUAL_INT(1000, received.size());
+  TEST_ASSERT_TRUE(server.pending());
+  for (int i = 0; i < 100 && server.pending(); i++) {
+    poll(1);
+    received += socket->take();
+  }
+  TEST_ASSERT_EQUAL_INT(200, status(received));
+  size_t second = received.find("HTTP/1.1 200 OK", 1);
+  TEST_ASSERT_TRUE(second != std::string::npos);  // Only after all of the first response
+  std::string first = body(received.substr(0, second));
+  std::string expected;
+  for (int i = 0; i < 100; i++) expected += std::string(100, 'a' + i % 26);
+  TEST_ASSERT_TRUE(unchunk(first) == expected);
+  TEST_ASSERT_EQUAL_STRING("next||", body(received.substr(second)).c_str());
+  TEST_ASSERT_FALSE(socket->serverClosed);
+}
+
+void test_connection_closes_once_the_queue_is_sent() {
+  std::shared_ptr<MockSocket> socket = mockConnect("GET /big HTTP/1.0\r\n\r\n");
+  socket->sendWindow = 1000;
+  poll();
+  TEST_ASSERT_FALSE(socket->serverClosed);
+  std::string received;
+  for (int i = 0; i < 100 && !socket->serverClosed; i++) {
+    received += socket->take();
+    poll(1);
+  }
+  received += socket->take();
+  TEST_ASSERT_TRUE(socket->serverClosed);
+  TEST_ASSERT_EQUAL_INT(10000, body(received).size());  // HTTP/1.0: not chunked
+}
+
+void test_client_that_stops_reading_times_out() {
+  std::shared_ptr<MockSocket> socket = mockConnect("GET /big HTTP/1.1\r\n\r\n");
+  socket->sendWindow = 1000;
+  poll();
+  mockMillis += HTTP_REQUEST_TIMEOUT + 1;
+  poll();
+  TEST_ASSERT_TRUE(socket->serverClosed);
+}
+
+void test_head_response_has_no_body() {
+  std::string response = request("HEAD /echo?a=1 HTTP/1.1\r\n\r\n");
+  TEST_ASSERT_EQUAL_INT(200, status(response));
+  TEST_ASSERT_TRUE(response.find("Content-Length: 3\r\n") != std::string::npos);
+  TEST_ASSERT_EQUAL_STRING("", body(response).c_str());
+  response = request("HEAD /big HTTP/1.1\r\n\r\n");
+  TEST_ASSERT_TRUE(response.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+  TEST_ASSERT_EQUAL_STRING("", body(response).c_str());
+}
+
+// No Content-Length on a 304, it would claim the cached body is empty
+void test_not_modified_has_no_length_or_body() {
+  std::shared_ptr<MockSocket> socket = mockConnect("GET /cached HTTP/1.1\r\n\r\nGET /echo?a=1 HTTP/1.1\r\n\r\n");
+  poll();
+  std::string responses = socket->take();
+  TEST_ASSERT_EQUAL_INT(304, status(responses));
+  size_t end = responses.find("\r\n\r\n");
+  std::string head = responses.substr(0, end);
+  TEST_ASSERT_TRUE(head.find("Content-Length") == std::string::npos);
+  TEST_ASSERT_TRUE(head.find("Transfer-Encoding") == std::string::npos);
+  TEST_ASSERT_TRUE(head.find("Connection: keep-alive") != std::string::npos);
+  // The next response follows right after the head
+  TEST_ASSERT_EQUAL_INT(0, responses.compare(end + 4, 12, "HTTP/1.1 200"));
+  TEST_ASSERT_EQUAL_STRING("1||", body(responses.substr(end + 4)).c_str());
+}
+
+int main(int argc, char** argv) {
+  server.on("/echo", handleEcho);
+  server.on("/big", handleBig);
+  server.on("/cached", handleCached);
+  server.on("/form", HTTP_POST, handleForm);
+  server.on("/upload", HTTP_POST, handleUpload, handleUploadBody);
+  server.onNotFound(handleMissing);
+  const char* headerKeys[] = { "X-Test" };
+  server.collectHeaders(headerKeys, 1);
+  server.begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_query_arguments_are_url_decoded);
+  RUN_TEST(test_form_body_is_parsed);
+  RUN_TEST(test_body_arriving_later_is_waited_for);
+  RUN_TEST(test_bad_content_length_is_rejected);
+  RUN_TEST(test_form_larger_than_the_buffer_is_rejected);
+  RUN_TEST(test_longest_form_message_fits);
+  RUN_TEST(test_pipelined_requests_share_a_connection);
+  RUN_TEST(test_http10_and_connection_close_end_the_connection);
+  RUN_TEST(test_malformed_requests_are_rejected);
+  RUN_TEST(test_unknown_path_goes_to_not_found);
+  RUN_TEST(test_raw_body_is_streamed_in_chunks);
+  RUN_TEST(test_raw_body_cut_short_is_aborted);
+  RUN_TEST(test_raw_body_rejected_by_the_handler_is_not_read);
+  RUN_TEST(test_response_is_queued_for_a_slow_client);
+  RUN_TEST(test_connection_closes_once_the_queue_is_sent);
+  RUN_TEST(test_client_that_stops_reading_times_out);
+  RUN_TEST(test_head_response_has_no_body);
+  RUN_TEST(test_not_modified_has_no_length_or_body);
+  return UNITY_END();
+}
@@ -0,0 +1,178 @@
+// Line wrapping, auto-fit measuring and text layout
+// FreeMonoBold is monospaced, so line lengths are counted in characters
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+
+static uint16_t text[MAX_TEXT_GLYPHS];
+static FitMemo memo;
+static FitMemo fresh;
+static TextLayout layout;
+
+static int toText(const char* s) {
+  int len = strlen(s);
+  for (int i = 0; i < len; i++) text[i] = (uint8_t)s[i];
+  return len;
+}
+
+// Characters that fit on one line at a size
+static int lineChars(int size) {
+  return (FRAME_WIDTH - 2 * TEXT_MARGIN) / glyphAdvance(getFont(size), 'a');
+}
+
+// Deterministic words of 1 to 9 letters, some lines broken by hand
+static int makeText(uint32_t seed, int len) {
+  for (int i = 0; i < len; i++) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t r = (seed >> 16) % 100;
+    text[i] = (r < 15) ? ' ' : (r == 15) ? '\n' : 'a' + r % 26;
+  }
+  return len;
+}
+
+void setUp() {
+  memset(&memo, 0, sizeof(memo));
+}
+void tearDown() {}
+
+void test_wrap_breaks_after_the_last_space() {
+  int chars = lineChars(2);
+  int len = 2 * chars;
+  for (int i = 0; i < len; i++) text[i] = "word "[i % 5];
+  int next, scanned;
+  int end = wrapLine(text, len, 0, getFont(2), next, scanned);
+  TEST_ASSERT_EQUAL_UINT16(' ', text[end]);
+  TEST_ASSERT_LESS_OR_EQUAL(chars, end);
+  TEST_ASSERT_GREATER_THAN(chars - 5, end);
+  TEST_ASSERT_EQUAL_INT(end + 1, next);
+  TEST_ASSERT_EQUAL_INT(chars, scanned);
+}
+
+void test_wrap_splits_a_word_longer_than_the_line() {
+  int chars = lineChars(4);
+  int len = chars + 5;
+  for (int i = 0; i < len; i++) text[i] = 'x';
+  int next, scanned;
+  TEST_ASSERT_EQUAL_INT(chars, wrapLine(text, len, 0, getFont(4), next, scanned));
+  TEST_ASSERT_EQUAL_INT(chars, next);
+  TEST_ASSERT_EQUAL_INT(len, wrapLine(text, len, next, getFont(4), next, scanned));
+  TEST_ASSERT_EQUAL_INT(len, next);
+}
+
+void test_wrap_drops_the_space_it_breaks_at() {
+  int chars = lineChars(3);
+  for (int i = 0; i < chars; i++) text[i] = 'x';
+  text[chars] = ' ';
+  text[chars + 1] = 'y';
+  int next, scanned;
+  TEST_ASSERT_EQUAL_INT(chars, wrapLine(text, chars + 2, 0, getFont(3), next, scanned));
+  TEST_ASSERT_EQUAL_INT(chars + 1, next);
+}
+
+void test_wrap_takes_crlf_as_one_break() {
+  int len = toText("ab\r\ncd\nef\r");
+  int next, scanned;
+  TEST_ASSERT_EQUAL_INT(2, wrapLine(text, len, 0, getFont(1), next, scanned));
+  TEST_ASSERT_EQUAL_INT(4, next);
+  TEST_ASSERT_EQUAL_INT(6, wrapLine(text, len, next, getFont(1), next, scanned));
+  TEST_ASSERT_EQUAL_INT(7, next);
+  TEST_ASSERT_EQUAL_INT(9, wrapLine(text, len, next, getFont(1), next, scanned));
+  TEST_ASSERT_EQUAL_INT(len, next);
+}
+
+void test_measure_counts_wrapped_lines() {
+  int chars = lineChars(2);
+  int len = 3 * chars;
+  for (int i = 0; i < len; i++) text[i] = 'x';
+  TEST_ASSERT_EQUAL_INT(3, measureLines(text, len, 2, memo));
+  TEST_ASSERT_EQUAL_INT(1, measureLines(text, toText("a\r\n"), 2, memo));
+  TEST_ASSERT_EQUAL_INT(0, measureLines(text, 0, 2, memo));
+}
+
+// After every edit the memoized count and line starts equal a fresh measurement
+void test_measure_after_edits_matches_fresh() {
+  uint32_t seed = 1;
+  int len = makeText(7, 300);
+  for (int edit = 0; edit < 2000; edit++) {
+    seed = seed * 1103515245 + 12345;
+    int at = (seed >> 8) % (len + 1);
+    int kind = (seed >> 4) % 3;
+    if (kind == 0 && len < MAX_TEXT_GLYPHS) {
+      memmove(text + at + 1, text + at, (len - at) * sizeof(uint16_t));
+      text[at] = (seed & 1) ? ' ' : 'q';
+      len++;
+    } else if (kind == 1 && at < len) {
+      memmove(text + at, text + at + 1, (len - at - 1) * sizeof(uint16_t));
+      len--;
+    } else if (at < len) {
+      text[at] = (text[at] == ' ') ? 'z' : ' ';
+    }
+    memset(&fresh, 0, sizeof(fresh));
+    for (int size = 1; size <= FONT_SIZES; size++) {
+      int expected = measureLines(text, len, size, fresh);
+      TEST_ASSERT_EQUAL_INT(expected, measureLines(text, len, size, memo));
+      for (int i = 0; i < expected; i++) {
+        TEST_ASSERT_EQUAL_UINT16(fresh.sizes[size - 1].lines[i].start, memo.sizes[size - 1].lines[i].start);
+      }
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(memo.linesWrapped, memo.linesReused);
+}
+
+void test_measure_of_unchanged_text_wraps_nothing() {
+  int len = makeText(3, 200);
+  measureLines(text, len, 1, memo);
+  uint32_t wrapped = memo.linesWrapped;
+  measureLines(text, len, 1, memo);
+  TEST_ASSERT_EQUAL_UINT32(wrapped, memo.linesWrapped);
+}
+
+void test_fit_picks_the_largest_size_that_fits() {
+  for (int len = 0; len <= MAX_TEXT_GLYPHS; len += 8) {
+    makeText(len, len);
+    int size = fitFontSize(text, len, memo);
+    memset(&fresh, 0, sizeof(fresh));
+    TEST_ASSERT_TRUE(size == 1 || fitsAtSize(text, len, size, fresh));
+    TEST_ASSERT_TRUE(size == FONT_SIZES || !fitsAtSize(text, len, size + 1, fresh));
+  }
+}
+
+void test_fit_uses_the_largest_size_for_a_short_message() {
+  TEST_ASSERT_EQUAL_INT(FONT_SIZES, fitFontSize(text, toText("Hi"), memo));
+}
+
+void test_layout_lines_match_measure() {
+  const char* message = "The quick brown fox jumps over the lazy dog, again and again and again.\nNew line";
+  for (int size = 1; size <= FONT_SIZES; size++) {
+    layoutText(message, strlen(message), size, layout);
+    TEST_ASSERT_EQUAL_INT(size, layout.fontSize);
+    TEST_ASSERT_EQUAL_INT(measureLines(layout.text, layout.textLength, size, memo), layout.runCount);
+    for (int i = 1; i < layout.runCount; i++) {
+      TEST_ASSERT_EQUAL_INT(layout.lineHeight, layout.runs[i].y - layout.runs[i - 1].y);
+      TEST_ASSERT_EQUAL_INT(TEXT_MARGIN, layout.runs[i].x);
+    }
+  }
+}
+
+void test_layout_auto_size_is_the_fitted_size() {
+  const char* message = "A message of some length that should not fit on one line at the largest size";
+  layoutText(message, strlen(message), FONT_SIZE_AUTO, layout);
+  TEST_ASSERT_EQUAL_INT(fitFontSize(layout.text, layout.textLength, memo), layout.fontSize);
+  TEST_ASSERT_TRUE(layout.font == getFont(layout.fontSize));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_wrap_breaks_after_the_last_space);
+  RUN_TEST(test_wrap_splits_a_word_longer_than_the_line);
+  RUN_TEST(test_wrap_drops_the_space_it_breaks_at);
+  RUN_TEST(test_wrap_takes_crlf_as_one_break);
+  RUN_TEST(test_measure_counts_wrapped_lines);
+  RUN_TEST(test_measure_after_edits_matches_fresh);
+  RUN_TEST(test_measure_of_unchanged_text_wraps_nothing);
+  RUN_TEST(test_fit_picks_the_largest_size_that_fits);
+  RUN_TEST(test_fit_uses_the_largest_size_for_a_short_message);
+  RUN_TEST(test_layout_lines_match_measure);
+  RUN_TEST(test_layout_auto_size_is_the_fitted_size);
+  return UNITY_END();
+}
@@ -0,0 +1,164 @@
+// Power policy and the deadlines loop() sleeps until, on a simulated clock:
+// loop() has no poll interval, so an idle device only wakes when the policy,
+// a connection or the serial port has a deadline
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+
+static PowerPolicy policy;
+
+void setUp() {
+  policy = PowerPolicy();
+}
+void tearDown() {}
+
+void test_active_until_the_window_passes() {
+  unsigned long now = 1000;
+  policy.onActivity(now);
+  policy.onRender(now);
+  TEST_ASSERT_EQUAL_INT(POWER_ACTIVE, policy.update(now, 0, false));
+  TEST_ASSERT_EQUAL_UINT32(POWER_ACTIVE_WINDOW, policy.untilChange(now));
+  now += POWER_ACTIVE_WINDOW - 1;
+  TEST_ASSERT_EQUAL_INT(POWER_ACTIVE, policy.update(now, 0, false));
+  TEST_ASSERT_EQUAL_UINT32(1, policy.untilChange(now));
+  now += 1;
+  TEST_ASSERT_EQUAL_INT(POWER_DOZE, policy.update(now, 0, false));
+  TEST_ASSERT_EQUAL_UINT32(80, policy.cpuMhz());
+}
+
+void test_stations_keep_it_idle_not_dozing() {
+  policy.onActivity(0);
+  TEST_ASSERT_EQUAL_INT(POWER_IDLE, policy.update(POWER_ACTIVE_WINDOW, 2, false));
+  TEST_ASSERT_EQUAL_INT(POWER_DOZE, policy.update(POWER_ACTIVE_WINDOW + 10, 0, false));
+}
+
+// A render in flight holds the state and has no deadline: its end wakes loop()
+void test_rendering_holds_active() {
+  policy.onActivity(0);
+  TEST_ASSERT_EQUAL_INT(POWER_ACTIVE, policy.update(POWER_ACTIVE_WINDOW * 3, 0, true));
+  TEST_ASSERT_EQUAL_UINT32(NO_DEADLINE, policy.untilChange(POWER_ACTIVE_WINDOW * 3));
+  TEST_ASSERT_FALSE(policy.shouldHibernate(POWER_ACTIVE_WINDOW * 3));
+  TEST_ASSERT_EQUAL_INT(POWER_DOZE, policy.update(POWER_ACTIVE_WINDOW * 3 + 1, 0, false));
+}
+
+void test_hibernates_once_after_the_last_render() {
+  policy.onRender(0);
+  policy.update(POWER_ACTIVE_WINDOW, 0, false);
+  TEST_ASSERT_EQUAL_UINT32(POWER_HIBERNATE_AFTER - POWER_ACTIVE_WINDOW, policy.untilChange(POWER_ACTIVE_WINDOW));
+  TEST_ASSERT_FALSE(policy.shouldHibernate(POWER_HIBERNATE_AFTER - 1));
+  TEST_ASSERT_TRUE(policy.shouldHibernate(POWER_HIBERNATE_AFTER));
+  TEST_ASSERT_FALSE(policy.shouldHibernate(POWER_HIBERNATE_AFTER + 1));
+  TEST_ASSERT_EQUAL_UINT32(NO_DEADLINE, policy.untilChange(POWER_HIBERNATE_AFTER));
+
+  // A render wakes the panel, the next hibernation counts from it
+  policy.onRender(100000);
+  TEST_ASSERT_FALSE(policy.shouldHibernate(100000 + POWER_HIBERNATE_AFTER - 1));
+  TEST_ASSERT_TRUE(policy.shouldHibernate(100000 + POWER_HIBERNATE_AFTER));
+}
+
+// Never while ACTIVE, however long ago the last render was
+void test_no_hibernation_while_active() {
+  policy.onActivity(POWER_HIBERNATE_AFTER * 2);
+  policy.update(POWER_HIBERNATE_AFTER * 2, 0, false);
+  TEST_ASSERT_FALSE(policy.shouldHibernate(POWER_HIBERNATE_AFTER * 2));
+}
+
+void test_wake_latency_is_measured_from_the_first_request() {
+  policy.update(POWER_ACTIVE_WINDOW, 0, false);
+  TEST_ASSERT_TRUE(policy.onActivity(10000));
+  TEST_ASSERT_FALSE(policy.onActivity(10005));
+  policy.onResponse(10040);
+  policy.onResponse(10100);
+  TEST_ASSERT_EQUAL_UINT32(40, policy.lastWakeLatency);
+  TEST_ASSERT_EQUAL_INT(POWER_DOZE, policy.wokeFrom);
+  TEST_ASSERT_EQUAL_UINT32(1, policy.wakeCount);
+}
+
+// Run loop()'s policy steps from one deadline to the next: after a message
+// an hour without traffic costs two wakeups, one to doze and one to hibernate
+void test_idle_hour_wakes_twice() {
+  unsigned long now = 0;
+  policy.onActivity(now);
+  policy.onRender(now);
+  int wakeups = 0;
+  int hibernations = 0;
+  for (;;) {
+    policy.update(now, 0, false);
+    if (policy.shouldHibernate(now)) hibernations++;
+    unsigned long wait = policy.untilChange(now);
+    if (wait == NO_DEADLINE || now + wait > 3600000UL) break;
+    TEST_ASSERT_GREATER_THAN(0, wait);
+    now += wait;
+    wakeups++;
+  }
+  TEST_ASSERT_EQUAL_INT(2, wakeups);
+  TEST_ASSERT_EQUAL_INT(1, hibernations);
+  TEST_ASSERT_EQUAL_INT(POWER_DOZE, policy.state);
+}
+
+static void handleHello() {
+  server.send(200, "text/plain", "hello");
+}
+
+// An open connection waits for its socket until it times out; a request that
+// already arrived behind the last one is work to do right away
+void test_web_server_deadlines() {
+  NetWaitSet set;
+  set.clear();
+  TEST_ASSERT_EQUAL_UINT32(NO_DEADLINE, server.waitSet(mockMillis, set));
+
+  std::shared_ptr<MockSocket> socket = mockConnect("GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+  server.handleClient();
+  set.clear();
+  TEST_ASSERT_EQUAL_UINT32(0, server.waitSet(mockMillis, set));  // The second request
+  server.handleClient();
+  set.clear();
+  TEST_ASSERT_EQUAL_UINT32(HTTP_IDLE_TIMEOUT + 1, server.waitSet(mockMillis, set));
+  TEST_ASSERT_TRUE(FD_ISSET(socket->fd, &set.readable));
+  TEST_ASSERT_FALSE(FD_ISSET(socket->fd, &set.writable));
+
+  // A response the client is slow to read waits for the socket to take more,
+  // its input is left alone until then
+  socket->sendWindow = 0;
+  socket->take();
+  socket->input = "GET / HTTP/1.1\r\n\r\n";
+  server.handleClient();
+  mockMillis += 100;
+  set.clear();
+  TEST_ASSERT_EQUAL_UINT32(HTTP_REQUEST_TIMEOUT + 1 - 100, server.waitSet(mockMillis, set));
+  TEST_ASSERT_TRUE(FD_ISSET(socket->fd, &set.writable));
+  TEST_ASSERT_FALSE(FD_ISSET(socket->fd, &set.readable));
+  socket->clientClosed = true;
+  mockMillis += HTTP_REQUEST_TIMEOUT + 1;
+  server.handleClient();
+  set.clear();
+  TEST_ASSERT_EQUAL_UINT32(NO_DEADLINE, server.waitSet(mockMillis, set));
+}
+
+void test_serial_deadlines() {
+  TEST_ASSERT_EQUAL_UINT32(NO_DEADLINE, serialUntilTimeout(mockMillis));
+  Serial.input.assign(1, (char)SERIAL_SYNC);
+  TEST_ASSERT_EQUAL_UINT32(0, serialUntilTimeout(mockMillis));
+  serialPoll(mockMillis);
+  TEST_ASSERT_EQUAL_UINT32(SERIAL_FRAME_TIMEOUT + 1, serialUntilTimeout(mockMillis));
+  mockMillis += SERIAL_FRAME_TIMEOUT + 1;
+  serialPoll(mockMillis);
+  TEST_ASSERT_EQUAL_UINT32(NO_DEADLINE, serialUntilTimeout(mockMillis));
+}
+
+int main(int argc, char** argv) {
+  mainLoopTask = xTaskGetCurrentTaskHandle();
+  server.on("/", handleHello);
+  server.begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_active_until_the_window_passes);
+  RUN_TEST(test_stations_keep_it_idle_not_dozing);
+  RUN_TEST(test_rendering_holds_active);
+  RUN_TEST(test_hibernates_once_after_the_last_render);
+  RUN_TEST(test_no_hibernation_while_active);
+  RUN_TEST(test_wake_latency_is_measured_from_the_first_request);
+  RUN_TEST(test_idle_hour_wakes_twice);
+  RUN_TEST(test_web_server_deadlines);
+  RUN_TEST(test_serial_deadlines);
+  return UNITY_END();
+}
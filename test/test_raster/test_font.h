@@ -0,0 +1,143 @@
+// A small fixed font for the golden images, so they don't change when the
+// generated FreeMonoBold fonts do: 5x9 cells drawn at twice the size, capitals,
+// digits, some punctuation and the Icelandic capitals; lower case letters are
+// drawn as capitals and anything else as an empty cell
+#pragma once
+#include <gfxfont.h>
+#include <string.h>
+
+#define TEST_FONT_SCALE 2
+#define TEST_FONT_FIRST 0x20
+#define TEST_FONT_LAST 0xFE
+
+// Seven rows of five, under two empty rows for an accent
+struct TestGlyphArt {
+  uint16_t codepoint;
+  const char* rows;
+};
+
+static const TestGlyphArt TEST_GLYPHS[] = {
+  { 'A',  ".###." "#...#" "#...#" "#####" "#...#" "#...#" "#...#" },
+  { 'B',  "####." "#...#" "#...#" "####." "#...#" "#...#" "####." },
+  { 'C',  ".###." "#...#" "#...." "#...." "#...." "#...#" ".###." },
+  { 'D',  "####." "#...#" "#...#" "#...#" "#...#" "#...#" "####." },
+  { 'E',  "#####" "#...." "#...." "####." "#...." "#...." "#####" },
+  { 'F',  "#####" "#...." "#...." "####." "#...." "#...." "#...." },
+  { 'G',  ".###." "#...#" "#...." "#.###" "#...#" "#...#" ".###." },
+  { 'H',  "#...#" "#...#" "#...#" "#####" "#...#" "#...#" "#...#" },
+  { 'I',  ".###." "..#.." "..#.." "..#.." "..#.." "..#.." ".###." },
+  { 'J',  "..###" "...#." "...#." "...#." "...#." "#..#." ".##.." },
+  { 'K',  "#...#" "#..#." "#.#.." "##..." "#.#.." "#..#." "#...#" },
+  { 'L',  "#...." "#...." "#...." "#...." "#...." "#...." "#####" },
+  { 'M',  "#...#" "##.##" "#.#.#" "#.#.#" "#...#" "#...#" "#...#" },
+  { 'N',  "#...#" "#...#" "##..#" "#.#.#" "#..##" "#...#" "#...#" },
+  { 'O',  ".###." "#...#" "#...#" "#...#" "#...#" "#...#" ".###." },
+  { 'P',  "####." "#...#" "#...#" "####." "#...." "#...." "#...." },
+  { 'Q',  ".###." "#...#" "#...#" "#...#" "#.#.#" "#..#." ".##.#" },
+  { 'R',  "####." "#...#" "#...#" "####." "#.#.." "#..#." "#...#" },
+  { 'S',  ".####" "#...." "#...." ".###." "....#" "....#" "####." },
+  { 'T',  "#####" "..#.." "..#.." "..#.." "..#.." "..#.." "..#.." },
+  { 'U',  "#...#" "#...#" "#...#" "#...#" "#...#" "#...#" ".###." },
+  { 'V',  "#...#" "#...#" "#...#" "#...#" "#...#" ".#.#." "..#.." },
+  { 'W',  "#...#" "#...#" "#...#" "#.#.#" "#.#.#" "#.#.#" ".#.#." },
+  { 'X',  "#...#" "#...#" ".#.#." "..#.." ".#.#." "#...#" "#...#" },
+  { 'Y',  "#...#" "#...#" ".#.#." "..#.." "..#.." "..#.." "..#.." },
+  { 'Z',  "#####" "....#" "...#." "..#.." ".#..." "#...." "#####" },
+  { '0',  ".###." "#...#" "#..##" "#.#.#" "##..#" "#...#" ".###." },
+  { '1',  "..#.." ".##.." "..#.." "..#.." "..#.." "..#.." ".###." },
+  { '2',  ".###." "#...#" "....#" "...#." "..#.." ".#..." "#####" },
+  { '3',  "#####" "...#." "..#.." "...#." "....#" "#...#" ".###." },
+  { '4',  "...#." "..##." ".#.#." "#..#." "#####" "...#." "...#." },
+  { '5',  "#####" "#...." "####." "....#" "....#" "#...#" ".###." },
+  { '6',  "..##." ".#..." "#...." "####." "#...#" "#...#" ".###." },
+  { '7',  "#####" "....#" "...#." "..#.." ".#..." ".#..." ".#..." },
+  { '8',  ".###." "#...#" "#...#" ".###." "#...#" "#...#" ".###." },
+  { '9',  ".###." "#...#" "#...#" ".####" "....#" "...#." ".##.." },
+  { '.',  "....." "....." "....." "....." "....." "....." "..#.." },
+  { ',',  "....." "....." "....." "....." "....." "..#.." ".#..." },
+  { '!',  "..#.." "..#.." "..#.." "..#.." "..#.." "....." "..#.." },
+  { '?',  ".###." "#...#" "....#" "...#." "..#.." "....." "..#.." },
+  { ':',  "....." "..#.." "....." "....." "....." "..#.." "....." },
+  { '-',  "....." "....." "....." "#####" "....." "....." "....." },
+  { '\'', "..#.." "..#.." "....." "....." "....." "....." "....." },
+  { '/',  "....#" "....#" "...#." "..#.." ".#..." "#...." "#...." },
+  { 0xDE, "#...." "####." "#...#" "#...#" "####." "#...." "#...." },  // Þ
+  { 0xC6, ".####" "#.#.." "#.#.." "#####" "#.#.." "#.#.." "#.###" },  // Æ
+  { 0xD0, "####." "#...#" "#...#" "###.#" "#...#" "#...#" "####." },  // Ð
+};
+
+// Capitals with an accent over them
+struct TestAccentArt {
+  uint16_t codepoint;
+  const char* accent;  // Two rows of five
+  char base;
+};
+
+static const TestAccentArt TEST_ACCENTS[] = {
+  { 0xC1, "...#." "..#..", 'A' },  // Á
+  { 0xC9, "...#." "..#..", 'E' },  // É
+  { 0xCD, "...#." "..#..", 'I' },  // Í
+  { 0xD3, "...#." "..#..", 'O' },  // Ó
+  { 0xDA, "...#." "..#..", 'U' },  // Ú
+  { 0xDD, "...#." "..#..", 'Y' },  // Ý
+  { 0xD6, ".#.#." ".....", 'O' },  // Ö
+};
+
+static uint8_t testFontBitmap[4096];
+static GFXglyph testFontGlyphs[TEST_FONT_LAST - TEST_FONT_FIRST + 1];
+static GFXfont testFont = {
+  testFontBitmap, testFontGlyphs, TEST_FONT_FIRST, TEST_FONT_LAST, 11 * TEST_FONT_SCALE
+};
+
+static const char* findTestArt(uint16_t codepoint) {
+  for (const TestGlyphArt &art : TEST_GLYPHS) {
+    if (art.codepoint == codepoint) return art.rows;
+  }
+  return NULL;
+}
+
+// Pack nine rows of art (accent rows first) into the bitmap at bit, scaled up
+static void packTestGlyph(const char* accent, const char* rows, uint32_t &bit) {
+  for (int row = 0; row < 9 * TEST_FONT_SCALE; row++) {
+    int r = row / TEST_FONT_SCALE;
+    const char* line = (r < 2) ? accent + r * 5 : rows + (r - 2) * 5;
+    for (int col = 0; col < 5 * TEST_FONT_SCALE; col++) {
+      if (line[col / TEST_FONT_SCALE] == '#') testFontBitmap[bit >> 3] |= 0x80 >> (bit & 7);
+      bit++;
+    }
+  }
+}
+
+static void buildTestFont() {
+  static const char blank[] = "..........";
+  memset(testFontBitmap, 0, sizeof(testFontBitmap));
+  uint32_t bit = 0;
+  for (uint16_t cp = TEST_FONT_FIRST; cp <= TEST_FONT_LAST; cp++) {
+    GFXglyph &glyph = testFontGlyphs[cp - TEST_FONT_FIRST];
+    memset(&glyph, 0, sizeof(glyph));
+    glyph.xAdvance = 6 * TEST_FONT_SCALE;
+    glyph.bitmapOffset = bit >> 3;
+
+    const char* accent = blank;
+    const char* rows = findTestArt(cp);
+    for (const TestAccentArt &art : TEST_ACCENTS) {
+      if (art.codepoint == cp) {
+        accent = art.accent;
+        rows = findTestArt(art.base);
+      }
+    }
+    if (rows == NULL) continue;
+    glyph.width = 5 * TEST_FONT_SCALE;
+    glyph.height = 9 * TEST_FONT_SCALE;
+    glyph.yOffset = -9 * TEST_FONT_SCALE;
+    packTestGlyph(accent, rows, bit);
+    bit = (bit + 7) & ~7u;
+  }
+
+  // Lower case letters, ASCII and Latin-1, share their capital's glyph
+  for (uint16_t cp = 'a'; cp <= TEST_FONT_LAST; cp++) {
+    bool lower = (cp <= 'z') || (cp >= 0xE0 && cp != 0xF7);
+    GFXglyph &glyph = testFontGlyphs[cp - TEST_FONT_FIRST];
+    if (lower && glyph.width == 0) glyph = testFontGlyphs[cp - 0x20 - TEST_FONT_FIRST];
+  }
+}
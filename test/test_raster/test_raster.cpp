@@ -0,0 +1,110 @@
+// Rendered screens against checked-in images: fixed messages and the QR screen
+// are drawn into the frame, fetched from /screen.pbm as a browser would get
+// them and compared byte for byte with the PBM files in golden/. The messages
+// use the font in test_font.h, not the generated ones.
+// UPDATE_GOLDEN=1 writes the images as they are now as the new golden files
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+#include "test_font.h"
+#include <fstream>
+#include <sstream>
+
+static std::string goldenDir() {
+  std::string file = __FILE__;
+  return file.substr(0, file.find_last_of('/') + 1) + "golden/";
+}
+
+// The frame as /screen.pbm sends it
+static std::string fetchScreen() {
+  std::shared_ptr<MockSocket> socket = mockConnect("GET /screen.pbm HTTP/1.1\r\nHost: x\r\n\r\n");
+  socket->clientClosed = true;
+  std::string response;
+  for (int i = 0; i < 100 && !socket->serverClosed; i++) {
+    server.handleClient();
+    mockMillis += 1;
+    response += socket->take();
+  }
+  TEST_ASSERT_EQUAL_INT(0, response.compare(0, 12, "HTTP/1.1 200"));
+  size_t end = response.find("\r\n\r\n");
+  TEST_ASSERT_TRUE(end != std::string::npos);
+  return response.substr(end + 4);
+}
+
+static void assertMatchesGolden(const char* name) {
+  std::string image = fetchScreen();
+  char header[24];
+  int headerLength = snprintf(header, sizeof(header), "P4\n%d %d\n", FRAME_WIDTH, FRAME_HEIGHT);
+  TEST_ASSERT_EQUAL_INT(headerLength + sizeof(frame.rows), image.size());
+  std::string path = goldenDir() + name;
+  const char* update = getenv("UPDATE_GOLDEN");
+  if (update != NULL && strcmp(update, "1") == 0) {
+    std::ofstream(path.c_str(), std::ios::binary) << image;
+  }
+  std::ifstream file(path.c_str(), std::ios::binary);
+  TEST_ASSERT_TRUE_MESSAGE(file.good(), path.c_str());
+  std::stringstream golden;
+  golden << file.rdbuf();
+  TEST_ASSERT_TRUE_MESSAGE(golden.str() == image, name);
+}
+
+// Lay out and draw a message in the test font, as updateDisplay() does
+static int drawMessage(const char* message) {
+  static TextLayout layout;
+  layout.textLength = handleUTF8(message, strlen(message), layout.text, MAX_TEXT_GLYPHS, &testFont);
+  layoutDecoded(layout, &testFont, 2);
+  return rasterizeLayout(frame, layout);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_short_message() {
+  TEST_ASSERT_EQUAL_INT(11, drawMessage("Hello World"));
+  assertMatchesGolden("short.pbm");
+}
+
+// Icelandic letters, lower case and upper case
+void test_icelandic_message() {
+  drawMessage("Þórður Ævar Íslandi: Ég sá Ýr í Ölfusá, ÐÁÚÉ!");
+  assertMatchesGolden("icelandic.pbm");
+}
+
+// Words wrap to new lines, newlines start one, and text below the panel is cut
+void test_wrapped_message() {
+  drawMessage("The quick brown fox jumps over the lazy dog, 0123456789 times.\n"
+              "A second paragraph after a newline, long enough to wrap again and again "
+              "and again until the lines run off the bottom of the panel, which is where "
+              "the layout stops and nothing more is drawn at all, not even this.");
+  assertMatchesGolden("wrapped.pbm");
+}
+
+// Anything the font has no glyph for, or broken UTF-8, is a question mark
+void test_replacement_glyphs() {
+  drawMessage("Euro \xE2\x82\xAC and a cut \xC3");
+  assertMatchesGolden("replacement.pbm");
+}
+
+void test_qr_screen() {
+  QRBitmap wifiQR, webQR;
+  const uint8_t wifiVersions[] = { 3, 2 };
+  const uint8_t webVersions[] = { 2 };
+  TEST_ASSERT_TRUE(generateQRBitmap("WIFI:T:WPA;S:Skilti;P:lykilord;;", wifiVersions, 2, wifiQR));
+  TEST_ASSERT_TRUE(generateQRBitmap("http://192.168.4.1", webVersions, 1, webQR));
+  TEST_ASSERT_GREATER_THAN(0, drawQRScreen(frame, wifiQR, webQR, &testFont));
+  assertMatchesGolden("qr.pbm");
+}
+
+int main(int argc, char** argv) {
+  buildTestFont();
+  startRenderTask();
+  server.on("/screen.pbm", handleScreen);
+  server.begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_short_message);
+  RUN_TEST(test_icelandic_message);
+  RUN_TEST(test_wrapped_message);
+  RUN_TEST(test_replacement_glyphs);
+  RUN_TEST(test_qr_screen);
+  return UNITY_END();
+}
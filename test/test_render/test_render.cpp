@@ -0,0 +1,61 @@
+// The render task on a thread of its own: a burst of submits collapses into
+// at most two refreshes, and the newest message is the one left on the panel
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+#include <thread>
+
+static const unsigned long WAIT_MS = 5000;
+
+// Wait until the render task finished the request with this sequence number
+static bool waitForRender(uint32_t sequence) {
+  for (unsigned long waited = 0; waited < WAIT_MS; waited++) {
+    if (renderedSequence == sequence) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_burst_of_submits_collapses_into_two_refreshes() {
+  // The first refresh is still running while the rest of the burst arrives
+  display.epd2.refreshMs = 200;
+  uint32_t refreshesBefore = display.epd2.refreshes;
+  uint32_t sequence = 0;
+  char message[32];
+  for (int i = 1; i <= 50; i++) {
+    snprintf(message, sizeof(message), "Message number %d", i);
+    sequence = showMessage(message, strlen(message), 2, false, millis());
+  }
+  TEST_ASSERT_TRUE(waitForRender(sequence));
+  TEST_ASSERT_LESS_OR_EQUAL(2, display.epd2.refreshes - refreshesBefore);
+  TEST_ASSERT_LESS_OR_EQUAL(2, renderCount);
+
+  // The last one submitted is on the panel
+  uint16_t expected[MAX_TEXT_GLYPHS];
+  int length = handleUTF8("Message number 50", 17, expected, MAX_TEXT_GLYPHS, getFont(2));
+  TEST_ASSERT_EQUAL_INT(length, lastLayout.textLength);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(expected, lastLayout.text, length);
+}
+
+// A request made while idle is drawn on its own
+void test_single_submit_is_rendered() {
+  display.epd2.refreshMs = 0;
+  uint32_t rendersBefore = renderCount;
+  uint32_t sequence = showMessage("Alone", 5, 2, false, millis());
+  TEST_ASSERT_TRUE(waitForRender(sequence));
+  TEST_ASSERT_EQUAL_UINT32(rendersBefore + 1, renderCount);
+}
+
+int main(int argc, char** argv) {
+  startLogTask();
+  startRenderTask();
+  std::thread render(renderTask, (void*)NULL);
+  render.detach();  // Blocks on the mailbox until the program exits
+  UNITY_BEGIN();
+  RUN_TEST(test_burst_of_submits_collapses_into_two_refreshes);
+  RUN_TEST(test_single_submit_is_rendered);
+  return UNITY_END();
+}
@@ -0,0 +1,192 @@
+// Serial control protocol: framing, CRC and the commands' replies
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+
+struct Reply {
+  uint8_t type;
+  uint8_t seq;
+  std::string payload;
+};
+
+static std::string encode(uint8_t type, uint8_t seq, const std::string &payload = std::string()) {
+  std::string out;
+  out += (char)SERIAL_SYNC;
+  out += (char)type;
+  out += (char)seq;
+  out += (char)(payload.size() & 0xFF);
+  out += (char)(payload.size() >> 8);
+  out += payload;
+  uint32_t crc = crc32_le(0, (const uint8_t*)out.data() + 1, out.size() - 1);
+  out.append((const char*)&crc, 4);
+  return out;
+}
+
+// Take the next frame the firmware sent, checking its framing
+static Reply reply() {
+  std::string &out = Serial.output;
+  TEST_ASSERT_TRUE(out.size() >= 9);
+  TEST_ASSERT_EQUAL_HEX8(SERIAL_SYNC, (uint8_t)out[0]);
+  size_t length = (uint8_t)out[3] | (uint8_t)out[4] << 8;
+  TEST_ASSERT_TRUE(out.size() >= 9 + length);
+  uint32_t crc;
+  memcpy(&crc, out.data() + 5 + length, 4);
+  TEST_ASSERT_EQUAL_HEX32(crc32_le(0, (const uint8_t*)out.data() + 1, 4 + length), crc);
+  Reply f = { (uint8_t)out[1], (uint8_t)out[2], out.substr(5, length) };
+  out.erase(0, 9 + length);
+  return f;
+}
+
+static void assertReply(uint8_t type, uint8_t seq, uint8_t status) {
+  Reply f = reply();
+  TEST_ASSERT_EQUAL_HEX8(type | SERIAL_REPLY, f.type);
+  TEST_ASSERT_EQUAL_UINT8(seq, f.seq);
+  TEST_ASSERT_TRUE(f.payload.size() >= 1);
+  TEST_ASSERT_EQUAL_UINT8(status, (uint8_t)f.payload[0]);
+}
+
+void setUp() {
+  Serial.input.clear();
+  Serial.output.clear();
+  serialFrameLength = 0;
+  serialFrames = 0;
+  serialBadFrames = 0;
+  serialBaud = SERIAL_DEFAULT_BAUD;
+  serialBaudChanged = 0;
+  Serial.begin(SERIAL_DEFAULT_BAUD);
+  mockMillis = 0;
+}
+void tearDown() {}
+
+// Bytes as tools/serial_client.py sends and expects them
+void test_hello_known_answer() {
+  const uint8_t hello[] = { 0xA5, 0x01, 0x07, 0x00, 0x00, 0xFC, 0xAE, 0xB7, 0x9C };
+  const uint8_t expected[] = { 0xA5, 0x81, 0x07, 0x08, 0x00, 0x00, 0x01, 0x00, 0x04,
+                               0x00, 0xC2, 0x01, 0x00, 0x8C, 0x6E, 0x9C, 0x62 };
+  Serial.input.assign((const char*)hello, sizeof(hello));
+  serialPoll(0);
+  TEST_ASSERT_EQUAL_INT(sizeof(expected), Serial.output.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected, Serial.output.data(), sizeof(expected));
+  TEST_ASSERT_EQUAL_UINT32(1, serialFrames);
+  TEST_ASSERT_TRUE(serialFramed);
+}
+
+void test_text_outside_frames_is_skipped() {
+  Serial.input = "help\r\n" + encode(SERIAL_HELLO, 1);
+  serialPoll(0);
+  assertReply(SERIAL_HELLO, 1, SERIAL_OK);
+  TEST_ASSERT_EQUAL_UINT32(0, serialBadFrames);
+}
+
+void test_frame_split_across_polls() {
+  std::string f = encode(SERIAL_HELLO, 2);
+  for (size_t i = 0; i < f.size(); i++) {
+    TEST_ASSERT_EQUAL_INT(0, Serial.output.size());
+    Serial.input += f[i];
+    serialPoll(i);
+  }
+  assertReply(SERIAL_HELLO, 2, SERIAL_OK);
+  TEST_ASSERT_FALSE(serialPending());
+}
+
+void test_bad_crc_is_answered_with_bad_frame() {
+  std::string f = encode(SERIAL_HELLO, 3, "x");
+  f[5] ^= 1;
+  Serial.input = f + encode(SERIAL_HELLO, 4);
+  serialPoll(0);
+  assertReply(SERIAL_HELLO, 3, SERIAL_BAD_FRAME);
+  assertReply(SERIAL_HELLO, 4, SERIAL_OK);
+  TEST_ASSERT_EQUAL_UINT32(1, serialBadFrames);
+}
+
+void test_oversized_length_resyncs_without_reply() {
+  std::string bogus = encode(SERIAL_HELLO, 5);
+  bogus[4] = (char)0xFF;  // 65280 + payload bytes
+  Serial.input = bogus.substr(0, 5) + encode(SERIAL_HELLO, 6);
+  serialPoll(0);
+  assertReply(SERIAL_HELLO, 6, SERIAL_OK);
+  TEST_ASSERT_EQUAL_INT(0, Serial.output.size());
+  TEST_ASSERT_EQUAL_UINT32(1, serialBadFrames);
+}
+
+void test_partial_frame_times_out() {
+  Serial.input = encode(SERIAL_HELLO, 7).substr(0, 6);
+  serialPoll(0);
+  TEST_ASSERT_TRUE(serialPending());
+  serialPoll(SERIAL_FRAME_TIMEOUT + 1);
+  TEST_ASSERT_FALSE(serialPending());
+  Serial.input = encode(SERIAL_HELLO, 8);
+  serialPoll(SERIAL_FRAME_TIMEOUT + 2);
+  assertReply(SERIAL_HELLO, 8, SERIAL_OK);
+}
+
+void test_unknown_command_and_bad_arguments() {
+  Serial.input = encode(0x55, 9) + encode(SERIAL_SET_FONT, 10, std::string(1, '\x09')) + encode(SERIAL_SET_MESSAGE, 11);
+  serialPoll(0);
+  assertReply(0x55, 9, SERIAL_BAD_COMMAND);
+  assertReply(SERIAL_SET_FONT, 10, SERIAL_BAD_ARGS);
+  assertReply(SERIAL_SET_MESSAGE, 11, SERIAL_BAD_ARGS);
+}
+
+void test_set_message_returns_its_render_sequence() {
+  std::string args("\x03\x00", 2);
+  Serial.input = encode(SERIAL_SET_MESSAGE, 12, args + "Serial hello");
+  serialPoll(0);
+  Reply f = reply();
+  TEST_ASSERT_EQUAL_UINT8(SERIAL_OK, (uint8_t)f.payload[0]);
+  uint32_t sequence;
+  TEST_ASSERT_EQUAL_INT(5, f.payload.size());
+  memcpy(&sequence, f.payload.data() + 1, 4);
+  TEST_ASSERT_EQUAL_UINT32(renderRequestCount, sequence);
+  TEST_ASSERT_EQUAL_STRING("Serial hello", displayMessage.c_str());
+  TEST_ASSERT_EQUAL_INT(3, fontSize);
+}
+
+static int baudChangesLocked;
+
+// Nothing else may write to the port while its rate changes
+static void checkTxLocked() {
+  if (uxSemaphoreGetCount(serialTxMutex) == 0) baudChangesLocked++;
+}
+
+void test_set_baud_replies_first_and_falls_back_without_frames() {
+  baudChangesLocked = 0;
+  Serial.onBaudRate = checkTxLocked;
+  uint32_t baud = 921600;
+  Serial.input = encode(SERIAL_SET_BAUD, 13, std::string((const char*)&baud, 4));
+  serialPoll(100);
+  assertReply(SERIAL_SET_BAUD, 13, SERIAL_OK);
+  TEST_ASSERT_EQUAL_UINT32(baud, Serial.baud);
+  TEST_ASSERT_EQUAL_UINT32(1, uxSemaphoreGetCount(serialTxMutex));  // Released again
+  serialPoll(100 + SERIAL_BAUD_CONFIRM + 1);
+  TEST_ASSERT_EQUAL_UINT32(SERIAL_DEFAULT_BAUD, Serial.baud);
+  TEST_ASSERT_EQUAL_UINT32(SERIAL_DEFAULT_BAUD, serialBaud);
+  TEST_ASSERT_EQUAL_INT(2, baudChangesLocked);
+  TEST_ASSERT_EQUAL_UINT32(1, uxSemaphoreGetCount(serialTxMutex));
+  Serial.onBaudRate = NULL;
+}
+
+void test_unsupported_baud_rate_is_refused() {
+  uint32_t baud = 12345;
+  Serial.input = encode(SERIAL_SET_BAUD, 14, std::string((const char*)&baud, 4));
+  serialPoll(0);
+  assertReply(SERIAL_SET_BAUD, 14, SERIAL_BAD_ARGS);
+  TEST_ASSERT_EQUAL_UINT32(SERIAL_DEFAULT_BAUD, Serial.baud);
+}
+
+int main(int argc, char** argv) {
+  startLogTask();
+  startRenderTask();
+  UNITY_BEGIN();
+  RUN_TEST(test_hello_known_answer);
+  RUN_TEST(test_text_outside_frames_is_skipped);
+  RUN_TEST(test_frame_split_across_polls);
+  RUN_TEST(test_bad_crc_is_answered_with_bad_frame);
+  RUN_TEST(test_oversized_length_resyncs_without_reply);
+  RUN_TEST(test_partial_frame_times_out);
+  RUN_TEST(test_unknown_command_and_bad_arguments);
+  RUN_TEST(test_set_message_returns_its_render_sequence);
+  RUN_TEST(test_set_baud_replies_first_and_falls_back_without_frames);
+  RUN_TEST(test_unsupported_baud_rate_is_refused);
+  return UNITY_END();
+}
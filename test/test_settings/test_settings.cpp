@@ -0,0 +1,127 @@
+// Settings record in NVS: one CRC-checked write for message and font size
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+
+static std::string &storedRecord() {
+  return mockPreferences["epaper/" SETTINGS_KEY];
+}
+
+// loadSettings() reads inside setupSettings()'s preferences.begin()
+static bool load() {
+  preferences.begin("epaper", true);
+  bool loaded = loadSettings();
+  preferences.end();
+  return loaded;
+}
+
+void setUp() {
+  mockPreferences.clear();
+  mockPreferenceWrites = 0;
+  settingsDirty = false;
+  settingsStoredCrc = 0;
+  settingsWrites = 0;
+  settingsWritesAvoided = 0;
+  displayMessage.assign("Hello World!");
+  fontSize = 2;
+}
+void tearDown() {}
+
+void test_record_layout_and_crc() {
+  displayMessage.assign("Hi");
+  fontSize = 3;
+  markSettingsDirty(0);
+  TEST_ASSERT_TRUE(flushSettings());
+  // version 1, font 3, 2 message bytes, CRC-32 (zlib's) over it all with the CRC field zeroed
+  const uint8_t expected[] = { 1, 0, 3, 0, 2, 0, 0, 0, 0x8D, 0x86, 0x11, 0x33, 'H', 'i' };
+  TEST_ASSERT_EQUAL_INT(sizeof(expected), storedRecord().size());
+  TEST_ASSERT_EQUAL_MEMORY(expected, storedRecord().data(), sizeof(expected));
+}
+
+void test_saved_settings_load_back() {
+  const char message[] = "\xC3\x9E" "etta er pr\xC3\xB3" "f";  // Þetta er próf
+  displayMessage.assign(message);
+  fontSize = FONT_SIZE_AUTO;
+  markSettingsDirty(0);
+  TEST_ASSERT_TRUE(flushSettings());
+  uint32_t crc = settingsStoredCrc;
+  displayMessage.assign("other");
+  fontSize = 1;
+  settingsStoredCrc = 0;
+  TEST_ASSERT_TRUE(load());
+  TEST_ASSERT_EQUAL_STRING(message, displayMessage.c_str());
+  TEST_ASSERT_EQUAL_INT(FONT_SIZE_AUTO, fontSize);
+  TEST_ASSERT_EQUAL_HEX32(crc, settingsStoredCrc);
+}
+
+void test_corrupted_record_is_ignored() {
+  markSettingsDirty(0);
+  TEST_ASSERT_TRUE(flushSettings());
+  storedRecord()[sizeof(SettingsHeader) + 1] ^= 0x20;
+  displayMessage.assign("kept");
+  TEST_ASSERT_FALSE(load());
+  TEST_ASSERT_EQUAL_STRING("kept", displayMessage.c_str());
+}
+
+void test_record_of_wrong_size_or_version_is_ignored() {
+  markSettingsDirty(0);
+  TEST_ASSERT_TRUE(flushSettings());
+  std::string record = storedRecord();
+  storedRecord().resize(record.size() - 1);
+  TEST_ASSERT_FALSE(load());
+  storedRecord() = record;
+  storedRecord()[0] = SETTINGS_VERSION + 1;
+  TEST_ASSERT_FALSE(load());
+  storedRecord().resize(sizeof(SettingsHeader) - 1);
+  TEST_ASSERT_FALSE(load());
+}
+
+void test_unchanged_settings_are_not_written_again() {
+  markSettingsDirty(0);
+  TEST_ASSERT_TRUE(flushSettings());
+  fontSize = 4;
+  markSettingsDirty(10);
+  fontSize = 2;
+  markSettingsDirty(20);
+  TEST_ASSERT_FALSE(flushSettings());
+  TEST_ASSERT_EQUAL_UINT32(1, mockPreferenceWrites);
+  TEST_ASSERT_EQUAL_UINT32(1, settingsWrites);
+  TEST_ASSERT_EQUAL_UINT32(2, settingsWritesAvoided);  // Folded into the flush, then the same as stored
+}
+
+void test_flush_waits_for_changes_to_settle() {
+  TEST_ASSERT_EQUAL_UINT32(ULONG_MAX, flushSettingsIfDue(0));
+  markSettingsDirty(1000);
+  TEST_ASSERT_EQUAL_UINT32(SETTINGS_FLUSH_DELAY - 500, flushSettingsIfDue(1500));
+  TEST_ASSERT_EQUAL_UINT32(0, mockPreferenceWrites);
+  TEST_ASSERT_EQUAL_UINT32(ULONG_MAX, flushSettingsIfDue(1000 + SETTINGS_FLUSH_DELAY));
+  TEST_ASSERT_EQUAL_UINT32(1, mockPreferenceWrites);
+}
+
+void test_legacy_keys_are_migrated() {
+  Preferences legacy;
+  legacy.begin("epaper", false);
+  legacy.putString("message", "Old message");
+  legacy.putInt("fontsize", 4);
+  legacy.end();
+  setupSettings();
+  TEST_ASSERT_EQUAL_STRING("Old message", displayMessage.c_str());
+  TEST_ASSERT_EQUAL_INT(4, fontSize);
+  TEST_ASSERT_EQUAL_INT(0, mockPreferences.count("epaper/message"));
+  TEST_ASSERT_EQUAL_INT(0, mockPreferences.count("epaper/fontsize"));
+  displayMessage.assign("other");
+  TEST_ASSERT_TRUE(load());
+  TEST_ASSERT_EQUAL_STRING("Old message", displayMessage.c_str());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_record_layout_and_crc);
+  RUN_TEST(test_saved_settings_load_back);
+  RUN_TEST(test_corrupted_record_is_ignored);
+  RUN_TEST(test_record_of_wrong_size_or_version_is_ignored);
+  RUN_TEST(test_unchanged_settings_are_not_written_again);
+  RUN_TEST(test_flush_waits_for_changes_to_settle);
+  RUN_TEST(test_legacy_keys_are_migrated);
+  return UNITY_END();
+}
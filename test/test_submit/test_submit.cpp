@@ -0,0 +1,60 @@
+// Allocations on the message path: a submit (showMessage, shared by the form,
+// the update API and the serial protocol) and the render task drawing it
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+#include "mock_alloc.h"
+
+static RenderRequest request;
+
+// Submit a message and draw it like the render task would
+static void submit(const char* message, int size) {
+  display.epd2.writes.clear();  // The mock's record, its capacity is kept
+  showMessage(message, strlen(message), size, false, millis());
+  TEST_ASSERT_TRUE(xQueueReceive(renderMailbox, &request, 0));
+  processRenderRequest(request);
+}
+
+void setUp() {
+  // First use of the function statics and the fonts
+  submit("warm up", 2);
+}
+void tearDown() {}
+
+void test_submit_and_render_allocate_nothing() {
+  const char* messages[] = {
+    "Hello World!",
+    "  Halló heimur! Þetta er prófun á skjánum með íslenskum stöfum: á é í ó ú ý þ æ ö ð.  ",
+    "Halló heimur! Þetta er prófun á skjánum með íslenskum stöfum: á é í ó ú ý þ æ ö ð. "
+    "The quick brown fox jumps over the lazy dog while the panel waits for its next refresh.",
+    "",
+  };
+  unsigned long before = mockAllocs;
+  for (int round = 0; round < 3; round++) {
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+      submit(messages[i], (int)(i % FONT_SIZE_AUTO) + 1);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, mockAllocs - before);
+  TEST_ASSERT_EQUAL_UINT32(renderRequestCount, renderedSequence);
+}
+
+// A submit on its own, and one replacing a request not drawn yet
+void test_queueing_allocates_nothing() {
+  unsigned long before = mockAllocs;
+  showMessage("first", 5, 2, false, millis());
+  showMessage("second", 6, 3, true, millis());
+  TEST_ASSERT_EQUAL_UINT32(0, mockAllocs - before);
+  TEST_ASSERT_TRUE(xQueueReceive(renderMailbox, &request, 0));
+  TEST_ASSERT_EQUAL_STRING("second", request.message);
+}
+
+int main(int argc, char** argv) {
+  startLogTask();
+  startRenderTask();
+  display.epd2.writes.reserve(64);
+  UNITY_BEGIN();
+  RUN_TEST(test_submit_and_render_allocate_nothing);
+  RUN_TEST(test_queueing_allocates_nothing);
+  return UNITY_END();
+}
@@ -0,0 +1,104 @@
+// UTF-8 decoding into the display font's codepoints (handleUTF8)
+#include <unity.h>
+#include "main.cpp"
+#include "mock_runtime.h"
+
+static uint16_t out[MAX_TEXT_GLYPHS];
+
+static int decode(const char* text, size_t length, int maxLength = MAX_TEXT_GLYPHS) {
+  return handleUTF8(text, length, out, maxLength, &FreeMonoBoldLatin9pt);
+}
+
+static void assertDecoded(const char* expected, int count) {
+  TEST_ASSERT_EQUAL_INT(strlen(expected), count);
+  for (int i = 0; i < count; i++) TEST_ASSERT_EQUAL_UINT16((uint8_t)expected[i], out[i]);
+}
+
+// Nothing but replacement glyphs
+static void assertReplaced(int count) {
+  TEST_ASSERT_GREATER_THAN(0, count);
+  for (int i = 0; i < count; i++) TEST_ASSERT_EQUAL_UINT16(REPLACEMENT_GLYPH, out[i]);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_ascii_passes_through() {
+  assertDecoded("Hello World!", decode("Hello World!", 12));
+}
+
+void test_icelandic_letters_decode_to_latin1() {
+  const char text[] = "\xC3\xBE\xC3\xB0\xC3\x86\xC3\xB6";  // þðÆö
+  TEST_ASSERT_EQUAL_INT(4, decode(text, sizeof(text) - 1));
+  TEST_ASSERT_EQUAL_UINT16(0xFE, out[0]);
+  TEST_ASSERT_EQUAL_UINT16(0xF0, out[1]);
+  TEST_ASSERT_EQUAL_UINT16(0xC6, out[2]);
+  TEST_ASSERT_EQUAL_UINT16(0xF6, out[3]);
+}
+
+void test_latin_extended_a_is_kept() {
+  const char text[] = "\xC5\x91\xC5\xBF";  // U+0151, U+017F, the last glyph
+  TEST_ASSERT_EQUAL_INT(2, decode(text, sizeof(text) - 1));
+  TEST_ASSERT_EQUAL_UINT16(0x151, out[0]);
+  TEST_ASSERT_EQUAL_UINT16(0x17F, out[1]);
+}
+
+void test_codepoints_outside_the_font_are_replaced() {
+  const char text[] = "5\xE2\x82\xAC \xF0\x9F\x98\x80";  // 5€ and an emoji
+  assertDecoded("5? ?", decode(text, sizeof(text) - 1));
+}
+
+void test_never_valid_byte_is_replaced_once() {
+  assertDecoded("ab?cd", decode("ab\xC0" "cd", 5));
+  assertDecoded("ab??cd", decode("ab\xFF\xF5" "cd", 6));
+}
+
+void test_broken_sequence_keeps_the_byte_that_broke_it() {
+  assertDecoded("a?b", decode("a\xC3" "b", 3));
+  assertDecoded("a?b", decode("a\xE2\x82" "b", 4));
+  const char text[] = "\xC3\xC3\xA1";  // Lead byte, then a complete á
+  TEST_ASSERT_EQUAL_INT(2, decode(text, sizeof(text) - 1));
+  TEST_ASSERT_EQUAL_UINT16('?', out[0]);
+  TEST_ASSERT_EQUAL_UINT16(0xE1, out[1]);
+}
+
+void test_stray_continuation_byte_is_replaced() {
+  assertDecoded("a?b", decode("a\x80" "b", 3));
+}
+
+void test_overlong_and_surrogate_encodings_are_rejected() {
+  assertReplaced(decode("\xE0\x80\xAF", 3));  // Overlong '/'
+  assertReplaced(decode("\xED\xA0\x80", 3));  // UTF-16 surrogate
+}
+
+void test_truncated_sequence_at_the_end_is_replaced() {
+  assertDecoded("x?", decode("x\xC3", 2));
+  assertDecoded("x?", decode("x\xF0\x9F\x98", 4));
+}
+
+void test_tabs_become_spaces_and_other_controls_are_dropped() {
+  assertDecoded("a b\nc\r\nd", decode("a\tb\x01\nc\r\n\x1B" "d", 10));
+}
+
+void test_output_stops_at_max_length() {
+  char text[MAX_TEXT_GLYPHS + 10];
+  memset(text, 'x', sizeof(text));
+  TEST_ASSERT_EQUAL_INT(MAX_TEXT_GLYPHS, decode(text, sizeof(text)));
+  TEST_ASSERT_EQUAL_INT(3, decode("ab\xC0" "cd", 5, 3));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ascii_passes_through);
+  RUN_TEST(test_icelandic_letters_decode_to_latin1);
+  RUN_TEST(test_latin_extended_a_is_kept);
+  RUN_TEST(test_codepoints_outside_the_font_are_replaced);
+  RUN_TEST(test_never_valid_byte_is_replaced_once);
+  RUN_TEST(test_broken_sequence_keeps_the_byte_that_broke_it);
+  RUN_TEST(test_stray_continuation_byte_is_replaced);
+  RUN_TEST(test_overlong_and_surrogate_encodings_are_rejected);
+  RUN_TEST(test_truncated_sequence_at_the_end_is_replaced);
+  RUN_TEST(test_tabs_become_spaces_and_other_controls_are_dropped);
+  RUN_TEST(test_output_stops_at_max_length);
+  return UNITY_END();
+}
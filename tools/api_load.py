@@ -0,0 +1,209 @@
+"""
+Load generator for the /api/v1/display update API.
+
+Sends a number of API requests (JSON or binary, optionally batching several
+show operations per request) and reports round-trip latency and throughput.
+Each worker keeps its connection alive across requests, as the firmware's web
+server does; --no-keepalive opens a new one for every request instead.
+
+Against a device on its access point:
+
+    python tools/api_load.py --host 192.168.4.1 -n 200 --batch 4 --binary
+
+Against a local stand-in server that parses the same formats, for trying the
+tool or comparing numbers without hardware:
+
+    python tools/api_load.py --stand-in -n 1000 -c 4
+"""
+import argparse
+import http.client
+import http.server
+import json
+import socket
+import statistics
+import struct
+import threading
+import time
+
+PATH = '/api/v1/display'
+BINARY_VERSION = 1
+OP_SHOW = 1
+OP_NAMES = {'show': 1, 'playlist_add': 2, 'playlist_clear': 3, 'playlist_start': 4, 'playlist_stop': 5}
+
+
+# --- Request bodies ----------------------------------------------------------
+
+def json_body(messages, font):
+    ops = [{'op': 'show', 'message': m, 'font': font} for m in messages]
+    doc = ops[0] if len(ops) == 1 else {'ops': ops}
+    return json.dumps(doc, ensure_ascii=False, separators=(',', ':')).encode('utf-8'), 'application/json'
+
+
+def binary_body(messages, font):
+    body = bytearray([BINARY_VERSION, len(messages)])
+    for m in messages:
+        data = m.encode('utf-8')
+        body += struct.pack('<BBBHH', OP_SHOW, font, 0, 0, len(data)) + data
+    return bytes(body), 'application/octet-stream'
+
+
+def parse_reply(binary, data):
+    if binary:
+        status, applied, seq = struct.unpack('<BBI', data[:6])
+        return status == 0, applied, seq
+    reply = json.loads(data)
+    return reply['ok'], reply['applied'], reply['seq']
+
+
+# --- Local stand-in server ---------------------------------------------------
+
+class StandIn(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'  # Keep-alive, like the firmware
+    disable_nagle_algorithm = True
+    """Answers like the firmware: applies nothing, counts render sequences."""
+    sequence = 0
+    lock = threading.Lock()
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        binary = body[:1] == bytes([BINARY_VERSION])
+        try:
+            applied = self.count_binary(body) if binary else self.count_json(body)
+            ok, error = True, None
+        except (ValueError, KeyError, struct.error) as e:
+            applied, ok, error = 0, False, str(e)
+        with StandIn.lock:
+            StandIn.sequence += applied
+            seq = StandIn.sequence
+        if binary:
+            reply, kind = struct.pack('<BBI', 0 if ok else 1, applied, seq), 'application/octet-stream'
+        else:
+            reply = {'ok': ok, 'applied': applied, 'seq': seq}
+            if error:
+                reply['error'] = error
+            reply = json.dumps(reply, separators=(',', ':')).encode()
+            kind = 'application/json'
+        self.send_response(200 if ok else 400)
+        self.send_header('Content-Type', kind)
+        self.send_header('Content-Length', str(len(reply)))
+        self.end_headers()
+        self.wfile.write(reply)
+
+    @staticmethod
+    def count_json(body):
+        doc = json.loads(body)
+        if not isinstance(doc, dict):
+            raise ValueError('body is not a JSON object')
+        ops = doc.get('ops', [doc])
+        for op in ops:
+            if not isinstance(op, dict):
+                raise ValueError('operation is not an object')
+            name = op.get('op', 'show')
+            if name not in OP_NAMES:
+                raise ValueError('unknown op')
+            if name in ('show', 'playlist_add') and not isinstance(op.get('message'), str):
+                raise ValueError('message missing')
+        return len(ops)
+
+    @staticmethod
+    def count_binary(body):
+        count, pos = body[1], 2
+        for _ in range(count):
+            _, _, _, _, length = struct.unpack_from('<BBBHH', body, pos)
+            pos += 7 + length
+            if pos > len(body):
+                raise ValueError('truncated')
+        return count
+
+    def log_message(self, *args):
+        pass
+
+
+def start_stand_in():
+    server = http.server.ThreadingHTTPServer(('127.0.0.1', 0), StandIn)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+# --- Load generation ---------------------------------------------------------
+
+def worker(args, count, latencies, failures):
+    conn = None
+    for i in range(count):
+        messages = ['%s %d.%d' % (args.message, i, j) for j in range(args.batch)]
+        body, kind = (binary_body if args.binary else json_body)(messages, args.font)
+        start = time.perf_counter()
+        try:
+            if conn is None:
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+                conn.connect()
+                # Head and body go out as two writes, Nagle would hold the body for the head's ACK
+                conn.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            conn.request('POST', PATH, body, {'Content-Type': kind})
+            response = conn.getresponse()
+            ok, _, _ = parse_reply(args.binary, response.read())
+            if args.no_keepalive or response.getheader('Connection', '').lower() == 'close':
+                conn.close()
+                conn = None
+        except (OSError, ValueError, struct.error, http.client.HTTPException):
+            ok = False
+            if conn is not None:
+                conn.close()
+                conn = None
+        elapsed = time.perf_counter() - start
+        if ok and response.status == 200:
+            latencies.append(elapsed)
+        else:
+            failures.append(elapsed)
+    if conn is not None:
+        conn.close()
+
+
+def percentile(values, fraction):
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host', default='192.168.4.1')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('--stand-in', action='store_true', help='run against a local stand-in server')
+    parser.add_argument('-n', '--requests', type=int, default=100)
+    parser.add_argument('-c', '--concurrency', type=int, default=1)
+    parser.add_argument('--batch', type=int, default=1, help='show operations per request (max 16)')
+    parser.add_argument('--binary', action='store_true', help='binary bodies instead of JSON')
+    parser.add_argument('--font', type=int, default=2)
+    parser.add_argument('--message', default='Halló heimur')
+    parser.add_argument('--timeout', type=float, default=10)
+    parser.add_argument('--no-keepalive', action='store_true', help='a new connection for every request')
+    args = parser.parse_args()
+
+    if args.stand_in:
+        server = start_stand_in()
+        args.host, args.port = server.server_address
+
+    latencies, failures = [], []
+    per_worker = [args.requests // args.concurrency + (i < args.requests % args.concurrency)
+                  for i in range(args.concurrency)]
+    threads = [threading.Thread(target=worker, args=(args, n, latencies, failures)) for n in per_worker]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    wall = time.perf_counter() - start
+
+    print('%d requests (%s, %d op%s each), %d connections, %d failed'
+          % (args.requests, 'binary' if args.binary else 'JSON', args.batch, 's' if args.batch > 1 else '',
+             args.concurrency, len(failures)))
+    if latencies:
+        latencies.sort()
+        ms = [v * 1000 for v in latencies]
+        print('round trip ms: min %.1f  median %.1f  p95 %.1f  max %.1f'
+              % (ms[0], statistics.median(ms), percentile(ms, 0.95), ms[-1]))
+        print('throughput: %.1f requests/s, %.1f ops/s'
+              % (len(latencies) / wall, len(latencies) * args.batch / wall))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,528 @@
+"""
+Generate extended FreeMonoBold fonts with precomposed Latin-1 and
+Latin Extended-A glyphs (U+0020..U+017F) at 9, 12, 18 and 24 pt.
+
+The source fonts are the Adafruit GFX FreeMonoBold*pt7b.h headers. Accented
+letters are composed from the base letter and a diacritic mark drawn to match
+the font's stroke width, using the decompositions from Python's unicodedata.
+Letters without a decomposition (þ, ð, æ, ø, ...) have their own recipes.
+
+Runs as a PlatformIO extra script (see platformio.ini) and writes
+FreeMonoBoldLatin<N>pt.h into the build directory, plus the same fonts as
+files for LittleFS in data/fonts/mono-<N>.epf (the format is described above
+FontFace in src/main.cpp; not for the native test environment), or by hand:
+
+    python tools/gen_fonts.py <Adafruit GFX Fonts dir> <header dir> [<data dir>]
+"""
+import glob
+import os
+import re
+import struct
+import sys
+import unicodedata
+
+SIZES = (9, 12, 18, 24)
+FIRST = 0x20
+LAST = 0x17F
+FAMILY = 'mono'
+GLYPH_CACHE_BYTES = 160  # Slot size of the firmware's glyph cache
+
+
+# --- Reading Adafruit GFX fonts ---------------------------------------------
+
+def parse_font(path):
+    text = re.sub(r'//[^\n]*', '', open(path).read())
+    bitmaps = re.search(r'Bitmaps\[\]\s*PROGMEM\s*=\s*\{(.*?)\}\s*;', text, re.S).group(1)
+    bitmap = [int(b, 16) for b in re.findall(r'0x[0-9A-Fa-f]+', bitmaps)]
+    glyph_block = re.search(r'Glyphs\[\]\s*PROGMEM\s*=\s*\{(.*)\}\s*;\s*const\s+GFXfont', text, re.S).group(1)
+    entries = re.findall(r'\{\s*(-?\d+)\s*,\s*(-?\d+)\s*,\s*(-?\d+)\s*,\s*(-?\d+)\s*,\s*(-?\d+)\s*,\s*(-?\d+)\s*\}',
+                         glyph_block)
+    header = re.search(r'GFXglyph\s*\*\s*\)\s*\w+\s*,\s*(\w+)\s*,\s*(\w+)\s*,\s*(\w+)', text)
+    first, last, y_advance = (int(v, 0) for v in header.groups())
+    glyphs = {}
+    for i, entry in enumerate(entries):
+        offset, width, height, advance, x_offset, y_offset = (int(v) for v in entry)
+        pixels = set()
+        for bit in range(width * height):
+            byte = bitmap[offset + bit // 8]
+            if byte & (0x80 >> (bit % 8)):
+                pixels.add((x_offset + bit % width, y_offset + bit // width))
+        glyphs[first + i] = (frozenset(pixels), advance)
+    return glyphs, y_advance
+
+
+# --- Pixel set helpers (x right, y down, origin at the pen on the baseline) --
+
+def bbox(pixels):
+    xs = [x for x, _ in pixels]
+    ys = [y for _, y in pixels]
+    return min(xs), min(ys), max(xs), max(ys)
+
+
+def shift(pixels, dx, dy):
+    return frozenset((x + dx, y + dy) for x, y in pixels)
+
+
+def scale(pixels, factor):
+    """Shrink around the origin, keeping the bold look by sampling blocks"""
+    return frozenset((int(round(x * factor)), int(round(y * factor))) for x, y in pixels)
+
+
+def rotate180(pixels):
+    x0, y0, x1, y1 = bbox(pixels)
+    return frozenset((x0 + x1 - x, y0 + y1 - y) for x, y in pixels)
+
+
+def mirror(pixels):
+    x0, _, x1, _ = bbox(pixels)
+    return frozenset((x0 + x1 - x, y) for x, y in pixels)
+
+
+def line(x0, y0, x1, y1, thickness):
+    """Bresenham line stamped with a square pen"""
+    points = set()
+    dx, dy = abs(x1 - x0), -abs(y1 - y0)
+    sx, sy = (1 if x0 < x1 else -1), (1 if y0 < y1 else -1)
+    err = dx + dy
+    while True:
+        for px in range(thickness):
+            for py in range(thickness):
+                points.add((x0 + px - thickness // 2, y0 + py - thickness // 2))
+        if x0 == x1 and y0 == y1:
+            break
+        e2 = 2 * err
+        if e2 >= dy:
+            err += dy
+            x0 += sx
+        if e2 <= dx:
+            err += dx
+            y0 += sy
+    return frozenset(points)
+
+
+def polyline(points, thickness):
+    result = frozenset()
+    for (xa, ya), (xb, yb) in zip(points, points[1:]):
+        result |= line(xa, ya, xb, yb, thickness)
+    return result
+
+
+def box(x0, y0, x1, y1):
+    return frozenset((x, y) for x in range(x0, x1 + 1) for y in range(y0, y1 + 1))
+
+
+# --- Composition -------------------------------------------------------------
+
+class Composer:
+    def __init__(self, glyphs):
+        self.glyphs = glyphs
+        self.advance = glyphs[ord('A')][1]
+        self.x_height = -bbox(self.pixels('x'))[1]
+        self.cap_height = -bbox(self.pixels('H'))[1]
+        self.descent = bbox(self.pixels('p'))[3]
+        # Stem width: the run of pixels across the middle of 'l'
+        l_pixels = self.pixels('l')
+        _, y0, _, y1 = bbox(l_pixels)
+        self.stem = max(1, len([p for p in l_pixels if p[1] == (y0 + y1) // 2]))
+        self.mark_pen = max(1, (self.stem * 2 + 2) // 3)
+        self.mark_width = max(3, int(round(self.advance * 0.45)))
+        self.mark_height = max(2, int(round(self.cap_height * 0.22)))
+
+    def pixels(self, ch):
+        return self.glyphs[ord(ch) if isinstance(ch, str) else ch][0]
+
+    # Diacritic marks, drawn with their bottom centre at (0, 0)
+    def mark(self, code, height):
+        w, h, t = self.mark_width, height, self.mark_pen
+        half = w // 2
+        dot = max(2, t)
+        if code == 0x0301:  # acute
+            return line(-w // 4, 0, w // 4, -h, t)
+        if code == 0x0300:  # grave
+            return line(w // 4, 0, -w // 4, -h, t)
+        if code == 0x0302:  # circumflex
+            return polyline([(-half, 0), (0, -h), (half, 0)], t)
+        if code == 0x030C:  # caron
+            return polyline([(-half, -h), (0, 0), (half, -h)], t)
+        if code == 0x0303:  # tilde
+            return polyline([(-half, -h // 3), (-w // 4, -h), (w // 4, 0), (half, -h * 2 // 3)], t)
+        if code == 0x0304:  # macron
+            return box(-half, -t + 1, half, 0)
+        if code == 0x0306:  # breve
+            return polyline([(-half, -h), (-w // 4, 0), (w // 4, 0), (half, -h)], t)
+        if code == 0x0307:  # dot above
+            return box(-dot // 2, -dot + 1, dot - dot // 2 - 1, 0)
+        if code == 0x0308:  # diaeresis
+            gap = max(dot, w // 3)
+            one = box(0, -dot + 1, dot - 1, 0)
+            return shift(one, -gap - dot // 2, 0) | shift(one, gap - dot // 2, 0)
+        if code == 0x030A:  # ring above
+            r = max(2, h // 2 + 1)
+            return polyline([(-r // 2, 0), (-r, -r // 2), (-r // 2, -r), (r // 2, -r), (r, -r // 2),
+                             (r // 2, 0), (-r // 2, 0)], max(1, t - 1))
+        if code == 0x030B:  # double acute
+            one = line(-w // 6, 0, w // 6, -h, t)
+            return shift(one, -w // 4, 0) | shift(one, w // 4, 0)
+        if code == 0x0327:  # cedilla, hangs below
+            return polyline([(0, 0), (0, h // 2), (w // 4, h // 2), (w // 4, h), (-w // 4, h)], t)
+        if code == 0x0328:  # ogonek, hangs below
+            return polyline([(0, 0), (-w // 4, h // 2), (-w // 8, h), (w // 4, h)], t)
+        raise KeyError(code)
+
+    def with_mark(self, base_char, code):
+        base = self.pixels(base_char)
+        upper = base_char.isupper()
+        if base_char in 'ij' and code not in (0x0327, 0x0328):
+            base = self.dotless(base)
+        x0, y0, x1, y1 = bbox(base)
+        center = (x0 + x1 + 1) // 2
+        if code == 0x030C and base_char in 'dltL':
+            # Caron on tall letters is written as an apostrophe after the letter
+            tick = line(0, 0, -self.mark_pen, self.mark_height, self.mark_pen)
+            return base | shift(tick, x1 + self.mark_pen + 1, -self.cap_height)
+        if code == 0x0327:
+            return base | shift(self.mark(code, self.mark_height), center, y1 + 1)
+        if code == 0x0328:
+            return base | shift(self.mark(code, self.mark_height), x1 - self.mark_pen, y1 + 1)
+        # Capitals get flatter marks so the line spacing does not grow as much
+        height = max(2, self.mark_height * 2 // 3) if upper else self.mark_height
+        gap = 1 if upper else max(1, self.stem // 2)
+        return base | shift(self.mark(code, height), center, y0 - gap - 1)
+
+    def dotless(self, pixels):
+        return frozenset(p for p in pixels if p[1] >= -self.x_height - 1)
+
+    def pair(self, left, right):
+        """Squeeze two glyphs into one cell (ligatures like Æ or ĳ)"""
+        a, b = self.pixels(left), self.pixels(right)
+        squeezed = lambda p: frozenset((x // 2, y) for x, y in p)
+        a, b = squeezed(a), squeezed(b)
+        ax0, _, ax1, _ = bbox(a)
+        bx0, _, _, _ = bbox(b)
+        b = shift(b, ax1 - bx0 + 1 - self.stem // 2, 0)
+        x0, _, x1, _ = bbox(a | b)
+        return shift(a | b, (self.advance - (x1 - x0 + 1)) // 2 - x0, 0)
+
+    def superscript(self, ch):
+        small = scale(self.pixels(ch), 0.55)
+        x0, y0, x1, _ = bbox(small)
+        return shift(small, (self.advance - (x1 - x0 + 1)) // 2 - x0, -self.cap_height - y0)
+
+    def fraction(self, numerator, denominator):
+        num = scale(self.pixels(numerator), 0.5)
+        den = scale(self.pixels(denominator), 0.5)
+        x0, y0, _, _ = bbox(num)
+        num = shift(num, -x0, -self.cap_height - y0)
+        x0, _, x1, y1 = bbox(den)
+        den = shift(den, self.advance - 1 - x1, -y1)
+        slash = line(self.advance - 2, -self.cap_height, 1, 0, max(1, self.stem // 2))
+        return num | den | slash
+
+    def centered(self, pixels, y_center):
+        x0, y0, x1, y1 = bbox(pixels)
+        return shift(pixels, (self.advance - (x1 + x0 + 1)) // 2, y_center - (y0 + y1) // 2)
+
+    def bar(self, pixels, y, x_from=None, x_to=None):
+        x0, _, x1, _ = bbox(pixels)
+        x_from = x0 if x_from is None else x_from
+        x_to = x1 if x_to is None else x_to
+        return pixels | box(x_from, y - self.stem // 2, x_to, y - self.stem // 2 + max(1, self.stem * 2 // 3) - 1)
+
+    def slashed(self, pixels):
+        x0, y0, x1, y1 = bbox(pixels)
+        return pixels | line(x0, y1, x1, y0, max(1, self.stem // 2))
+
+    def special(self, code):
+        t = self.stem
+        xh, cap = self.x_height, self.cap_height
+        P = self.pixels
+        if code == 0xA0:
+            return frozenset()
+        if code in (0xA1, 0xBF):  # ¡ ¿
+            flipped = rotate180(P('!' if code == 0xA1 else '?'))
+            return shift(flipped, 0, -xh - bbox(flipped)[1])
+        if code == 0xA2:  # ¢
+            x0, _, x1, _ = bbox(P('c'))
+            c = (x0 + x1) // 2
+            return P('c') | box(c, -xh - t, c + max(1, t // 2) - 1, t)
+        if code == 0xA3:  # £
+            return self.bar(P('L'), -cap // 2)
+        if code == 0xA4:  # ¤
+            return self.centered(scale(P('o') | P('x'), 0.8), -xh // 2)
+        if code == 0xA5:  # ¥
+            return self.bar(self.bar(P('Y'), -cap // 3), -cap // 3 + t + 1)
+        if code == 0xA6:  # ¦
+            bar_pixels = P('|')
+            _, y0, _, y1 = bbox(bar_pixels)
+            middle = (y0 + y1) // 2
+            return frozenset(p for p in bar_pixels if abs(p[1] - middle) > t)
+        if code == 0xA7:  # §
+            s = scale(P('S'), 0.6)
+            return self.centered(s | shift(s, 0, bbox(s)[3] - bbox(s)[1] - t), -cap // 2)
+        if code == 0xA9:  # ©
+            return P('O') | self.centered(scale(P('c'), 0.6), -cap // 2)
+        if code == 0xAE:  # ®
+            return P('O') | self.centered(scale(P('R'), 0.5), -cap // 2)
+        if code in (0xAB, 0xBB):  # « »
+            return self.pair('<', '<') if code == 0xAB else self.pair('>', '>')
+        if code == 0xAC:  # ¬
+            x0, _, x1, _ = bbox(P('-'))
+            y = -xh // 2
+            return box(x0, y - t // 2, x1, y - t // 2 + t - 1) | box(x1 - t + 1, y, x1, y + xh // 3)
+        if code == 0xAD:  # soft hyphen
+            return P('-')
+        if code in (0xA8, 0xAF, 0xB4):  # ¨ ¯ ´ on their own
+            mark_code = {0xA8: 0x0308, 0xAF: 0x0304, 0xB4: 0x0301}[code]
+            return shift(self.mark(mark_code, self.mark_height), self.advance // 2, -xh - t - 1)
+        if code == 0xB8:  # ¸ on its own
+            return shift(self.mark(0x0327, self.mark_height), self.advance // 2, 1)
+        if code == 0xB0:  # °
+            return shift(self.mark(0x030A, self.mark_height + 1), self.advance // 2, -cap + self.mark_height)
+        if code == 0xB1:  # ±
+            plus = P('+')
+            x0, _, x1, y1 = bbox(plus)
+            return plus | box(x0, y1 + t, x1, y1 + 2 * t - 1)
+        if code == 0xB5:  # µ
+            x0, _, _, _ = bbox(P('u'))
+            return P('u') | box(x0, 0, x0 + t - 1, self.descent)
+        if code == 0xB6:  # ¶
+            return mirror(P('P'))
+        if code == 0xB7:  # ·
+            d = max(2, t)
+            return shift(box(0, 0, d - 1, d - 1), (self.advance - d) // 2, -xh // 2 - d // 2)
+        if code in (0xAA, 0xB2, 0xB3, 0xB9, 0xBA):  # ª ² ³ ¹ º
+            return self.superscript({0xAA: 'a', 0xB2: '2', 0xB3: '3', 0xB9: '1', 0xBA: 'o'}[code])
+        if code in (0xBC, 0xBD, 0xBE):  # ¼ ½ ¾
+            return self.fraction(*{0xBC: '14', 0xBD: '12', 0xBE: '34'}[code])
+        if code == 0xC6:
+            return self.pair('A', 'E')
+        if code == 0xE6:
+            return self.pair('a', 'e')
+        if code == 0x152:
+            return self.pair('O', 'E')
+        if code == 0x153:
+            return self.pair('o', 'e')
+        if code == 0x132:
+            return self.pair('I', 'J')
+        if code == 0x133:
+            return self.pair('i', 'j')
+        if code == 0x149:  # ŉ
+            return self.pair("'", 'n')
+        if code in (0xD0, 0x110):  # Ð Đ
+            x0, _, _, _ = bbox(P('D'))
+            return self.bar(P('D'), -cap // 2, x0 - t // 2, x0 + self.advance // 3)
+        if code == 0x111:  # đ
+            _, y0, x1, _ = bbox(P('d'))
+            return self.bar(P('d'), (y0 - xh) // 2, x1 - self.advance // 3, x1)
+        if code == 0xD7:  # ×
+            return self.centered(scale(P('x'), 0.75), -xh // 2)
+        if code == 0xF7:  # ÷
+            d = max(2, t)
+            dot = box(0, 0, d - 1, d - 1)
+            minus = P('-')
+            x0, y0, x1, y1 = bbox(minus)
+            cx = (x0 + x1) // 2 - d // 2
+            return minus | shift(dot, cx, y0 - d - t) | shift(dot, cx, y1 + t + 1)
+        if code in (0xD8, 0xF8):  # Ø ø
+            return self.slashed(P('O' if code == 0xD8 else 'o'))
+        if code == 0xDE:  # Þ: the P bowl lowered with the stem kept full height
+            p = P('P')
+            x0, y0, _, y1 = bbox(p)
+            stem = box(x0, y0, x0 + t - 1 + (t // 2), y1)
+            bowl = frozenset(q for q in shift(p, 0, (y1 - y0) // 5) if q[1] <= y1)
+            return stem | bowl
+        if code == 0xFE:  # þ: stem of b with the bowl and descender of p
+            return P('b') | P('p')
+        if code == 0xDF:  # ß: a stem rising into an arch, closed on the right by two bowls
+            x0, _, x1, _ = bbox(P('o'))
+            left, right = x0 + t // 2, x1 - t // 2
+            w = right - left
+            waist = -cap * 9 // 20
+            return polyline([(left, 0), (left, -cap + w // 3), (left + w // 3, -cap), (right - w // 3, -cap),
+                             (right, -cap + w // 4), (right, waist - w // 4), (left + w // 2, waist),
+                             (right, waist + w // 4), (right, -w // 4), (right - w // 3, 0),
+                             (left + w // 2, 0)], t)
+        if code == 0xF0:  # ð: o with a crossed, leaning ascender
+            o = P('o')
+            x0, y0, x1, _ = bbox(o)
+            top = -cap
+            ascender = line((x0 + x1) // 2, y0, x1 - t // 2, top, t)
+            cross = line((x0 + x1) // 2 - t, (top + y0) // 2 + t, x1 + 1, (top + y0) // 2 - t, max(1, t // 2))
+            return o | ascender | cross
+        if code == 0x126:  # Ħ
+            return self.bar(P('H'), -cap * 3 // 4)
+        if code == 0x127:  # ħ
+            x0, y0, _, _ = bbox(P('h'))
+            return self.bar(P('h'), (y0 - xh) // 2, x0 - t // 2, x0 + self.advance // 3)
+        if code == 0x131:  # ı
+            return self.dotless(P('i'))
+        if code == 0x138:  # ĸ
+            return frozenset(p for p in P('k') if p[1] >= -xh - 1)
+        if code in (0x13F, 0x140):  # Ŀ ŀ
+            base = P('L' if code == 0x13F else 'l')
+            d = max(2, t)
+            _, _, x1, _ = bbox(base)
+            return base | shift(box(0, 0, d - 1, d - 1), min(self.advance - d, x1 - d), -cap // 2)
+        if code in (0x141, 0x142):  # Ł ł
+            base = P('L' if code == 0x141 else 'l')
+            x0, y0, x1, y1 = bbox(base)
+            middle = (y0 + y1) // 2
+            return base | line(x0 - t // 2, middle + t, x0 + self.advance // 3, middle - t, max(1, t // 2))
+        if code in (0x14A, 0x14B):  # Ŋ ŋ: right stem continues into a hook
+            base = P('N' if code == 0x14A else 'n')
+            _, _, x1, _ = bbox(base)
+            return base | box(x1 - t + 1, 0, x1, self.descent - t) | \
+                box(x1 - self.advance // 3, self.descent - t + 1, x1 - t // 2, self.descent)
+        if code in (0x166, 0x167):  # Ŧ ŧ
+            base = P('T' if code == 0x166 else 't')
+            return self.bar(base, -cap // 2 if code == 0x166 else -xh // 2)
+        if code == 0x17F:  # ſ: f without the crossbar's right arm
+            f = P('f')
+            x0, _, x1, _ = bbox(f)
+            stem_right = x0 + (x1 - x0) // 2
+            return frozenset(p for p in f if not (p[0] > stem_right and -xh - t <= p[1] <= -xh + t))
+        return None
+
+    def compose(self, code):
+        if code in self.glyphs:
+            return self.glyphs[code][0]
+        if 0x7F <= code <= 0x9F:
+            return frozenset()  # Control characters
+        pixels = self.special(code)
+        if pixels is not None:
+            return pixels
+        parts = unicodedata.decomposition(chr(code)).split()
+        if len(parts) == 2 and not parts[0].startswith('<'):
+            return self.with_mark(chr(int(parts[0], 16)), int(parts[1], 16))
+        return self.glyphs[ord('?')][0]
+
+
+# --- Writing the font --------------------------------------------------------
+
+def build_font(name, glyphs):
+    composer = Composer(glyphs)
+    bitmap = []
+    entries = []
+    for code in range(FIRST, LAST + 1):
+        pixels = composer.compose(code)
+        offset = len(bitmap)
+        if not pixels:
+            entries.append((offset, 0, 0, composer.advance, 0, 0, code))
+            continue
+        x0, y0, x1, y1 = bbox(pixels)
+        width, height = x1 - x0 + 1, y1 - y0 + 1
+        bits = [1 if (x0 + i % width, y0 + i // width) in pixels else 0 for i in range(width * height)]
+        for i in range(0, len(bits), 8):
+            chunk = bits[i:i + 8] + [0] * (8 - len(bits[i:i + 8]))
+            bitmap.append(sum(bit << (7 - n) for n, bit in enumerate(chunk)))
+        entries.append((offset, width, height, composer.advance, x0, y0, code))
+    if len(bitmap) > 0xFFFF:
+        raise ValueError('%s: bitmap too large for GFXglyph offsets' % name)
+    return bitmap, entries
+
+
+def glyph_bytes(entry):
+    return (entry[1] * entry[2] + 7) // 8
+
+
+def write_header(name, source_name, bitmap, entries, y_advance, path):
+    out = ['// Generated by tools/gen_fonts.py from %s, do not edit' % source_name,
+           '#pragma once', '#include <Adafruit_GFX.h>', '',
+           'const uint8_t %sBitmaps[] PROGMEM = {' % name]
+    for i in range(0, len(bitmap), 12):
+        out.append('  ' + ', '.join('0x%02X' % b for b in bitmap[i:i + 12]) + ',')
+    out += ['};', '', 'const GFXglyph %sGlyphs[] PROGMEM = {' % name]
+    for offset, width, height, advance, x_offset, y_offset, code in entries:
+        out.append('  { %5d, %3d, %3d, %3d, %4d, %4d },  // U+%04X' %
+                   (offset, width, height, advance, x_offset, y_offset, code))
+    out += ['};', '',
+            'const GFXfont %s PROGMEM = {' % name,
+            '  (uint8_t  *)%sBitmaps,' % name,
+            '  (GFXglyph *)%sGlyphs,' % name,
+            '  0x%02X, 0x%03X, %d };' % (FIRST, LAST, y_advance), '']
+    with open(path, 'w') as f:
+        f.write('\n'.join(out))
+
+
+def write_font_file(name, bitmap, entries, y_advance, path):
+    largest = max(glyph_bytes(e) for e in entries)
+    if largest > GLYPH_CACHE_BYTES:
+        raise ValueError('%s: a %d byte glyph does not fit the glyph cache' % (name, largest))
+    out = bytearray(b'EPF1' + struct.pack('<HHBBH', FIRST, LAST, y_advance, 0, largest))
+    for offset, width, height, advance, x_offset, y_offset, _ in entries:
+        out += struct.pack('<HBBBbb', offset, width, height, advance, x_offset, y_offset)
+    out += bytes(bitmap)
+    with open(path, 'wb') as f:
+        f.write(out)
+    return len(out)
+
+
+def up_to_date(target, source):
+    return os.path.exists(target) and os.path.getmtime(target) >= max(os.path.getmtime(source),
+                                                                       os.path.getmtime(__file__))
+
+
+def generate(fonts_dir, out_dir, data_dir=None):
+    font_dir = os.path.join(data_dir, 'fonts') if data_dir else None
+    for directory in (out_dir, font_dir):
+        if directory and not os.path.isdir(directory):
+            os.makedirs(directory)
+    for size in SIZES:
+        source = os.path.join(fonts_dir, 'FreeMonoBold%dpt7b.h' % size)
+        name = 'FreeMonoBoldLatin%dpt' % size
+        header = os.path.join(out_dir, name + '.h')
+        font_file = os.path.join(font_dir, '%s-%d.epf' % (FAMILY, size)) if font_dir else None
+        if up_to_date(header, source) and (font_file is None or up_to_date(font_file, source)):
+            continue
+        glyphs, y_advance = parse_font(source)
+        bitmap, entries = build_font(name, glyphs)
+        write_header(name, os.path.basename(source), bitmap, entries, y_advance, header)
+        print('Generated %s' % header)
+        if font_file:
+            # Linked in, a GFXglyph is 8 bytes with padding; the file packs it in 7
+            linked = len(bitmap) + 8 * len(entries) + 12
+            size_on_flash = write_font_file(name, bitmap, entries, y_advance, font_file)
+            print('Generated %s: %d bytes (%d bytes when linked in), largest glyph %d bytes'
+                  % (font_file, size_on_flash, linked, max(glyph_bytes(e) for e in entries)))
+
+
+def find_fonts_dir(search_dirs):
+    for directory in search_dirs:
+        for match in glob.glob(os.path.join(directory, '*', 'Fonts', 'FreeMonoBold9pt7b.h')):
+            return os.path.dirname(match)
+    return None
+
+
+try:
+    Import('env')  # noqa: F821 (defined when run by PlatformIO)
+except NameError:
+    env = None
+
+if env is not None:
+    __file__ = os.path.join(env.subst('$PROJECT_DIR'), 'tools', 'gen_fonts.py')
+    out_dir = os.path.join(env.subst('$BUILD_DIR'), 'generated')
+    data_dir = env.subst('$PROJECT_DATA_DIR')
+    env.Append(CPPPATH=[out_dir])
+
+    def generate_before_compile(target, source, env):
+        fonts_dir = find_fonts_dir([os.path.join(env.subst('$PROJECT_LIBDEPS_DIR'), env.subst('$PIOENV')),
+                                    env.subst('$PROJECT_LIBDEPS_DIR')])
+        if fonts_dir is None:
+            sys.stderr.write('gen_fonts: Adafruit GFX Library fonts not found in lib_deps\n')
+            env.Exit(1)
+        generate(fonts_dir, out_dir, data_dir)
+
+    if env.subst('$PIOPLATFORM') == 'native':
+        # Host tests include main.cpp from their own sources, so there is no
+        # main.cpp object to wait for; they only need the headers
+        data_dir = None
+        generate_before_compile(None, None, env)
+    else:
+        # The font files are needed by the firmware build (headers) and the
+        # file system image (uploadfs), whichever comes first
+        env.AddPreAction('$BUILD_DIR/src/main.cpp.o', generate_before_compile)
+        env.AddPreAction('$BUILD_DIR/${ESP32_FS_IMAGE_NAME}.bin', generate_before_compile)
+elif __name__ == '__main__':
+    if len(sys.argv) not in (3, 4):
+        sys.exit(__doc__)
+    generate(sys.argv[1], sys.argv[2], sys.argv[3] if len(sys.argv) == 4 else None)
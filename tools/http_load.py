@@ -0,0 +1,112 @@
+"""
+Load test for the web server with several clients at once.
+
+Each client opens a connection and loads the page the way a phone does
+(the page, then the stylesheet), sending a message now and then, and
+reports latency percentiles over all requests. Connections are kept alive
+unless --close is given.
+
+Against a device on its access point, 12 clients for 20 s:
+
+    python tools/http_load.py --host 192.168.4.1 -c 12 -d 20
+
+Compare with a new connection per request:
+
+    python tools/http_load.py --host 192.168.4.1 -c 12 -d 20 --close
+"""
+import argparse
+import http.client
+import statistics
+import threading
+import time
+import urllib.parse
+
+# One page load, as (method, path, body)
+PAGE_LOAD = [('GET', '/', None), ('GET', '/style.css', None)]
+
+
+def client(args, index, deadline, latencies, failures, counts):
+    conn = None
+    n = 0
+    while time.monotonic() < deadline:
+        requests = list(PAGE_LOAD)
+        if args.send_every and n % args.send_every == args.send_every - 1:
+            body = urllib.parse.urlencode({'message': 'Load test %d.%d' % (index, n), 'fontsize': 2})
+            requests.append(('POST', '/send', body))
+        n += 1
+        for method, path, body in requests:
+            start = time.perf_counter()
+            headers = {'Connection': 'close'} if args.close else {}
+            if body is not None:
+                headers['Content-Type'] = 'application/x-www-form-urlencoded'
+            ok = False
+            # A kept-alive connection the server closed while idle is retried
+            # on a new one, the same as browsers do
+            for attempt in range(2):
+                reused = conn is not None
+                try:
+                    if conn is None:
+                        conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+                        counts['connections'] += 1
+                    conn.request(method, path, body, headers)
+                    response = conn.getresponse()
+                    response.read()
+                    ok = response.status in (200, 304)
+                    if args.close or response.will_close:
+                        conn.close()
+                        conn = None
+                    break
+                except (OSError, http.client.HTTPException) as e:
+                    if conn is not None:
+                        conn.close()
+                    conn = None
+                    closed_idle = isinstance(e, (http.client.RemoteDisconnected, ConnectionResetError, BrokenPipeError))
+                    if not (reused and closed_idle):
+                        break
+                    counts['retries'] += 1
+            elapsed = time.perf_counter() - start
+            (latencies if ok else failures).append(elapsed)
+    if conn is not None:
+        conn.close()
+
+
+def percentile(values, fraction):
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host', default='192.168.4.1')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('-c', '--clients', type=int, default=12, help='clients at once (8-16 is a crowded room)')
+    parser.add_argument('-d', '--duration', type=float, default=10, help='seconds')
+    parser.add_argument('--send-every', type=int, default=5, help='page loads per message sent (0 = never)')
+    parser.add_argument('--close', action='store_true', help='new connection for every request')
+    parser.add_argument('--timeout', type=float, default=10)
+    args = parser.parse_args()
+
+    latencies, failures = [], []
+    counts = {'connections': 0, 'retries': 0}
+    deadline = time.monotonic() + args.duration
+    threads = [threading.Thread(target=client, args=(args, i, deadline, latencies, failures, counts))
+               for i in range(args.clients)]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    wall = time.perf_counter() - start
+
+    print('%d clients for %.0f s (%s): %d requests, %d failed, %d connections, %d retried'
+          % (args.clients, wall, 'close' if args.close else 'keep-alive', len(latencies) + len(failures),
+             len(failures), counts['connections'], counts['retries']))
+    if latencies:
+        latencies.sort()
+        ms = [v * 1000 for v in latencies]
+        print('latency ms: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f'
+              % (statistics.median(ms), percentile(ms, 0.90), percentile(ms, 0.99), ms[-1]))
+        print('throughput: %.1f requests/s' % (len(latencies) / wall))
+
+
+if __name__ == '__main__':
+    main()
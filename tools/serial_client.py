@@ -0,0 +1,374 @@
+"""
+Host side of the framed serial control protocol.
+
+Frames are 0xA5, type, seq, payload length (u16 LE), payload and a CRC-32
+(LE, zlib's) of type through payload; see SerialType in src/main.cpp. Every
+command gets a reply of the same type with 0x80 set, whose payload starts
+with a status byte. Once the device has seen a valid frame its log lines come
+as SERIAL_LOG frames too.
+
+    python tools/serial_client.py --port /dev/ttyUSB0 hello
+    python tools/serial_client.py --port /dev/ttyUSB0 --baud 921600 message "Halló heimur" --font 3
+    python tools/serial_client.py --port /dev/ttyUSB0 --baud 921600 image picture.pbm
+    python tools/serial_client.py --port /dev/ttyUSB0 metrics
+    python tools/serial_client.py --port /dev/ttyUSB0 logs
+
+--baud switches the device to a faster rate after the hello; if the host
+never talks at the new rate the device goes back to 115200 on its own.
+
+Without hardware, --stand-in runs the commands against a stand-in device on
+a pseudo terminal that parses the same frames, and selftest runs them all:
+
+    python tools/serial_client.py --stand-in selftest
+"""
+import argparse
+import os
+import struct
+import sys
+import threading
+import time
+import zlib
+
+SYNC = 0xA5
+MAX_PAYLOAD = 1024
+DEFAULT_BAUD = 115200
+BAUD_RATES = (115200, 230400, 460800, 921600, 1500000, 2000000)
+HELLO, SET_BAUD, SET_MESSAGE, SET_FONT = 0x01, 0x02, 0x10, 0x11
+IMAGE_START, IMAGE_DATA, IMAGE_END, READ_METRICS, LOG, REPLY = 0x20, 0x21, 0x22, 0x30, 0x7F, 0x80
+STATUS = ['ok', 'bad frame', 'bad command', 'bad arguments', 'busy']
+IMAGE_FORMATS = {'pbm': 0, 'raw': 1, 'rle': 2}
+FRAME_WIDTH, FRAME_HEIGHT = 416, 240
+
+
+def frame(kind, seq, payload=b''):
+    header = struct.pack('<BBH', kind, seq, len(payload))
+    crc = zlib.crc32(header + payload) & 0xFFFFFFFF
+    return bytes([SYNC]) + header + payload + struct.pack('<I', crc)
+
+
+class FrameReader:
+    """Pulls frames out of a byte stream, skipping anything between them.
+    With whole_frames a frame failing the CRC is dropped as a whole and
+    returned with None for the payload, like the firmware does."""
+
+    def __init__(self, read, whole_frames=False):
+        self.read = read
+        self.whole_frames = whole_frames
+        self.buffer = bytearray()
+        self.bad = 0
+
+    def next(self, timeout):
+        deadline = time.monotonic() + timeout
+        while True:
+            start = self.buffer.find(bytes([SYNC]))
+            if start < 0:
+                self.buffer.clear()
+            elif start > 0:
+                del self.buffer[:start]
+            if len(self.buffer) >= 5:
+                kind, seq, length = struct.unpack_from('<BBH', self.buffer, 1)
+                if length > MAX_PAYLOAD:
+                    self.bad += 1
+                    del self.buffer[:1]
+                    continue
+                if len(self.buffer) >= 5 + length + 4:
+                    payload = bytes(self.buffer[5:5 + length])
+                    crc, = struct.unpack_from('<I', self.buffer, 5 + length)
+                    if crc != zlib.crc32(bytes(self.buffer[1:5 + length])) & 0xFFFFFFFF:
+                        self.bad += 1
+                        if self.whole_frames:
+                            del self.buffer[:5 + length + 4]
+                            return kind, seq, None
+                        del self.buffer[:1]
+                        continue
+                    del self.buffer[:5 + length + 4]
+                    return kind, seq, payload
+            left = deadline - time.monotonic()
+            if left <= 0:
+                return None
+            self.buffer += self.read(left)
+
+
+# --- Port access -------------------------------------------------------------
+
+class Port:
+    """pyserial if it is installed, termios otherwise (Linux and macOS)."""
+
+    def __init__(self, path, baud):
+        try:
+            import serial
+            self.serial = serial.Serial(path, baud, timeout=0.05)
+            self.fd = None
+        except ImportError:
+            self.serial = None
+            self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+            self.set_baud(baud)
+
+    def set_baud(self, baud):
+        if self.serial:
+            self.serial.baudrate = baud
+            return
+        import termios
+        import tty
+        tty.setraw(self.fd)
+        attrs = termios.tcgetattr(self.fd)
+        speed = getattr(termios, 'B%d' % baud, None)
+        if speed is None:
+            raise SystemExit('%d baud needs pyserial on this system' % baud)
+        attrs[4] = attrs[5] = speed
+        termios.tcsetattr(self.fd, termios.TCSADRAIN, attrs)
+
+    def write(self, data):
+        if self.serial:
+            self.serial.write(data)
+            self.serial.flush()
+        else:
+            os.write(self.fd, data)
+
+    def read(self, timeout):
+        if self.serial:
+            self.serial.timeout = min(timeout, 0.05)
+            return self.serial.read(max(1, self.serial.in_waiting))
+        import select
+        ready, _, _ = select.select([self.fd], [], [], min(timeout, 0.05))
+        return os.read(self.fd, 4096) if ready else b''
+
+
+class Device:
+    def __init__(self, port, timeout):
+        self.port = port
+        self.timeout = timeout
+        self.reader = FrameReader(port.read)
+        self.seq = 0
+        self.logs = []
+
+    def command(self, kind, payload=b''):
+        self.seq = (self.seq + 1) & 0xFF
+        self.port.write(frame(kind, self.seq, payload))
+        deadline = time.monotonic() + self.timeout
+        while time.monotonic() < deadline:
+            got = self.reader.next(deadline - time.monotonic())
+            if got is None:
+                break
+            kind_in, seq_in, data = got
+            if kind_in == LOG:
+                self.logs.append(data)
+            elif kind_in == kind | REPLY and seq_in == self.seq:
+                if data[0] != 0:
+                    status = STATUS[data[0]] if data[0] < len(STATUS) else str(data[0])
+                    raise RuntimeError('%s: %s %s' % (hex(kind), status, data[1:].decode('utf-8', 'replace')))
+                return data[1:]
+        raise RuntimeError('no reply to %s' % hex(kind))
+
+    def hello(self):
+        version, max_payload, baud = struct.unpack('<BHI', self.command(HELLO))
+        return version, max_payload, baud
+
+    def set_baud(self, baud):
+        self.command(SET_BAUD, struct.pack('<I', baud))
+        self.port.set_baud(baud)
+        self.hello()  # Confirms the new rate, or the device goes back after 2 s
+
+    def message(self, text, font=0, full=False):
+        return struct.unpack('<I', self.command(SET_MESSAGE, bytes([font, int(full)]) + text.encode('utf-8')))[0]
+
+    def font(self, size):
+        return struct.unpack('<I', self.command(SET_FONT, bytes([size])))[0]
+
+    def image(self, body, kind):
+        self.command(IMAGE_START, struct.pack('<BI', IMAGE_FORMATS[kind], len(body)))
+        for i in range(0, len(body), MAX_PAYLOAD):
+            self.command(IMAGE_DATA, body[i:i + MAX_PAYLOAD])
+        return struct.unpack('<I', self.command(IMAGE_END))[0]
+
+    def metrics(self):
+        return self.command(READ_METRICS).decode()
+
+    def follow_logs(self, seconds):
+        # Logs only come framed once a frame has been sent
+        self.hello()
+        end = time.monotonic() + seconds
+        while time.monotonic() < end:
+            for entry in self.logs:
+                millis, level = struct.unpack_from('<IB', entry)
+                print('[%d] %s %s' % (millis, '-EWIDT'[level], entry[5:].decode('utf-8', 'replace')))
+            self.logs.clear()
+            got = self.reader.next(0.2)
+            if got and got[0] == LOG:
+                self.logs.append(got[2])
+
+
+# --- Stand-in device ---------------------------------------------------------
+
+class StandIn:
+    """Parses frames like the firmware does and answers on a pseudo terminal."""
+
+    def __init__(self, fd):
+        self.fd = fd
+        self.reader = FrameReader(self.read, whole_frames=True)
+        self.sequence = 0
+        self.frames = 0
+        self.baud = DEFAULT_BAUD
+        self.image = None
+        self.font = 2
+
+    def read(self, timeout):
+        import select
+        ready, _, _ = select.select([self.fd], [], [], min(timeout, 0.05))
+        return os.read(self.fd, 4096) if ready else b''
+
+    def reply(self, kind, seq, status=0, data=b''):
+        os.write(self.fd, frame(kind | REPLY, seq, bytes([status]) + data))
+
+    def log(self, level, text):
+        os.write(self.fd, frame(LOG, 0, struct.pack('<IB', int(time.monotonic() * 1000) & 0xFFFFFFFF, level)
+                                + text.encode()))
+
+    def run(self):
+        while True:
+            got = self.reader.next(3600)
+            if got and got[2] is None:
+                self.reply(got[0], got[1], 1)
+            elif got:
+                self.frames += 1
+                self.handle(*got)
+
+    def render(self, what):
+        self.sequence += 1
+        self.log(4, 'Render %d: %s' % (self.sequence, what))
+        return struct.pack('<I', self.sequence)
+
+    def handle(self, kind, seq, p):
+        if kind == HELLO:
+            return self.reply(kind, seq, 0, struct.pack('<BHI', 1, MAX_PAYLOAD, self.baud))
+        if kind == SET_BAUD and len(p) == 4 and struct.unpack('<I', p)[0] in BAUD_RATES:
+            self.baud = struct.unpack('<I', p)[0]
+            return self.reply(kind, seq)
+        if kind == SET_MESSAGE and len(p) >= 2:
+            self.font = p[0] if 1 <= p[0] <= 5 else self.font
+            return self.reply(kind, seq, 0, self.render(p[2:].decode('utf-8', 'replace')))
+        if kind == SET_FONT and len(p) == 1 and 1 <= p[0] <= 5:
+            self.font = p[0]
+            return self.reply(kind, seq, 0, self.render('font %d' % p[0]))
+        if kind == IMAGE_START and len(p) == 5 and p[0] <= 2:
+            self.image = [struct.unpack_from('<I', p, 1)[0], bytearray()]
+            return self.reply(kind, seq)
+        if kind == IMAGE_DATA and self.image:
+            self.image[1] += p
+            if len(self.image[1]) > self.image[0]:
+                self.image = None
+                return self.reply(kind, seq, 3, b'more data than announced')
+            return self.reply(kind, seq)
+        if kind == IMAGE_END and self.image:
+            length, body = self.image
+            self.image = None
+            if len(body) != length:
+                return self.reply(kind, seq, 3, b'image data incomplete')
+            return self.reply(kind, seq, 0, self.render('image, %d bytes' % length))
+        if kind == READ_METRICS:
+            text = 'renders %d\nfont %d\nserial_frames %d\nserial_baud %d\n' % (
+                self.sequence, self.font, self.frames, self.baud)
+            return self.reply(kind, seq, 0, text.encode())
+        known = (HELLO, SET_BAUD, SET_MESSAGE, SET_FONT, IMAGE_START, IMAGE_DATA, IMAGE_END, READ_METRICS)
+        self.reply(kind, seq, 3 if kind in known else 2)
+
+
+def start_stand_in():
+    device, host = os.openpty()
+    threading.Thread(target=StandIn(device).run, daemon=True).start()
+    return os.ttyname(host)
+
+
+# --- Commands ----------------------------------------------------------------
+
+def test_image():
+    """An RLE image of horizontal stripes, 8 rows each."""
+    runs = bytearray()
+    for row in range(FRAME_HEIGHT // 8):
+        runs += bytes([(0x80 if row % 2 else 0) | 127]) * (FRAME_WIDTH * 8 // 128)
+    return b'R1' + struct.pack('<HH', FRAME_WIDTH, FRAME_HEIGHT) + bytes(runs)
+
+
+def selftest(device):
+    version, max_payload, baud = device.hello()
+    print('hello: version %d, max payload %d, %d baud' % (version, max_payload, baud))
+    device.set_baud(921600)
+    print('baud: now %d' % device.hello()[2])
+    print('message: seq %d' % device.message('Halló heimur', font=3))
+    print('font: seq %d' % device.font(2))
+    body = test_image()
+    start = time.monotonic()
+    seq = device.image(body, 'rle')
+    print('image: seq %d, %d bytes in %.0f ms' % (seq, len(body), (time.monotonic() - start) * 1000))
+    for bad, expected in ((bytes([IMAGE_START, 0]), 'bad arguments'), (bytes([0x55]), 'bad command')):
+        try:
+            device.command(bad[0], bad[1:])
+            raise SystemExit('0x%02x was accepted' % bad[0])
+        except RuntimeError as e:
+            assert expected in str(e), e
+    # A corrupted frame is answered with "bad frame" and nothing runs
+    corrupt = bytearray(frame(SET_FONT, 0xEE, b'\x01'))
+    corrupt[-1] ^= 0xFF
+    device.port.write(bytes(corrupt))
+    got = device.reader.next(device.timeout)
+    assert got and got[0] == SET_FONT | REPLY and got[2][:1] == b'\x01', got
+    print('metrics:\n' + device.metrics().rstrip())
+    print('%d log frames received' % len(device.logs))
+    print('selftest passed')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--port', help='serial port of the device')
+    parser.add_argument('--stand-in', action='store_true', help='talk to a local stand-in device')
+    parser.add_argument('--baud', type=int, choices=BAUD_RATES, help='switch to this rate after connecting')
+    parser.add_argument('--timeout', type=float, default=2)
+    sub = parser.add_subparsers(dest='command', required=True)
+    sub.add_parser('hello')
+    p = sub.add_parser('message')
+    p.add_argument('text')
+    p.add_argument('--font', type=int, default=0, help='1-4, 5 auto-fit, 0 keeps the current size')
+    p.add_argument('--full', action='store_true', help='full refresh')
+    p = sub.add_parser('font')
+    p.add_argument('size', type=int, choices=range(1, 6), help='1-4, 5 auto-fit')
+    p = sub.add_parser('image')
+    p.add_argument('file')
+    p.add_argument('--format', choices=IMAGE_FORMATS, help='default: from the first byte')
+    sub.add_parser('metrics')
+    p = sub.add_parser('logs')
+    p.add_argument('--seconds', type=float, default=30)
+    sub.add_parser('selftest')
+    args = parser.parse_args()
+
+    if args.stand_in:
+        args.port = start_stand_in()
+    elif not args.port:
+        parser.error('--port or --stand-in is required')
+    device = Device(Port(args.port, DEFAULT_BAUD), args.timeout)
+    try:
+        if args.command == 'selftest':
+            return selftest(device)
+        if args.baud and args.baud != DEFAULT_BAUD:
+            device.hello()
+            device.set_baud(args.baud)
+        if args.command == 'hello':
+            print('version %d, max payload %d, %d baud' % device.hello())
+        elif args.command == 'message':
+            print('seq %d' % device.message(args.text, args.font, args.full))
+        elif args.command == 'font':
+            print('seq %d' % device.font(args.size))
+        elif args.command == 'image':
+            with open(args.file, 'rb') as f:
+                body = f.read()
+            kind = args.format or {b'P': 'pbm', b'R': 'rle'}.get(body[:1], 'raw')
+            print('seq %d' % device.image(body, kind))
+        elif args.command == 'metrics':
+            print(device.metrics(), end='')
+        elif args.command == 'logs':
+            device.follow_logs(args.seconds)
+    except RuntimeError as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()